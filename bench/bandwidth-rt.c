@@ -34,6 +34,9 @@
 #include <getopt.h>
 #include <time.h>
 #include <pthread.h>
+#include <math.h>
+
+#include "isolbench.h"
 
 /**************************************************************************
  * Public Definitions
@@ -48,11 +51,33 @@
 #define MAX(a,b) ((a>b)?(a):(b))
 #define MIN(a,b) ((a>b)?(b):(a))
 
+#define MAX_THREADS 32
+#define DEFAULT_BLOCK_SIZE 50	   /* jobs per block for block maxima */
+#define DEFAULT_POT_QUANTILE 0.90  /* peaks-over-threshold threshold */
+#define MIN_EVT_SAMPLES 10	   /* minimum #of maxima/exceedances to fit */
+
 /**************************************************************************
  * Public Types
  **************************************************************************/
 enum access_type { READ, WRITE};
 
+/* how the threads' working sets map onto memory */
+enum share_mode {
+	SHARED,		/* every thread streams the same buffer */
+	PRIVATE,	/* per-thread malloc */
+	PARTITION,	/* disjoint slices of one buffer */
+	ADJACENT,	/* neighboring threads access adjacent lines */
+	SAMELINE,	/* every thread writes its own word of the same lines */
+};
+
+static const char *share_mode_names[] = {
+	[SHARED]	= "shared",
+	[PRIVATE]	= "private",
+	[PARTITION]	= "partition",
+	[ADJACENT]	= "adjacent",
+	[SAMELINE]	= "sameline",
+};
+
 struct periodic_info
 {
 	int id;
@@ -63,6 +88,28 @@ struct periodic_info
 	int wakeups_missed;	
 };
 
+/* per-thread job execution times (us), kept for pWCET analysis */
+struct job_samples
+{
+	unsigned int *duration;
+	int nr;
+	int max;
+	int dropped;		/* jobs not kept: out of memory */
+};
+
+/* fitted extreme value distribution and its goodness-of-fit */
+struct evt_fit
+{
+	double loc;		/* gumbel: mu, gpd: threshold u */
+	double scale;		/* gumbel: beta, gpd: sigma */
+	double shape;		/* gpd: xi (0 for gumbel) */
+	double rate;		/* gpd: fraction of jobs above threshold */
+	double ks_d;		/* Kolmogorov-Smirnov statistic */
+	double ks_p;		/* KS p-value (approximate) */
+	double ad;		/* Anderson-Darling statistic */
+	int n;			/* #of fitted points */
+};
+
 /**************************************************************************
  * Global Variables
  **************************************************************************/
@@ -77,54 +124,396 @@ int jobs = 0;
 int period = 0; /* in ms */
 int verbose = 0;
 int cpuid = 0;
-int is_thread_local = 0;
+int share_mode = SHARED;
+int block_size = DEFAULT_BLOCK_SIZE;
+double pot_quantile = DEFAULT_POT_QUANTILE;
+char *dump_file = NULL;
+int counters = 0;
+char *events = NULL;
+
+struct job_samples g_samples[MAX_THREADS];
+struct ib_counters *g_counters[MAX_THREADS]; /* per-thread, --counters */
+
+/* per-job exceedance probabilities to report pWCET at */
+static const double pwcet_probs[] = { 1e-6, 1e-7, 1e-8, 1e-9, 1e-10, 1e-11, 1e-12 };
 
 volatile uint64_t g_nread = 0;	           /* number of bytes read */
+/* per-thread bytes read, a cache line each so the threads don't share */
+struct thread_nread {
+	volatile uint64_t bytes;
+} __attribute__((aligned(CACHE_LINE_SIZE))) g_thread_nread[MAX_THREADS];
 volatile unsigned int g_start;		   /* starting time */
+volatile int g_go = 0;			   /* set by main once all are ready */
+volatile sig_atomic_t g_stop = 0;	   /* set by quit(), workers stop */
 
 /**************************************************************************
  * Public Functions
  **************************************************************************/
 unsigned int get_usecs()
 {
-	struct timeval         time;
-	gettimeofday(&time, NULL);
-	return (time.tv_sec * 1000000 +	time.tv_usec);
+	return ib_now_ns() / 1000;
+}
+
+/*
+ * job execution time samples
+ */
+void record_job(int id, unsigned int duration)
+{
+	struct job_samples *s = &g_samples[id];
+
+	if (s->nr >= s->max) {
+		int max = (s->max) ? s->max * 2 : ((jobs > 0) ? jobs : 1024);
+		unsigned int *p = realloc(s->duration, max * sizeof(unsigned int));
+		if (!p) {
+			s->dropped++; /* keep what we have */
+			return;
+		}
+		s->duration = p;
+		s->max = max;
+	}
+	s->duration[s->nr++] = duration;
+}
+
+void dump_samples(const char *filename)
+{
+	FILE *fp;
+	int i, j;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		return;
+	}
+	fprintf(fp, "# thread job duration_us\n");
+	for (i = 0; i < MIN(g_nthreads, MAX_THREADS); i++)
+		for (j = 0; j < g_samples[i].nr; j++)
+			fprintf(fp, "%d %d %u\n", i, j, g_samples[i].duration[j]);
+	fclose(fp);
+	printf("dumped job samples to %s\n", filename);
+}
+
+/*
+ * extreme value analysis (pWCET)
+ */
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double mean_of(const double *x, int n)
+{
+	double sum = 0;
+	int i;
+	for (i = 0; i < n; i++)
+		sum += x[i];
+	return sum / n;
+}
+
+static double gumbel_cdf(const struct evt_fit *f, double x)
+{
+	return exp(-exp(-(x - f->loc) / f->scale));
+}
+
+/* tail distribution of the exceedances y = x - u */
+static double gpd_cdf(const struct evt_fit *f, double y)
+{
+	if (y <= 0)
+		return 0;
+	if (fabs(f->shape) < 1e-9)
+		return 1 - exp(-y / f->scale);
+	if (1 + f->shape * y / f->scale <= 0)
+		return 1; /* beyond the upper end point (xi < 0) */
+	return 1 - pow(1 + f->shape * y / f->scale, -1 / f->shape);
+}
+
+/* Kolmogorov distribution tail Q_ks(lambda) */
+static double ks_prob(double lambda)
+{
+	double sum = 0, term;
+	int j;
+
+	if (lambda < 0.2)
+		return 1;
+	for (j = 1; j <= 100; j++) {
+		term = 2 * ((j & 1) ? 1 : -1) * exp(-2 * j * j * lambda * lambda);
+		sum += term;
+		if (fabs(term) < 1e-10)
+			break;
+	}
+	return MIN(MAX(sum, 0), 1);
+}
+
+/*
+ * KS and Anderson-Darling statistics of sorted x[] against cdf. The
+ * parameters are estimated from the same data, so the p-value is optimistic.
+ */
+static void goodness_of_fit(struct evt_fit *f, const double *x, int n,
+			    double (*cdf)(const struct evt_fit *, double))
+{
+	double d = 0, ad = 0, sq = sqrt(n);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		double lo = cdf(f, x[i]);
+		double hi = cdf(f, x[n - 1 - i]);
+		d = MAX(d, MAX((double)(i + 1) / n - lo, lo - (double)i / n));
+		lo = MIN(MAX(lo, 1e-300), 1 - 1e-16);
+		hi = MIN(MAX(hi, 1e-300), 1 - 1e-16);
+		ad += (2 * i + 1) * (log(lo) + log1p(-hi));
+	}
+	f->ks_d = d;
+	f->ks_p = ks_prob((sq + 0.12 + 0.11 / sq) * d);
+	f->ad = -n - ad / n;
+}
+
+/*
+ * Gumbel fit of the block maxima by maximum likelihood (Newton on the
+ * scale parameter, starting from the method of moments estimate).
+ */
+static int fit_gumbel(struct evt_fit *f, double *max, int n)
+{
+	double m = mean_of(max, n), var = 0, beta, sw, swx, swxx;
+	int i, k;
+
+	qsort(max, n, sizeof(double), cmp_double);
+	for (i = 0; i < n; i++)
+		var += (max[i] - m) * (max[i] - m);
+	var /= (n - 1);
+	if (var <= 0)
+		return -1;
+
+	beta = sqrt(6 * var) / M_PI;
+	for (k = 0; k < 100; k++) {
+		double g, dg, ex, ex2, step;
+		sw = swx = swxx = 0;
+		for (i = 0; i < n; i++) {
+			double w = exp(-(max[i] - max[0]) / beta);
+			sw += w;
+			swx += w * max[i];
+			swxx += w * max[i] * max[i];
+		}
+		ex = swx / sw;
+		ex2 = swxx / sw;
+		g = beta - m + ex;
+		dg = 1 + (ex2 - ex * ex) / (beta * beta);
+		step = g / dg;
+		if (beta - step <= 0)
+			step = beta / 2;
+		beta -= step;
+		if (fabs(step) < 1e-9 * beta)
+			break;
+	}
+	sw = 0;
+	for (i = 0; i < n; i++)
+		sw += exp(-(max[i] - max[0]) / beta);
+
+	f->loc = max[0] - beta * log(sw / n);
+	f->scale = beta;
+	f->shape = 0;
+	f->rate = 1;
+	f->n = n;
+	goodness_of_fit(f, max, n, gumbel_cdf);
+	return 0;
+}
+
+/*
+ * Generalized Pareto fit of the exceedances over the threshold by
+ * probability weighted moments (Hosking & Wallis, 1987). y[] is sorted.
+ */
+static int fit_gpd(struct evt_fit *f, double u, double *y, int n, int total)
+{
+	double a0 = mean_of(y, n), a1 = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		a1 += (1 - (i + 1 - 0.35) / n) * y[i];
+	a1 /= n;
+	if (a0 - 2 * a1 <= 0)
+		return -1;
+
+	f->loc = u;
+	f->shape = 2 - a0 / (a0 - 2 * a1);
+	f->scale = 2 * a0 * a1 / (a0 - 2 * a1);
+	f->rate = (double)n / total;
+	f->n = n;
+	goodness_of_fit(f, y, n, gpd_cdf);
+	return 0;
+}
+
+/* per-job pWCET at exceedance probability p */
+static double gumbel_pwcet(const struct evt_fit *f, double p)
+{
+	/* a block of block_size jobs stays below x with (1-p)^block_size */
+	return f->loc - f->scale * log(-block_size * log1p(-p));
+}
+
+static double gpd_pwcet(const struct evt_fit *f, double p)
+{
+	if (p >= f->rate)
+		return f->loc;
+	if (fabs(f->shape) < 1e-9)
+		return f->loc + f->scale * log(f->rate / p);
+	return f->loc + f->scale / f->shape * (pow(p / f->rate, -f->shape) - 1);
+}
+
+static void print_fit(const char *name, const struct evt_fit *f)
+{
+	printf("  %s: loc=%.2f scale=%.2f shape=%.4f n=%d | KS D=%.4f p=%.3f | AD A2=%.3f\n",
+	       name, f->loc, f->scale, f->shape, f->n, f->ks_d, f->ks_p, f->ad);
+}
+
+void pwcet_analysis(int id)
+{
+	struct job_samples *s = &g_samples[id];
+	struct evt_fit gumbel = { 0 }, gpd = { 0 };
+	int has_gumbel = 0, has_gpd = 0;
+	int n = s->nr, nblocks, nexc, i, j;
+	double *x, *max, *y, u;
+
+	if (n == 0)
+		return;
+	x = malloc(n * sizeof(double));
+	if (!x) {
+		perror("pwcet");
+		return;
+	}
+	for (i = 0; i < n; i++)
+		x[i] = s->duration[i];
+
+	printf("thread %d pWCET: %d jobs, mean=%.2f us\n", id, n, mean_of(x, n));
+	if (s->dropped)
+		printf("  warning: %d later jobs dropped (out of memory), the fit is of the first %d\n",
+		       s->dropped, n);
+
+	/* block maxima (in job order) */
+	nblocks = n / block_size;
+	if (nblocks >= MIN_EVT_SAMPLES) {
+		max = malloc(nblocks * sizeof(double));
+		if (!max) {
+			perror("pwcet");
+			free(x);
+			return;
+		}
+		for (i = 0; i < nblocks; i++) {
+			max[i] = x[i * block_size];
+			for (j = 1; j < block_size; j++)
+				max[i] = MAX(max[i], x[i * block_size + j]);
+		}
+		has_gumbel = (fit_gumbel(&gumbel, max, nblocks) == 0);
+		free(max);
+	} else {
+		printf("  gumbel: need %d blocks of %d jobs, have %d\n",
+		       MIN_EVT_SAMPLES, block_size, nblocks);
+	}
+
+	/* peaks over threshold */
+	qsort(x, n, sizeof(double), cmp_double);
+	u = x[MIN((int)(pot_quantile * n), n - 1)];
+	for (i = 0; i < n && x[i] <= u; i++);
+	nexc = n - i;
+	if (nexc >= MIN_EVT_SAMPLES) {
+		y = malloc(nexc * sizeof(double));
+		if (!y) {
+			perror("pwcet");
+			free(x);
+			return;
+		}
+		for (j = 0; j < nexc; j++)
+			y[j] = x[i + j] - u;
+		has_gpd = (fit_gpd(&gpd, u, y, nexc, n) == 0);
+		free(y);
+	} else {
+		printf("  gpd: need %d exceedances over %.0f us, have %d\n",
+		       MIN_EVT_SAMPLES, u, nexc);
+	}
+	printf("  observed max=%.0f us\n", x[n - 1]);
+
+	if (has_gumbel)
+		print_fit("gumbel (block maxima)", &gumbel);
+	if (has_gpd)
+		print_fit("gpd (peaks over threshold)", &gpd);
+	if (has_gumbel || has_gpd) {
+		printf("  %-12s %14s %14s\n", "exceedance", "gumbel(us)", "gpd(us)");
+		for (i = 0; i < sizeof(pwcet_probs) / sizeof(pwcet_probs[0]); i++) {
+			printf("  %-12.0e", pwcet_probs[i]);
+			if (has_gumbel)
+				printf(" %14.2f", gumbel_pwcet(&gumbel, pwcet_probs[i]));
+			else
+				printf(" %14s", "-");
+			if (has_gpd)
+				printf(" %14.2f", gpd_pwcet(&gpd, pwcet_probs[i]));
+			else
+				printf(" %14s", "-");
+			printf("\n");
+		}
+	}
+	free(x);
 }
 
+/*
+ * SIGINT/SIGTERM/SIGHUP/SIGALRM: only ask the workers to stop. main
+ * reports once they are joined, record_job() may still grow the samples
+ */
 void quit(int param)
+{
+	g_stop = 1;
+}
+
+void report(void)
 {
 	float dur_in_sec;
 	float bw;
 	float dur = get_usecs() - g_start;
+	struct ib_counters total;
+	int i, k;
 	dur_in_sec = (float)dur / 1000000;
 	printf("g_nread(bytes read) = %lld\n", (long long)g_nread);
 	printf("elapsed = %.2f sec ( %.0f usec )\n", dur_in_sec, dur);
 	bw = (float)g_nread / dur_in_sec / 1024 / 1024;
 	printf("CPU%d: B/W = %.2f MB/s | ",cpuid, bw);
 	printf("CPU%d: average = %.2f ns\n", cpuid, (dur*1000)/(g_nread/CACHE_LINE_SIZE));
-	exit(0);
+	for (i = 0; g_nthreads > 1 && i < g_nthreads; i++) {
+		bw = (float)g_thread_nread[i].bytes / dur_in_sec / 1024 / 1024;
+		printf("thread %d (CPU%d): B/W = %.2f MB/s | average = %.2f ns\n",
+		       i, (cpuid + i) % (int)sysconf(_SC_NPROCESSORS_CONF), bw,
+		       (dur*1000)/(g_thread_nread[i].bytes/CACHE_LINE_SIZE));
+	}
+	ib_result("elapsed_s", dur_in_sec);
+	ib_result("bandwidth_mbs", (float)g_nread / dur_in_sec / 1024 / 1024);
+	ib_result("average_ns", (dur*1000)/(g_nread/CACHE_LINE_SIZE));
+
+	/* each worker stopped its own counters; the driver gets their sum */
+	for (i = 0; i < MIN(g_nthreads, MAX_THREADS); i++) {
+		char prefix[32];
+
+		snprintf(prefix, sizeof(prefix), "thread %d counters: ", i);
+		ib_counters_print(stdout, prefix, g_counters[i], NULL);
+	}
+	if (g_counters[0]) {
+		total = *g_counters[0];
+		for (i = 1; i < MIN(g_nthreads, MAX_THREADS); i++)
+			for (k = 0; k < total.nr; k++)
+				total.value[k] += g_counters[i]->value[k];
+		ib_counters_result(&total);
+	}
+	for (i = 0; i < MIN(g_nthreads, MAX_THREADS); i++)
+		pwcet_analysis(i);
+	if (dump_file)
+		dump_samples(dump_file);
 }
 
-int64_t bench_read(char *mem_ptr)
+int64_t bench_read(char *mem_ptr, long start, long stride, long end)
 {
-	int i;	
-	int64_t sum = 0;
-	for ( i = 0; i < g_mem_size; i+=(CACHE_LINE_SIZE) ) {
-		sum += mem_ptr[i];
-	}
-	// g_nread += g_mem_size;	
+	int64_t sum = ib_read(mem_ptr, start, stride, end);
+
 	__atomic_fetch_add(&g_nread, g_mem_size, __ATOMIC_SEQ_CST);
 	return sum;
 }
 
-int bench_write(char *mem_ptr)
+int bench_write(char *mem_ptr, long start, long stride, long end)
 {
-	register int i;
-	for ( i = 0; i < g_mem_size; i+=(CACHE_LINE_SIZE) ) {
-		mem_ptr[i] = 0xff;
-	}
-	// g_nread += g_mem_size;	
+	ib_write(mem_ptr, start, stride, end, 0xff);
 	__atomic_fetch_add(&g_nread, g_mem_size, __ATOMIC_SEQ_CST);	
 	return 1;
 }
@@ -185,47 +574,95 @@ void worker(void *param)
 {
 	int64_t sum = 0;
 	int i,j;
-	char *l_mem_ptr;
+	char *l_mem_ptr = g_mem_ptr;
+	long start = 0, stride = CACHE_LINE_SIZE, end = g_mem_size;
+	uint64_t last_value[IB_MAX_COUNTERS] = { 0 };
+	struct ib_counters *pmu = NULL;
 	
 	struct periodic_info *info = (struct periodic_info *)param;
 
+	/* pin first: the PRIVATE buffer is placed on first touch */
+	if (ib_pin_cpu((cpuid + info->id) % sysconf(_SC_NPROCESSORS_CONF)) < 0)
+		perror("error");
+
 	/*
-	 * allocate contiguous region of memory 
+	 * every mode touches g_mem_size/CACHE_LINE_SIZE lines per iteration
 	 */
-	if (is_thread_local) {
-		l_mem_ptr = malloc(g_mem_size);
+	switch (share_mode) {
+	case PRIVATE:
+		l_mem_ptr = ib_alloc(g_mem_size, 0, NULL);
+		if (!l_mem_ptr) {
+			perror("alloc failed");
+			exit(1);
+		}
 		memset(l_mem_ptr, 1, g_mem_size);
-	} else {
-		l_mem_ptr = g_mem_ptr;
+		break;
+	case PARTITION:
+		l_mem_ptr = g_mem_ptr + (size_t)info->id * g_mem_size;
+		break;
+	case ADJACENT:
+		start = info->id * CACHE_LINE_SIZE;
+		stride = g_nthreads * CACHE_LINE_SIZE;
+		end = (long)g_nthreads * g_mem_size;
+		break;
+	case SAMELINE:
+		start = (info->id * sizeof(int64_t)) % CACHE_LINE_SIZE;
+		end = g_mem_size;
+		break;
+	}
+
+	/* counters count the calling thread: each worker opens its own */
+	if (counters && !(pmu = ib_counters_open(events)))
+		exit(1);
+	g_counters[info->id] = pmu;
+
+	/* with -j, room for every sample up front: no realloc between jobs */
+	if (jobs > 0) {
+		g_samples[info->id].duration = malloc(jobs * sizeof(unsigned int));
+		if (!g_samples[info->id].duration) {
+			perror("samples");
+			exit(1);
+		}
+		g_samples[info->id].max = jobs;
 	}
 
 	__atomic_fetch_add(&g_njoin, 1, __ATOMIC_SEQ_CST);
-	while (g_njoin < g_nthreads); // busy wait until all join
+	while (!g_go); // busy wait until main starts all
 
 	/*
 	 * actual memory access
 	 */
 	if (period > 0) make_periodic(period * 1000, info);
-	for (j = 0;; j++) {
+	for (j = 0; !g_stop; j++) {
 		unsigned int l_start, l_end, l_duration;
 		l_start = get_usecs();
+		ib_counters_start(pmu);
 		for (i = 0;; i++) {
 			switch (acc_type) {
 			case READ:
-				sum += bench_read(l_mem_ptr);
+				sum += bench_read(l_mem_ptr, start, stride, end);
 				break;
 			case WRITE:
-				sum += bench_write(l_mem_ptr);
+				sum += bench_write(l_mem_ptr, start, stride, end);
 				break;
 			}
+			g_thread_nread[info->id].bytes += g_mem_size;
 			if (verbose > 1) fprintf(stderr, ".");
-			if (iterations > 0 && i+1 >= iterations)
+			if (g_stop || (iterations > 0 && i+1 >= iterations))
 				break;
 		}
+		ib_counters_stop(pmu);
 		l_end = get_usecs();
 		l_duration = l_end - l_start;
+		if (g_stop)
+			break;	/* a cut-short job is no sample */
+		record_job(info->id, l_duration);
 		if (period > 0) wait_period (info);
 		if (verbose) fprintf(stderr, "\nJob %d Took %d us", j, l_duration);
+		if (verbose && pmu) {
+			ib_counters_print(stderr, " | ", pmu, last_value);
+			memcpy(last_value, pmu->value, sizeof(last_value));
+		}
 		if (jobs == 0 || j+1 >= jobs)
 			break;
 	}
@@ -251,7 +688,17 @@ void usage(int argc, char *argv[])
 	printf("-j: jobs. default=0\n");
 	printf("-l: job period (in ms)\n");
 	printf("-v: debug level (in ms)\n");
-	printf("-o: per-thread allocation\n");
+	printf("-o: per-thread allocation (same as -s private)\n");
+	printf("-s: buffer sharing mode - shared, private, partition, adjacent, sameline. default=shared\n");
+	printf("    shared: all threads access the same buffer\n");
+	printf("    private: each thread allocates its own buffer\n");
+	printf("    partition: each thread accesses a disjoint slice of one buffer\n");
+	printf("    adjacent: thread i accesses lines i, i+n, i+2n, ... of one buffer\n");
+	printf("    sameline: each thread accesses its own word in the same lines, up to 8 threads\n");
+	printf("-b: jobs per block for block-maxima pWCET fit. default=%d\n", DEFAULT_BLOCK_SIZE);
+	printf("-q: threshold quantile for peaks-over-threshold pWCET fit. default=%.2f\n", DEFAULT_POT_QUANTILE);
+	printf("-d: dump per-job execution times to a file\n");
+	printf("--counters[=<event>,...]: hardware counters of each thread's jobs, per job with -v. default=%s\n", IB_COUNTERS_DEFAULT);
 	printf("-h: help\n");
 	printf("\nExamples: \n$ bandwidth-rt -m 8192 -c 2 -a read -i 10 -j 100 -l 10 -c 2\n  <- 8MB read*10 iterations per job, for 100 jobs with 10ms period, on CPU 2\n");
 	exit(1);
@@ -264,12 +711,10 @@ int main(int argc, char *argv[])
 	int prio = 0;        
 	int num_processors;
 	int opt;
-	cpu_set_t cmask;
 	int i;
-	struct sched_param param;
 	sigset_t alarm_sig;
-	pthread_t tid[32]; /* thread identifier */
-	struct periodic_info info[32];
+	pthread_t tid[MAX_THREADS]; /* thread identifier */
+	struct periodic_info info[MAX_THREADS];
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
 	
@@ -279,6 +724,11 @@ int main(int argc, char *argv[])
 		{"jobs",    required_argument, 0,  'j' },
 		{"verbose", required_argument, 0,  'v' },
 		{"local",   no_argument,       0,  'o' },
+		{"share",   required_argument, 0,  's' },
+		{"block",   required_argument, 0,  'b' },
+		{"threshold", required_argument, 0, 'q' },
+		{"dump",    required_argument, 0,  'd' },
+		{"counters", optional_argument, 0, 'C' },
 		{0,         0,                 0,  0 }
 	};
 	int option_index = 0;
@@ -288,14 +738,14 @@ int main(int argc, char *argv[])
 	/*
 	 * get command line options 
 	 */
-	while ((opt = getopt_long(argc, argv, "m:n:a:t:c:r:p:i:j:l:hv:o",
+	while ((opt = getopt_long(argc, argv, "m:n:a:t:c:r:p:i:j:l:hv:os:b:q:d:",
 				  long_options, &option_index)) != -1) {
 		switch (opt) {
 		case 'm': /* set memory size */
 			g_mem_size = 1024 * strtol(optarg, NULL, 0);
 			break;
 		case 'n': /* #of threads */
-			g_nthreads = strtol(optarg, NULL, 0);
+			g_nthreads = MIN(strtol(optarg, NULL, 0), MAX_THREADS);
 			break;
 		case 'a': /* set access type */
 			if (!strcmp(optarg, "read"))
@@ -315,16 +765,13 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'r': /* set rt scheduler and its priority */
-			prio = strtol(optarg, NULL, 0);
-			param.sched_priority = prio; /* 1(low)- 99(high) for SCHED_FIFO or SCHED_RR
-						        0 for SCHED_OTHER or SCHED_BATCH */
-			if(sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+			prio = strtol(optarg, NULL, 0); /* 1(low)- 99(high) */
+			if (ib_set_rt_prio(prio) < 0)
 				perror("sched_setscheduler failed");
-			}
 			break;
 		case 'p': /* set priority */
 			prio = strtol(optarg, NULL, 0);
-			if (setpriority(PRIO_PROCESS, 0, prio) < 0)
+			if (ib_set_nice(prio) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned priority %d\n", prio);
@@ -349,21 +796,67 @@ int main(int argc, char *argv[])
 			verbose = strtol(optarg, NULL, 0);
 			break;
 		case 'o':
-			is_thread_local = 1;
+			share_mode = PRIVATE;
+			break;
+		case 's': /* set buffer sharing mode */
+			for (i = 0; i < sizeof(share_mode_names) / sizeof(share_mode_names[0]); i++)
+				if (!strcmp(optarg, share_mode_names[i]))
+					break;
+			if (i == sizeof(share_mode_names) / sizeof(share_mode_names[0])) {
+				fprintf(stderr, "unknown sharing mode %s: shared, private, partition, adjacent or sameline\n", optarg);
+				exit(1);
+			}
+			share_mode = i;
+			break;
+		case 'b': /* block size for block maxima */
+			block_size = MAX(strtol(optarg, NULL, 0), 1);
+			break;
+		case 'q': /* POT threshold quantile */
+			pot_quantile = strtod(optarg, NULL);
+			if (pot_quantile <= 0 || pot_quantile >= 1) {
+				fprintf(stderr, "threshold quantile must be in (0, 1)\n");
+				exit(1);
+			}
+			break;
+		case 'd': /* dump job samples */
+			dump_file = optarg;
+			break;
+		case 'C': /* hardware counters */
+			counters = 1;
+			events = optarg;
 			break;
 		}
 	}
 
+	g_nthreads = MIN(g_nthreads, num_processors);
+	if (share_mode == SAMELINE &&
+	    g_nthreads > CACHE_LINE_SIZE / sizeof(int64_t)) {
+		fprintf(stderr, "sameline: at most %d threads, one word of a line each\n",
+			(int)(CACHE_LINE_SIZE / sizeof(int64_t)));
+		exit(1);
+	}
+
 	/*
 	 * allocate contiguous region of memory 
 	 */
-	g_mem_ptr = malloc(g_mem_size);
-	memset(g_mem_ptr, 1, g_mem_size);
+	if (share_mode == PARTITION || share_mode == ADJACENT) {
+		g_mem_ptr = ib_alloc((size_t)g_nthreads * g_mem_size, 0, NULL);
+		if (g_mem_ptr)
+			memset(g_mem_ptr, 1, (size_t)g_nthreads * g_mem_size);
+	} else {
+		g_mem_ptr = ib_alloc(g_mem_size, 0, NULL);
+		if (g_mem_ptr)
+			memset(g_mem_ptr, 1, g_mem_size);
+	}
+	if (!g_mem_ptr) {
+		perror("alloc failed");
+		exit(1);
+	}
 
 	/* print experiment info before starting */
 	printf("mem=%d KB (%s), type=%s, nthreads=%d cpuid=%d, iterations=%d, jobs=%d, period=%d\n",
 	       g_mem_size/1024,
-	       (is_thread_local)? "private":"shared",
+	       share_mode_names[share_mode],
 	       ((acc_type==READ) ?"read": "write"),
 	       g_nthreads,
 	       cpuid,
@@ -376,28 +869,29 @@ int main(int argc, char *argv[])
 	signal(SIGINT, &quit);
 	signal(SIGTERM, &quit);
 	signal(SIGHUP, &quit); 
+
+	/* each thread pins itself to cpuid + its id */
+	for (i = 0; i < MIN(g_nthreads, num_processors); i++) {
+		info[i].id = i;
+		pthread_create(&tid[i], &attr, (void *)worker, &info[i]);
+	}
+
+	/* all workers set up: tell the driver, wait for its start */
+	while (g_njoin < MIN(g_nthreads, num_processors));
+	ib_ready();
 	if (finish > 0) {
 		signal(SIGALRM, &quit);
 		alarm(finish);
 	}
-
 	g_start = get_usecs();
-	
-	/* thread affinity set */
-	for (i = 0; i < MIN(g_nthreads, num_processors); i++) {
-		pthread_create(&tid[i], &attr, (void *)worker, &info[i]);
-		CPU_ZERO(&cmask);
-		CPU_SET((cpuid + i) % num_processors, &cmask);
-		if (pthread_setaffinity_np(tid[i], sizeof(cpu_set_t), &cmask) < 0)
-			perror("error");
-	}
+	g_go = 1;
 
 	for (i = 0; i < MIN(g_nthreads, num_processors); i++) {
 		pthread_join(tid[i], NULL);
 		printf("thread %d finished\n", i);
 	}
 
-	quit(0);
+	report();
 
 	return 0;
 }
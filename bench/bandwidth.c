@@ -31,6 +31,10 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <getopt.h>
+
+#include "pgtrace.h"
+#include "isolbench.h"
 
 /**************************************************************************
  * Public Definitions
@@ -50,50 +54,44 @@ int64_t g_mem_size = DEFAULT_ALLOC_SIZE_KB * 1024;	   /* memory size */
 int *g_mem_ptr = 0;		   /* pointer to allocated memory region */
 
 volatile uint64_t g_nread = 0;	           /* number of bytes read */
-volatile unsigned int g_start;		   /* starting time */
+volatile uint64_t g_start;		   /* starting time (ns) */
 int cpuid = 0;
+struct ib_counters *g_counters;		   /* --counters, NULL: off */
 
 /**************************************************************************
  * Public Functions
  **************************************************************************/
-unsigned int get_usecs()
-{
-	struct timeval         time;
-	gettimeofday(&time, NULL);
-	return (time.tv_sec * 1000000 +	time.tv_usec);
-}
-
 void quit(int param)
 {
 	float dur_in_sec;
 	float bw;
-	float dur = get_usecs() - g_start;
+	float dur = (ib_now_ns() - g_start) / 1000;
 	dur_in_sec = (float)dur / 1000000;
 	printf("g_nread(bytes read) = %lld\n", (long long)g_nread);
 	printf("elapsed = %.2f sec ( %.0f usec )\n", dur_in_sec, dur);
 	bw = (float)g_nread / dur_in_sec / 1024 / 1024;
 	printf("CPU%d: B/W = %.2f MB/s | ",cpuid, bw);
 	printf("CPU%d: average = %.2f ns\n", cpuid, (dur*1000)/(g_nread/CACHE_LINE_SIZE));
+	ib_result("elapsed_s", dur_in_sec);
+	ib_result("bandwidth_mbs", bw);
+	ib_result("average_ns", (dur*1000)/(g_nread/CACHE_LINE_SIZE));
+	ib_counters_stop(g_counters);
+	ib_counters_print(stdout, "counters: ", g_counters, NULL);
+	ib_counters_result(g_counters);
 	exit(0);
 }
 
 int64_t bench_read()
 {
-	int64_t i;
-	int64_t sum = 0;
-	for ( i = 0; i < g_mem_size/4; i+=(CACHE_LINE_SIZE/4) ) {
-		sum += g_mem_ptr[i];
-	}
+	int64_t sum = ib_read(g_mem_ptr, 0, CACHE_LINE_SIZE, g_mem_size);
+
 	g_nread += g_mem_size;
 	return sum;
 }
 
 int bench_write()
 {
-	register int64_t i;
-	for ( i = 0; i < g_mem_size/4; i+=(CACHE_LINE_SIZE/4) ) {
-		g_mem_ptr[i] = i;
-	}
+	ib_write(g_mem_ptr, 0, CACHE_LINE_SIZE, g_mem_size, 0xff);
 	g_nread += g_mem_size;
 	return 1;
 }
@@ -109,6 +107,9 @@ void usage(int argc, char *argv[])
 	printf("-c <int> : CPU to run.\n");
 	printf("-i <int> : iterations. 0 means intefinite. default=0\n");
 	printf("-p <int> : CFS priority (nice value). -20 (highest)..19 (lowest) \n");
+	printf("-T <file> : write the buffer's page trace (vaddr, pfn, page size), see pgtrace\n");
+	printf("--counters[=<event>,...] : hardware counters of the access loop. default=%s\n", IB_COUNTERS_DEFAULT);
+	printf("--interval <ms> : also print the bandwidth (and counters) of every <ms> interval\n");
 	printf("-h : help\n");
 	printf("\nExamples: \n$ bandwidth -m 8192 -a read -t 1 -c 2\n  <- 8MB read for 1 second on CPU 2\n");
 	exit(1);
@@ -119,19 +120,32 @@ int main(int argc, char *argv[])
 	int64_t sum = 0;
 	unsigned finish = 5;
 	int prio = 0;        
-	int num_processors;
 	int acc_type = READ;
 	int opt;
-	cpu_set_t cmask;
 	int iterations = 0;
 	int use_hugepage = 0;
+	size_t page_size = getpagesize();
+	char *trace_file = NULL;
+	FILE *trace;
 	int i;
-	struct sched_param param;
+	int counters = 0;
+	char *events = NULL;
+	uint64_t interval = 0, next = 0, now, last = 0, last_nread = 0;
+	uint64_t last_value[IB_MAX_COUNTERS] = { 0 };
+	int nr_interval = 0;
+
+	static struct option long_options[] = {
+		{"counters", optional_argument, 0,  'C' },
+		{"interval", required_argument, 0,  'I' },
+		{0,          0,                 0,  0 }
+	};
+	int option_index = 0;
 
 	/*
 	 * get command line options 
 	 */
-	while ((opt = getopt(argc, argv, "m:a:t:c:i:p:r:xh")) != -1) {
+	while ((opt = getopt_long(argc, argv, "m:a:t:c:i:p:r:T:xh",
+				  long_options, &option_index)) != -1) {
 		switch (opt) {
 		case 'm': /* set memory size */
 			if (optarg[strlen(optarg)-1] == 'G' || optarg[strlen(optarg)-1] == 'g')
@@ -158,25 +172,19 @@ int main(int argc, char *argv[])
 			break;
 		case 'c': /* set CPU affinity */
 			cpuid = strtol(optarg, NULL, 0);
-			num_processors = sysconf(_SC_NPROCESSORS_CONF);
-			CPU_ZERO(&cmask);
-			CPU_SET(cpuid % num_processors, &cmask);
-			if (sched_setaffinity(0, num_processors, &cmask) < 0)
+			if (ib_pin_cpu(cpuid) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned to cpu %d\n", cpuid);
 			break;
 		case 'r':
-			prio = strtol(optarg, NULL, 0);
-			param.sched_priority = prio; /* 1(low)- 99(high) for SCHED_FIFO or SCHED_RR
-						        0 for SCHED_OTHER or SCHED_BATCH */
-			if(sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+			prio = strtol(optarg, NULL, 0); /* 1(low)- 99(high) */
+			if (ib_set_rt_prio(prio) < 0)
 				perror("sched_setscheduler failed");
-			}
 			break;
 		case 'p': /* set priority */
 			prio = strtol(optarg, NULL, 0);
-			if (setpriority(PRIO_PROCESS, 0, prio) < 0)
+			if (ib_set_nice(prio) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned priority %d\n", prio);
@@ -184,6 +192,16 @@ int main(int argc, char *argv[])
 		case 'i': /* iterations */
 			iterations = strtol(optarg, NULL, 0);
 			break;
+		case 'T': /* page trace */
+			trace_file = optarg;
+			break;
+		case 'C': /* hardware counters */
+			counters = 1;
+			events = optarg;
+			break;
+		case 'I': /* reporting interval in ms */
+			interval = strtol(optarg, NULL, 0) * 1000000ULL;
+			break;
 		case 'h': 
 			usage(argc, argv);
 			break;
@@ -191,51 +209,47 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * allocate contiguous region of memory 
+	 * allocate contiguous region of memory: 1GB, else 2MB huge pages
 	 */ 
-	if (use_hugepage) {
-		// try 1GB hugepage first
-		g_mem_ptr = (int *)mmap(0,
-				       g_mem_size,
-				       PROT_READ | PROT_WRITE,
-				       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT),
-				       -1, 0);
-		if ((void *)g_mem_ptr == MAP_FAILED) {
-			// fallback to 2MB (or 32MB in pi 5?) hugepage
-			g_mem_ptr = (int *)mmap(0,
-					       g_mem_size,
-					       PROT_READ | PROT_WRITE,
-					       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
-					       -1, 0);
-			if ((void *)g_mem_ptr == MAP_FAILED) {
-				perror("mmap with hugepage failed");
-				exit(1);
-			} else {
-				printf("Using 2MB hugepage\n");
-			}
-		} else {
-			printf("Using 1GB hugepage\n");
-		}
-	} else {
-		g_mem_ptr = (int *)malloc(g_mem_size);
-		if (g_mem_ptr == NULL) {
-			perror("alloc failed");
-			exit(1);
-		}
-		printf("Using malloc(), not very accurate\n");
+	g_mem_ptr = ib_alloc(g_mem_size,
+			     use_hugepage ? IB_MEM_HUGE | IB_MEM_STRICT : 0,
+			     &page_size);
+	if (!g_mem_ptr) {
+		perror(use_hugepage ? "mmap with hugepage failed" : "alloc failed");
+		exit(1);
 	}
+	if (page_size == 1UL << 30)
+		printf("Using 1GB hugepage\n");
+	else if (page_size == 2UL << 20)
+		printf("Using 2MB hugepage\n");
+	else
+		printf("Using small pages, not very accurate\n");
 
 	memset((char *)g_mem_ptr, 1, g_mem_size);
 
 	for (i = 0; i < g_mem_size / sizeof(int); i++)
 		g_mem_ptr[i] = i;
 
+	if (trace_file) {
+		trace = pgt_create(trace_file, NULL);
+		if (!trace) {
+			perror(trace_file);
+			exit(1);
+		}
+		printf("traced %ld pages\n", pgt_dump_region(trace, g_mem_ptr,
+				g_mem_size, page_size, NULL));
+		fclose(trace);
+	}
+
 	/* print experiment info before starting */
 	printf("memsize=%ld KB, type=%s, cpuid=%d\n",
 	       g_mem_size/1024,
 	       ((acc_type==READ) ?"read": "write"),
 		cpuid);
 	printf("stop at %d\n", finish);
+	if (counters && !(g_counters = ib_counters_open(events)))
+		exit(1);
+	ib_ready();
 
 	/* set signals to terminate once time has been reached */
 	signal(SIGINT, &quit);
@@ -247,7 +261,9 @@ int main(int argc, char *argv[])
 	/*
 	 * actual memory access
 	 */
-	g_start = get_usecs();
+	g_start = last = ib_now_ns();
+	next = g_start + interval;
+	ib_counters_start(g_counters);
 	for (i=0;; i++) {
 		switch (acc_type) {
 		case READ:
@@ -258,6 +274,24 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		/* per interval: bandwidth and counter deltas since the last */
+		if (interval > 0 && (now = ib_now_ns()) >= next) {
+			ib_counters_stop(g_counters);
+			printf("interval %d: %.0f ms, B/W = %.2f MB/s\n",
+			       nr_interval++, (double)(now - last) / 1000000,
+			       (double)(g_nread - last_nread) * 1000000000 /
+			       (now - last) / 1024 / 1024);
+			ib_counters_print(stdout, "  counters: ", g_counters,
+					  last_value);
+			if (g_counters)
+				memcpy(last_value, g_counters->value,
+				       sizeof(last_value));
+			last = now;
+			last_nread = g_nread;
+			next = now + interval;
+			ib_counters_start(g_counters);
+		}
+
 		if (iterations > 0 && i+1 >= iterations)
 			break;
 	}
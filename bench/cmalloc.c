@@ -0,0 +1,924 @@
+/**
+ * cmalloc: user-space page-coloring allocator. See cmalloc.h.
+ *
+ * The pool is an array of chunks. Free chunks sit on one list per color,
+ * linked by index in chunk_next[]. A chunk is carved into objects of one
+ * size class the first time a thread of its color needs that class, and
+ * stays that class; freed objects go back to the thread cache, or to the
+ * pool's free object list of their (class, color).
+ *
+ * Page regions (cm_map_pages()) are made of free page chunks moved out of
+ * the pool with mremap(), one page each, and moved back when unmapped. A
+ * region's record keeps each page's chunk. The kernel gives each moved
+ * page a VMA of its own, so the pages out of the pool at once are capped
+ * well below vm.max_map_count.
+ *
+ * mmap() and friends are called through syscall(): the preload shim
+ * (cmpreload.c) interposes them.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cmalloc.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define NR_CLASSES	16
+#define MAX_CLASS_SIZE	4096
+#define NO_CHUNK	((uint32_t)-1)
+#define FREE_CHUNK	0xff		/* chunk_class[] of an uncarved chunk */
+#define BATCH		32		/* objects moved per refill / drain */
+#define CACHE_MAX	(2 * BATCH)	/* per class in a thread cache */
+#define PAGEMAP_BATCH	4096		/* pages per pagemap read */
+#define NR_REGIONS	65536		/* region hash slots, a power of 2 */
+#define DEAD_REGION	((char *)1)	/* deleted hash slot */
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+struct object {
+	struct object	*next;
+};
+
+struct region {
+	char		*addr;		/* NULL: empty slot */
+	size_t		len;
+	uint32_t	*chunks;	/* per page, NO_CHUNK once unmapped */
+};
+
+struct tcache {
+	struct object	*head[NR_CLASSES];
+	int		count[NR_CLASSES];
+	struct cm_colorset set;
+	uint16_t	colors[CM_MAX_COLORS];	/* set, as a list */
+	int		nr_colors;
+	int		cursor;			/* round-robin over colors */
+	int		ready;
+	uint64_t	allocs;
+	uint64_t	frees;
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static const uint16_t class_size[NR_CLASSES] = {
+	16, 32, 48, 64, 96, 128, 192, 256,
+	384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+
+/* class of each size, in CM_ALIGN steps */
+static uint8_t size_class[MAX_CLASS_SIZE / CM_ALIGN + 1];
+
+static struct colormap g_cmap;
+static char *g_base;			/* the pool */
+static size_t g_size;
+static size_t g_page_size;
+static int g_chunk_shift;
+static uint64_t g_nr_chunks;
+static int g_nr_classes;		/* classes that fit in a chunk */
+static struct cm_colorset g_default_set;
+
+/* mmap()ed metadata */
+static uint16_t *chunk_color;
+static uint8_t *chunk_class;
+static uint32_t *chunk_next;
+static uint32_t *free_chunks;			/* [color] list head */
+static struct object **free_objects;		/* [class][color] */
+static struct region *regions;			/* hash on the address */
+static struct region **sorted;			/* live regions, by address */
+static uint64_t g_nr_regions;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t g_exit_key;
+static uint64_t g_free_chunks;
+static uint64_t g_allocs, g_frees, g_refills, g_failures;
+static int g_page_chunks;		/* cm_map_pages() works */
+static uint64_t g_out_pages;		/* in regions */
+static uint64_t g_max_out_pages;
+static uint64_t g_lost_pages;		/* unmapped by the program */
+static char *g_region_lo, *g_region_hi;	/* bounds of all regions ever */
+
+static __thread struct tcache t_cache;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static void *sys_mmap(void *addr, size_t len, int prot, int flags)
+{
+	void *p = (void *)syscall(SYS_mmap, addr, len, prot, flags, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static int sys_munmap(void *addr, size_t len)
+{
+	return syscall(SYS_munmap, addr, len);
+}
+
+static void *sys_mremap(void *from, size_t len, void *to)
+{
+	return (void *)syscall(SYS_mremap, from, len, len,
+			       MREMAP_MAYMOVE | MREMAP_FIXED, to);
+}
+
+#ifndef MREMAP_DONTUNMAP
+#define MREMAP_DONTUNMAP 4
+#endif
+
+/*
+ * move a pool page out without leaving a hole in the pool, where another
+ * mapping could land and pass for pool memory. MREMAP_DONTUNMAP (Linux
+ * 5.7) keeps the source mapped; before it, fill the hole right away
+ */
+static void *sys_mremap_out(void *from, size_t len, void *to)
+{
+	void *p;
+
+	p = (void *)syscall(SYS_mremap, from, len, len, MREMAP_MAYMOVE |
+			    MREMAP_FIXED | MREMAP_DONTUNMAP, to);
+	if (p != MAP_FAILED || errno != EINVAL)
+		return p;
+	p = sys_mremap(from, len, to);
+	if (p != MAP_FAILED)
+		sys_mmap(from, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+			 MAP_FIXED | MAP_NORESERVE);
+	return p;
+}
+
+static void *map_meta(size_t size)
+{
+	return sys_mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS);
+}
+
+/* vm.max_map_count, 65530 if unknown */
+static uint64_t max_map_count(void)
+{
+	char buf[32];
+	int fd, n;
+
+	fd = open("/proc/sys/vm/max_map_count", O_RDONLY);
+	if (fd < 0)
+		return 65530;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 65530;
+	buf[n] = '\0';
+	return strtoull(buf, NULL, 10);
+}
+
+/* 1GB, then 2MB huge pages, then small pages, like pll */
+static void *map_pool(size_t size, size_t *page_size, int flags)
+{
+	void *p;
+
+	*page_size = 1UL << 30;
+	p = (flags & CM_SMALL_PAGES) ? NULL :
+		sys_mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			 MAP_POPULATE | (30 << MAP_HUGE_SHIFT));
+	if (p)
+		return p;
+
+	*page_size = 2UL << 20;
+	p = (flags & CM_SMALL_PAGES) ? NULL :
+		sys_mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			 MAP_POPULATE);
+	if (p)
+		return p;
+
+	*page_size = getpagesize();
+	p = sys_mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE);
+	if (!p)
+		return NULL;
+	/*
+	 * khugepaged collapsing, swap and reclaim would move the pages to
+	 * other colors. Unlike huge pages, small ones have to be locked
+	 */
+	madvise(p, size, MADV_NOHUGEPAGE);
+	if (mlock(p, size) < 0) {
+		int e = errno;
+
+		sys_munmap(p, size);
+		errno = e;
+		return NULL;
+	}
+	return p;
+}
+
+/* color every chunk, from the pool's PFNs */
+static int color_chunks(void)
+{
+	uint64_t pagemap[PAGEMAP_BATCH];
+	uint64_t paddr[CMAP_BLOCK];
+	uint16_t color[CMAP_BLOCK];
+	size_t page = getpagesize();
+	uint64_t nr_pages = g_size / page, i, j, n, c = 0;
+	uint64_t per_page = page >> g_chunk_shift;
+	int fd, k;
+
+	fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	for (i = 0; i < nr_pages; i += n) {
+		n = nr_pages - i < PAGEMAP_BATCH ? nr_pages - i : PAGEMAP_BATCH;
+		if (pread(fd, pagemap, n * 8,
+			  ((uintptr_t)g_base / page + i) * 8) != (ssize_t)(n * 8)) {
+			close(fd);
+			errno = EIO;
+			return -1;
+		}
+		for (j = 0; j < n; j++) {
+			uint64_t pfn = pagemap[j] & ((1ULL << 55) - 1);
+
+			/* without CAP_SYS_ADMIN, PFNs read as 0 */
+			if (!(pagemap[j] & (1ULL << 63)) || !pfn) {
+				close(fd);
+				errno = EPERM;
+				return -1;
+			}
+			for (k = 0; k < (int)per_page; k++) {
+				paddr[c % CMAP_BLOCK] = pfn * page +
+					((uint64_t)k << g_chunk_shift);
+				if (++c % CMAP_BLOCK == 0) {
+					cmap_colors(&g_cmap, paddr, color,
+						    CMAP_BLOCK);
+					memcpy(&chunk_color[c - CMAP_BLOCK],
+					       color, sizeof(color));
+				}
+			}
+		}
+	}
+	close(fd);
+
+	if (c % CMAP_BLOCK) {
+		cmap_colors(&g_cmap, paddr, color, c % CMAP_BLOCK);
+		memcpy(&chunk_color[c - c % CMAP_BLOCK], color,
+		       (c % CMAP_BLOCK) * sizeof(color[0]));
+	}
+	return 0;
+}
+
+static void tcache_use_set(struct tcache *t, const struct cm_colorset *set)
+{
+	int c, nr = cmap_nr_colors(&g_cmap);
+
+	t->set = *set;
+	t->nr_colors = 0;
+	for (c = 0; c < nr; c++)
+		if (cm_colorset_has(set, c))
+			t->colors[t->nr_colors++] = c;
+	t->cursor = 0;
+}
+
+static inline uint64_t chunk_of(const void *ptr)
+{
+	return ((const char *)ptr - g_base) >> g_chunk_shift;
+}
+
+/* move n objects of class cls from the thread cache to the pool */
+static void drain(struct tcache *t, int cls, int n)
+{
+	struct object *obj;
+	int color;
+
+	pthread_mutex_lock(&g_lock);
+	while (n-- > 0 && (obj = t->head[cls])) {
+		t->head[cls] = obj->next;
+		t->count[cls]--;
+		color = chunk_color[chunk_of(obj)];
+		obj->next = free_objects[cls * CM_MAX_COLORS + color];
+		free_objects[cls * CM_MAX_COLORS + color] = obj;
+	}
+	g_allocs += t->allocs;
+	g_frees += t->frees;
+	t->allocs = t->frees = 0;
+	pthread_mutex_unlock(&g_lock);
+}
+
+static void tcache_flush(struct tcache *t)
+{
+	int cls;
+
+	for (cls = 0; cls < g_nr_classes; cls++)
+		drain(t, cls, t->count[cls]);
+}
+
+static void thread_exit(void *arg)
+{
+	tcache_flush((struct tcache *)arg);
+}
+
+static struct tcache *get_tcache(void)
+{
+	struct tcache *t = &t_cache;
+
+	if (!t->ready) {
+		tcache_use_set(t, &g_default_set);
+		pthread_setspecific(g_exit_key, t);
+		t->ready = 1;
+	}
+	return t;
+}
+
+/*
+ * refill the thread cache with up to BATCH objects of class cls, from the
+ * first of the thread's colors, starting at its cursor, that has free
+ * objects or a free chunk. returns the number of objects added
+ */
+static int refill(struct tcache *t, int cls)
+{
+	struct object **list, *obj;
+	uint32_t chunk;
+	char *p, *end;
+	int i, color, got = 0;
+
+	pthread_mutex_lock(&g_lock);
+	g_refills++;
+	g_allocs += t->allocs;
+	g_frees += t->frees;
+	t->allocs = t->frees = 0;
+	for (i = 0; i < t->nr_colors && !got; i++) {
+		color = t->colors[t->cursor];
+		t->cursor = (t->cursor + 1) % t->nr_colors;
+
+		list = &free_objects[cls * CM_MAX_COLORS + color];
+		for (; *list && got < BATCH; got++) {
+			obj = *list;
+			*list = obj->next;
+			obj->next = t->head[cls];
+			t->head[cls] = obj;
+		}
+		if (got)
+			break;
+
+		chunk = free_chunks[color];
+		if (chunk == NO_CHUNK)
+			continue;
+		free_chunks[color] = chunk_next[chunk];
+		chunk_class[chunk] = cls;
+		g_free_chunks--;
+
+		p = g_base + ((uint64_t)chunk << g_chunk_shift);
+		end = p + (1UL << g_chunk_shift) - class_size[cls];
+		for (; p <= end; p += class_size[cls], got++) {
+			obj = (struct object *)p;
+			obj->next = t->head[cls];
+			t->head[cls] = obj;
+		}
+	}
+	if (!got)
+		g_failures++;
+	pthread_mutex_unlock(&g_lock);
+
+	t->count[cls] += got;
+	return got;
+}
+
+/* a child forked while another thread held g_lock would deadlock on it */
+static void fork_prepare(void)
+{
+	pthread_mutex_lock(&g_lock);
+}
+
+static void fork_parent(void)
+{
+	pthread_mutex_unlock(&g_lock);
+}
+
+static void fork_child(void)
+{
+	pthread_mutex_unlock(&g_lock);
+}
+
+#define FREE_META(p, n)	do {					\
+		if (p)						\
+			sys_munmap(p, (n) * sizeof(*(p)));	\
+		p = NULL;					\
+	} while (0)
+
+/* cm_init() failed: unmap what it mapped */
+static void free_meta(void)
+{
+	FREE_META(chunk_color, g_nr_chunks);
+	FREE_META(chunk_class, g_nr_chunks);
+	FREE_META(chunk_next, g_nr_chunks);
+	FREE_META(free_chunks, CM_MAX_COLORS);
+	FREE_META(free_objects, NR_CLASSES * CM_MAX_COLORS);
+	FREE_META(regions, NR_REGIONS);
+	FREE_META(sorted, NR_REGIONS);
+}
+
+int cm_init(const struct colormap *cm, size_t size,
+	    const struct cm_colorset *set, int flags)
+{
+	uint64_t i, mask = 0;
+	int f, cls, c;
+
+	if (g_base || cm->nr_funcs > CM_MAX_FUNCS) {
+		errno = EINVAL;
+		return -1;
+	}
+	g_cmap = *cm;
+
+	/* the lowest bit any function uses, from a line to a page */
+	for (f = 0; f < cm->nr_funcs; f++)
+		mask |= cm->mask[f];
+	g_chunk_shift = mask ? __builtin_ctzll(mask) : 12;
+	if (g_chunk_shift < 6)
+		g_chunk_shift = 6;
+	if (g_chunk_shift > 12)
+		g_chunk_shift = 12;
+
+	size = (size + (2UL << 20) - 1) & ~((2UL << 20) - 1);
+	g_base = map_pool(size, &g_page_size, flags);
+	if (!g_base)
+		return -1;
+	g_size = size;
+	g_nr_chunks = size >> g_chunk_shift;
+	if (g_nr_chunks >= NO_CHUNK) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	chunk_color = map_meta(g_nr_chunks * sizeof(*chunk_color));
+	chunk_class = map_meta(g_nr_chunks * sizeof(*chunk_class));
+	chunk_next = map_meta(g_nr_chunks * sizeof(*chunk_next));
+	free_chunks = map_meta(CM_MAX_COLORS * sizeof(*free_chunks));
+	free_objects = map_meta(NR_CLASSES * CM_MAX_COLORS *
+				sizeof(*free_objects));
+	regions = map_meta(NR_REGIONS * sizeof(*regions));
+	sorted = map_meta(NR_REGIONS * sizeof(*sorted));
+	if (!chunk_color || !chunk_class || !chunk_next || !free_chunks ||
+	    !free_objects || !regions || !sorted)
+		goto fail;
+
+	if (color_chunks() < 0)
+		goto fail;
+
+	/* in reverse, so chunks are handed out in address order */
+	for (c = 0; c < CM_MAX_COLORS; c++)
+		free_chunks[c] = NO_CHUNK;
+	for (i = g_nr_chunks; i-- > 0; ) {
+		chunk_class[i] = FREE_CHUNK;
+		chunk_next[i] = free_chunks[chunk_color[i]];
+		free_chunks[chunk_color[i]] = i;
+	}
+	g_free_chunks = g_nr_chunks;
+
+	/* each page out of the pool is a VMA, and leaves a hole in it */
+	g_page_chunks = g_page_size == (size_t)getpagesize() &&
+		(1UL << g_chunk_shift) == g_page_size;
+	g_max_out_pages = max_map_count() / 4;
+
+	for (g_nr_classes = 0; g_nr_classes < NR_CLASSES; g_nr_classes++)
+		if (class_size[g_nr_classes] > (1UL << g_chunk_shift))
+			break;
+	/* largest first, so each size ends up with the smallest class */
+	for (cls = NR_CLASSES - 1; cls >= 0; cls--)
+		for (i = 0; i <= class_size[cls] / CM_ALIGN; i++)
+			size_class[i] = cls;
+
+	if (set) {
+		g_default_set = *set;
+	} else {
+		cm_colorset_zero(&g_default_set);
+		for (c = 0; c < cmap_nr_colors(cm); c++)
+			cm_colorset_add(&g_default_set, c);
+	}
+	pthread_key_create(&g_exit_key, thread_exit);
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+	return 0;
+
+fail:
+	f = errno;
+	free_meta();
+	sys_munmap(g_base, size);
+	g_base = NULL;
+	errno = f;
+	return -1;
+}
+
+int cm_set_colors(const struct cm_colorset *set)
+{
+	struct tcache *t;
+	int c;
+
+	for (c = cmap_nr_colors(&g_cmap); c < CM_MAX_COLORS; c++)
+		if (cm_colorset_has(set, c)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+	/* cached objects may be of colors no longer ours */
+	t = get_tcache();
+	tcache_flush(t);
+	tcache_use_set(t, set);
+	return 0;
+}
+
+void *cm_malloc(size_t size)
+{
+	struct tcache *t;
+	struct object *obj;
+	int cls;
+
+	if (!g_base || size > MAX_CLASS_SIZE ||
+	    (cls = size_class[(size + CM_ALIGN - 1) / CM_ALIGN]) >= g_nr_classes) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	t = get_tcache();
+	if (!t->head[cls] && !refill(t, cls)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	obj = t->head[cls];
+	t->head[cls] = obj->next;
+	t->count[cls]--;
+	t->allocs++;
+	return obj;
+}
+
+void *cm_memalign(size_t align, size_t size)
+{
+	size_t pow2 = CM_ALIGN;
+
+	if (align & (align - 1)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	/* power of 2 classes are aligned to their size in a chunk */
+	while (pow2 < size || pow2 < align)
+		pow2 <<= 1;
+	return cm_malloc(pow2);
+}
+
+void *cm_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (size && nmemb > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = cm_malloc(nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+	return p;
+}
+
+void cm_free(void *ptr)
+{
+	struct tcache *t;
+	struct object *obj = (struct object *)ptr;
+	uint64_t chunk;
+	int cls;
+
+	if (!ptr)
+		return;
+	chunk = chunk_of(ptr);
+	if (!cm_owns(ptr) || chunk_class[chunk] == FREE_CHUNK) {
+		fprintf(stderr, "cm_free(): %p was not allocated\n", ptr);
+		abort();
+	}
+	cls = chunk_class[chunk];
+	t = get_tcache();
+	t->frees++;
+
+	obj->next = t->head[cls];
+	t->head[cls] = obj;
+	t->count[cls]++;
+
+	/* another thread's color goes straight back to the pool */
+	if (!cm_colorset_has(&t->set, chunk_color[chunk]))
+		drain(t, cls, 1);
+	else if (t->count[cls] > CACHE_MAX)
+		drain(t, cls, BATCH);
+}
+
+size_t cm_usable_size(const void *ptr)
+{
+	if (!ptr || !cm_owns(ptr) || chunk_class[chunk_of(ptr)] == FREE_CHUNK)
+		return 0;
+	return class_size[chunk_class[chunk_of(ptr)]];
+}
+
+int cm_owns(const void *ptr)
+{
+	return g_base && (const char *)ptr >= g_base &&
+		(const char *)ptr < g_base + g_size;
+}
+
+int cm_color_of(const void *ptr)
+{
+	return cm_owns(ptr) ? chunk_color[chunk_of(ptr)] : -1;
+}
+
+void cm_get_stats(struct cm_stats *st)
+{
+	struct tcache *t = &t_cache;
+
+	memset(st, 0, sizeof(*st));
+	pthread_mutex_lock(&g_lock);
+	st->size = g_size;
+	st->page_size = g_page_size;
+	st->chunk_size = 1UL << g_chunk_shift;
+	st->nr_colors = cmap_nr_colors(&g_cmap);
+	st->nr_chunks = g_nr_chunks;
+	st->free_chunks = g_free_chunks;
+	st->allocs = g_allocs + t->allocs;
+	st->frees = g_frees + t->frees;
+	st->refills = g_refills;
+	st->failures = g_failures;
+	st->region_pages = g_out_pages;
+	st->lost_pages = g_lost_pages;
+	pthread_mutex_unlock(&g_lock);
+}
+
+static struct region *find_region(const void *addr)
+{
+	uint64_t h = ((uintptr_t)addr >> 12) & (NR_REGIONS - 1);
+
+	for (; regions[h].addr; h = (h + 1) & (NR_REGIONS - 1))
+		if (regions[h].addr == addr)
+			return &regions[h];
+	return NULL;
+}
+
+static struct region *add_region(char *addr)
+{
+	uint64_t h = ((uintptr_t)addr >> 12) & (NR_REGIONS - 1);
+	int i;
+
+	for (i = 0; i < NR_REGIONS; i++, h = (h + 1) & (NR_REGIONS - 1))
+		if (regions[h].addr == NULL || regions[h].addr == DEAD_REGION)
+			return &regions[h];
+	return NULL;
+}
+
+/* the number of live regions below addr: where addr goes in sorted[] */
+static uint64_t sorted_pos(const char *addr)
+{
+	uint64_t lo = 0, hi = g_nr_regions, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sorted[mid]->addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void sort_region(struct region *r)
+{
+	uint64_t pos = sorted_pos(r->addr);
+
+	memmove(&sorted[pos + 1], &sorted[pos],
+		(g_nr_regions - pos) * sizeof(*sorted));
+	sorted[pos] = r;
+	g_nr_regions++;
+}
+
+static void unsort_region(struct region *r)
+{
+	uint64_t pos = sorted_pos(r->addr);
+
+	if (pos == g_nr_regions || sorted[pos] != r)
+		return;
+	g_nr_regions--;
+	memmove(&sorted[pos], &sorted[pos + 1],
+		(g_nr_regions - pos) * sizeof(*sorted));
+}
+
+/* the region addr is in, for munmap()s of part of a region */
+static struct region *region_of(const char *addr)
+{
+	uint64_t pos;
+	struct region *r;
+
+	if (addr < g_region_lo || addr >= g_region_hi)
+		return NULL;
+	pos = sorted_pos(addr + 1);
+	if (!pos)
+		return NULL;
+	r = sorted[pos - 1];
+	return addr < r->addr + r->len ? r : NULL;
+}
+
+/* give chunks out of the pool back to its free lists */
+static void return_chunks(uint32_t *chunks, uint64_t n, uint64_t lost)
+{
+	uint64_t i, back = 0;
+	uint32_t chunk;
+
+	pthread_mutex_lock(&g_lock);
+	for (i = 0; i < n; i++) {
+		chunk = chunks[i];
+		if (chunk == NO_CHUNK)
+			continue;
+		chunk_next[chunk] = free_chunks[chunk_color[chunk]];
+		free_chunks[chunk_color[chunk]] = chunk;
+		chunks[i] = NO_CHUNK;
+		back++;
+	}
+	g_free_chunks += back;
+	g_out_pages -= back + lost;
+	g_lost_pages += lost;
+	pthread_mutex_unlock(&g_lock);
+}
+
+/*
+ * move pages [first, last) of r back to the pool. A page the program
+ * unmapped itself is lost to the pool.
+ */
+static void put_pages(struct region *r, uint64_t first, uint64_t last)
+{
+	size_t page = getpagesize();
+	uint64_t i, lost = 0;
+	char *to;
+
+	for (i = first; i < last; i++) {
+		if (r->chunks[i] == NO_CHUNK)
+			continue;
+		to = g_base + ((uint64_t)r->chunks[i] << g_chunk_shift);
+		if (sys_mremap(r->addr + i * page, page, to) != to) {
+			r->chunks[i] = NO_CHUNK;
+			lost++;
+			continue;
+		}
+		/* the program may have mprotect()ed it */
+		syscall(SYS_mprotect, to, page, PROT_READ | PROT_WRITE);
+	}
+	return_chunks(r->chunks + first, last - first, lost);
+}
+
+void *cm_map_pages(size_t len)
+{
+	size_t page = getpagesize();
+	struct region tmp, *r = NULL;
+	struct tcache *t;
+	uint32_t *chunks, chunk;
+	uint64_t i, n;
+	char *addr;
+	int c, tries;
+
+	if (!g_page_chunks) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+	n = (len + page - 1) / page;
+	if (!n) {
+		errno = EINVAL;
+		return NULL;
+	}
+	t = get_tcache();
+
+	addr = sys_mmap(NULL, n * page, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+	chunks = map_meta(n * sizeof(*chunks));
+	if (!addr || !chunks)
+		goto fail;
+	memset(chunks, 0xff, n * sizeof(*chunks));
+
+	/* take the chunks round-robin over the thread's colors */
+	pthread_mutex_lock(&g_lock);
+	for (i = 0; i < n && g_out_pages < g_max_out_pages; i++) {
+		chunk = NO_CHUNK;
+		for (tries = 0; tries < t->nr_colors && chunk == NO_CHUNK;
+		     tries++) {
+			c = t->colors[t->cursor];
+			t->cursor = (t->cursor + 1) % t->nr_colors;
+			chunk = free_chunks[c];
+		}
+		if (chunk == NO_CHUNK)
+			break;
+		free_chunks[c] = chunk_next[chunk];
+		chunks[i] = chunk;
+		g_free_chunks--;
+		g_out_pages++;
+	}
+	if (i < n)
+		g_failures++;
+	pthread_mutex_unlock(&g_lock);
+	if (i < n) {
+		return_chunks(chunks, i, 0);
+		goto fail;
+	}
+
+	tmp.addr = addr;
+	tmp.len = n * page;
+	tmp.chunks = chunks;
+	for (i = 0; i < n; i++) {
+		char *from = g_base + ((uint64_t)chunks[i] << g_chunk_shift);
+
+		if (sys_mremap_out(from, page, addr + i * page) != addr + i * page)
+			break;
+		memset(addr + i * page, 0, page);
+	}
+	if (i == n) {
+		pthread_mutex_lock(&g_lock);
+		r = add_region(addr);
+		if (r) {
+			*r = tmp;
+			sort_region(r);
+			if (!g_region_lo || addr < g_region_lo)
+				g_region_lo = addr;
+			if (addr + tmp.len > g_region_hi)
+				g_region_hi = addr + tmp.len;
+		}
+		pthread_mutex_unlock(&g_lock);
+	}
+	if (!r) {
+		/* pages from i on were never moved out */
+		put_pages(&tmp, 0, i);
+		return_chunks(chunks + i, n - i, 0);
+		goto fail;
+	}
+	return addr;
+
+fail:
+	if (addr)
+		sys_munmap(addr, n * page);
+	if (chunks)
+		sys_munmap(chunks, n * sizeof(*chunks));
+	errno = ENOMEM;
+	return NULL;
+}
+
+int cm_unmap_pages(void *addr, size_t len)
+{
+	size_t page = getpagesize();
+	struct region *r = NULL;
+	uint64_t first, last, i;
+
+	if (g_page_chunks) {
+		pthread_mutex_lock(&g_lock);
+		r = len ? region_of((char *)addr) : find_region(addr);
+		pthread_mutex_unlock(&g_lock);
+	}
+	if (!r) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!len)
+		len = r->len;
+	first = ((char *)addr - r->addr) / page;
+	last = ((char *)addr - r->addr + len + page - 1) / page;
+	if (last > r->len / page)
+		last = r->len / page;
+	put_pages(r, first, last);
+	sys_munmap(r->addr + first * page, (last - first) * page);
+
+	for (i = 0; i < r->len / page; i++)
+		if (r->chunks[i] != NO_CHUNK)
+			return 0;
+	sys_munmap(r->chunks, r->len / page * sizeof(*r->chunks));
+	pthread_mutex_lock(&g_lock);
+	unsort_region(r);
+	r->addr = DEAD_REGION;
+	pthread_mutex_unlock(&g_lock);
+	return 0;
+}
+
+size_t cm_mapped_size(const void *addr)
+{
+	struct region *r;
+	size_t len;
+
+	if (!g_page_chunks)
+		return 0;
+	pthread_mutex_lock(&g_lock);
+	r = find_region(addr);
+	len = r ? r->len : 0;
+	pthread_mutex_unlock(&g_lock);
+	return len;
+}
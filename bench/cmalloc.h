@@ -0,0 +1,141 @@
+#ifndef __CMALLOC_H
+#define __CMALLOC_H
+
+/*
+ * cmalloc: a page-coloring allocator in user space, for bank and cache
+ * isolation on stock kernels (no PALLOC patch).
+ *
+ * cm_init() reserves a pool the way pll does: 1GB, then 2MB huge pages,
+ * then small pages. It reads the pool's physical addresses from
+ * /proc/self/pagemap once (root needed) and indexes every chunk by its
+ * color under a colormap.h map. A chunk is the unit of color, the
+ * smallest size the map's functions can tell apart: a 4KB page for bank
+ * and page colors, down to a 64B line for maps on cache set bits.
+ *
+ * Allocations come from chunks of the calling thread's colors only, so an
+ * object is never larger than a chunk: bigger requests fail with ENOMEM,
+ * as does running out of colored chunks. Each thread has a cache per size
+ * class that cm_malloc() and cm_free() use in O(1); it is refilled and
+ * drained in batches under the pool lock, round-robin over the thread's
+ * colors. All metadata is mmap()ed, cmalloc never calls malloc().
+ *
+ * Larger memory comes from cm_map_pages(): a new mapping made of free pool
+ * pages of the thread's colors. That needs a pool of small pages
+ * (CM_SMALL_PAGES) and a page-colored map, and is limited to a quarter of
+ * vm.max_map_count pages at a time, as each page is a VMA of its own.
+ * Colors only hold while the pages stay put: fork() copy-on-write and
+ * MADV_DONTNEED give the program new, uncolored, pages. A small page pool
+ * is mlock()ed against swap and reclaim (cm_init() fails if it cannot
+ * be, see ulimit -l); vm.compact_unevictable_allowed=0 keeps compaction
+ * off it too.
+ *
+ *	struct colormap cm;
+ *	struct cm_colorset set;
+ *
+ *	cmap_load(&cm, "bank.map");
+ *	if (cm_init(&cm, 256 << 20, NULL, 0) < 0)
+ *		...
+ *	cm_colorset_zero(&set);
+ *	cm_colorset_add(&set, 3);
+ *	cm_set_colors(&set);		(this thread: color 3 only)
+ *	p = cm_malloc(128);
+ *	...
+ *	cm_free(p);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "colormap.h"
+
+#define CM_MAX_FUNCS	10
+#define CM_MAX_COLORS	(1 << CM_MAX_FUNCS)
+#define CM_ALIGN	16	/* cm_malloc() alignment */
+
+/* cm_init() flags */
+#define CM_SMALL_PAGES	1	/* no huge pages, for cm_map_pages() */
+
+struct cm_colorset {
+	uint64_t	bits[CM_MAX_COLORS / 64];
+};
+
+struct cm_stats {
+	size_t		size;		/* pool bytes */
+	size_t		page_size;	/* pool page size */
+	size_t		chunk_size;
+	int		nr_colors;
+	uint64_t	nr_chunks;
+	uint64_t	free_chunks;	/* not yet carved into objects */
+	uint64_t	allocs;
+	uint64_t	frees;
+	uint64_t	refills;	/* thread cache refills */
+	uint64_t	failures;	/* no memory of the thread's colors */
+	uint64_t	region_pages;	/* out in cm_map_pages() regions */
+	uint64_t	lost_pages;	/* unmapped by the program, not us */
+};
+
+static inline void cm_colorset_zero(struct cm_colorset *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+static inline void cm_colorset_add(struct cm_colorset *set, int color)
+{
+	set->bits[color / 64] |= 1ULL << (color % 64);
+}
+
+static inline int cm_colorset_has(const struct cm_colorset *set, int color)
+{
+	return !!(set->bits[color / 64] & (1ULL << (color % 64)));
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * reserve and index a pool of size bytes. set is the default color set of
+ * threads that do not call cm_set_colors(), NULL for all colors.
+ * returns 0, or -1 with errno set
+ */
+int cm_init(const struct colormap *cm, size_t size,
+	    const struct cm_colorset *set, int flags);
+
+/* colors the calling thread allocates from. returns 0 or -1/EINVAL */
+int cm_set_colors(const struct cm_colorset *set);
+
+void *cm_malloc(size_t size);
+void *cm_calloc(size_t nmemb, size_t size);
+void *cm_memalign(size_t align, size_t size);
+void cm_free(void *ptr);
+size_t cm_usable_size(const void *ptr);
+
+/*
+ * zeroed, read-write mapping of len bytes, of the thread's colors.
+ * returns NULL with errno ENOMEM, or EOPNOTSUPP without a page-colored
+ * small page pool
+ */
+void *cm_map_pages(size_t len);
+
+/*
+ * give [addr, addr + len) of a cm_map_pages() mapping back to the pool,
+ * all of the mapping that starts at addr if len is 0. returns 0, or -1
+ * with EINVAL if addr is not in one
+ */
+int cm_unmap_pages(void *addr, size_t len);
+
+/* length of the cm_map_pages() mapping at addr, 0 if there is none */
+size_t cm_mapped_size(const void *addr);
+
+/* whether ptr is in the pool, and the color of the chunk it is in */
+int cm_owns(const void *ptr);
+int cm_color_of(const void *ptr);
+
+/* pool state; counters of live threads are added at their next refill */
+void cm_get_stats(struct cm_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CMALLOC_H */
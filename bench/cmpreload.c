@@ -0,0 +1,417 @@
+/**
+ * cmpreload: run unmodified programs in a color partition.
+ *
+ * An LD_PRELOAD shim over cmalloc that replaces malloc(), calloc(),
+ * realloc(), free(), the memalign family and anonymous mmap()s:
+ *
+ *	$ sudo CM_MAP=bank.map CM_COLORS=0-3 \
+ *		LD_PRELOAD=./libcmpreload.so ./latency -m 16384
+ *
+ * Environment:
+ *	CM_MAP=<file>[:<group>,...]	color map file, see colormap.h
+ *	CM_MASK=<mask>			or one function per address bit
+ *	CM_COLORS=<list>		colors to use, e.g. 0,2,4-7. default: all
+ *	CM_POOL_MB=<size>		pool size in MB. default: 256
+ *	CM_HUGE=1			pool of huge pages: no colored
+ *					allocations larger than a chunk
+ *	CM_QUIET=1			no report at exit
+ *
+ * Small allocations come from cm_malloc(), larger ones and anonymous
+ * private mmap()s from cm_map_pages(). What cannot be colored, because it
+ * came before the pool was ready, does not fit the map's chunks or ran out
+ * of colored memory, goes to glibc and is counted in the exit report.
+ * PROT_NONE and MAP_NORESERVE mappings are address space reservations and
+ * are passed through uncounted.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cmalloc.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define DEFAULT_POOL_MB 256
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+enum { OFF, INIT, ON };
+
+/* why an allocation is outside the color set */
+enum outside {
+	EARLY,		/* before the pool was ready */
+	TOO_LARGE,	/* larger than a chunk, pool cannot map pages */
+	NO_MEMORY,	/* no colored memory left */
+	ALIGNMENT,	/* alignment above the page size */
+	MMAP,		/* anonymous mmap() */
+	NR_OUTSIDE
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static const char * const outside_names[NR_OUTSIDE] = {
+	"before init", "too large", "out of colored memory", "alignment",
+	"mmap",
+};
+
+static int g_state = OFF;
+static size_t g_chunk_size;
+static size_t g_page_size = 4096;
+static uint64_t g_outside[NR_OUTSIDE];
+static uint64_t g_outside_bytes;
+static uint64_t g_page_maps;		/* colored cm_map_pages() */
+
+static size_t (*real_usable_size)(void *);
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static inline void *outside(enum outside why, size_t size, void *p)
+{
+	__atomic_add_fetch(&g_outside[why], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&g_outside_bytes, size, __ATOMIC_RELAXED);
+	return p;
+}
+
+static inline void *map_pages(size_t size)
+{
+	void *p = cm_map_pages(size);
+
+	if (p)
+		__atomic_add_fetch(&g_page_maps, 1, __ATOMIC_RELAXED);
+	return p;
+}
+
+/* size of a block from any of the allocators, 0 if unknown */
+static size_t block_size(void *ptr)
+{
+	if (cm_owns(ptr))
+		return cm_usable_size(ptr);
+	if (!((uintptr_t)ptr & (g_page_size - 1)) && cm_mapped_size(ptr))
+		return cm_mapped_size(ptr);
+	return real_usable_size ? real_usable_size(ptr) : 0;
+}
+
+void *malloc(size_t size)
+{
+	void *p;
+
+	if (g_state != ON)
+		return outside(EARLY, size, __libc_malloc(size));
+
+	if (size <= g_chunk_size) {
+		p = cm_malloc(size);
+		if (p)
+			return p;
+		return outside(NO_MEMORY, size, __libc_malloc(size));
+	}
+	p = map_pages(size);
+	if (p)
+		return p;
+	return outside(errno == EOPNOTSUPP ? TOO_LARGE : NO_MEMORY, size,
+		       __libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	size_t total;
+	void *p;
+
+	if (size && nmemb > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	total = nmemb * size;
+
+	if (g_state != ON)
+		return outside(EARLY, total, __libc_calloc(nmemb, size));
+
+	if (total <= g_chunk_size) {
+		p = cm_calloc(nmemb, size);
+		if (p)
+			return p;
+		return outside(NO_MEMORY, total, __libc_calloc(nmemb, size));
+	}
+	p = map_pages(total);		/* zeroed */
+	if (p)
+		return p;
+	return outside(errno == EOPNOTSUPP ? TOO_LARGE : NO_MEMORY, total,
+		       __libc_calloc(nmemb, size));
+}
+
+void free(void *ptr)
+{
+	int err = errno;
+
+	if (!ptr)
+		return;
+	if (cm_owns(ptr)) {
+		cm_free(ptr);
+		return;
+	}
+	/* regions are page aligned, glibc blocks hardly ever are */
+	if (!((uintptr_t)ptr & (g_page_size - 1)) && g_state == ON &&
+	    cm_unmap_pages(ptr, 0) == 0)
+		return;
+	errno = err;
+	__libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	size_t old;
+	void *p;
+
+	if (!ptr)
+		return malloc(size);
+	if (!size) {
+		free(ptr);
+		return NULL;
+	}
+
+	/* from glibc, before the pool or without its size */
+	if (!cm_owns(ptr) && (g_state != ON || !(old = block_size(ptr))))
+		return __libc_realloc(ptr, size);
+
+	old = block_size(ptr);
+	if (size <= old && (cm_owns(ptr) || old - size < g_page_size))
+		return ptr;
+
+	p = malloc(size);
+	if (!p)
+		return NULL;
+	memcpy(p, ptr, old < size ? old : size);
+	free(ptr);
+	return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+	void *p;
+
+	if (g_state != ON)
+		return outside(EARLY, size, __libc_memalign(align, size));
+	if (align <= CM_ALIGN)
+		return malloc(size);
+
+	if (size <= g_chunk_size && align <= g_chunk_size) {
+		p = cm_memalign(align, size);
+		if (p)
+			return p;
+		return outside(NO_MEMORY, size, __libc_memalign(align, size));
+	}
+	if (align > g_page_size)
+		return outside(ALIGNMENT, size, __libc_memalign(align, size));
+	p = map_pages(size);
+	if (p)
+		return p;
+	return outside(errno == EOPNOTSUPP ? TOO_LARGE : NO_MEMORY, size,
+		       __libc_memalign(align, size));
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+	void *p;
+
+	if (align & (align - 1) || align % sizeof(void *))
+		return EINVAL;
+	p = memalign(align, size);
+	if (!p)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	return memalign(align, size);
+}
+
+void *valloc(size_t size)
+{
+	return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = getpagesize();
+
+	return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	return ptr ? block_size(ptr) : 0;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	void *p;
+
+	if (g_state == ON && !addr && (flags & MAP_ANONYMOUS) &&
+	    (flags & MAP_PRIVATE) && prot != PROT_NONE &&
+	    !(flags & (MAP_FIXED | MAP_HUGETLB | MAP_NORESERVE |
+		       MAP_GROWSDOWN))) {
+		p = map_pages(len);
+		if (p) {
+			if (prot != (PROT_READ | PROT_WRITE))
+				mprotect(p, len, prot);
+			return p;
+		}
+		outside(MMAP, len, NULL);
+	}
+	return (void *)syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+	__attribute__((alias("mmap")));
+
+int munmap(void *addr, size_t len)
+{
+	/* our part goes back to the pool, the kernel unmaps the rest */
+	int err = errno;
+
+	if (g_state == ON && cm_unmap_pages(addr, len) < 0)
+		errno = err;
+	return syscall(SYS_munmap, addr, len);
+}
+
+/* "0,2,4-7" */
+static int parse_colors(const char *list, int nr_colors,
+			struct cm_colorset *set)
+{
+	const char *p = list;
+	char *end;
+	long first, last;
+
+	cm_colorset_zero(set);
+	while (*p) {
+		first = last = strtol(p, &end, 0);
+		if (end == p)
+			return -1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 0);
+			if (end == p)
+				return -1;
+		}
+		if (first < 0 || last >= nr_colors || first > last)
+			return -1;
+		for (; first <= last; first++)
+			cm_colorset_add(set, first);
+		p = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',')
+			return -1;
+	}
+	return 0;
+}
+
+__attribute__((constructor))
+static void cmpreload_init(void)
+{
+	const char *map = getenv("CM_MAP"), *mask = getenv("CM_MASK");
+	const char *colors = getenv("CM_COLORS"), *pool = getenv("CM_POOL_MB");
+	const char *huge = getenv("CM_HUGE");
+	struct colormap cm;
+	struct cm_colorset set;
+	struct cm_stats st;
+	size_t size = (size_t)DEFAULT_POOL_MB << 20;
+
+	g_page_size = getpagesize();
+	if (!map && !mask) {
+		fprintf(stderr, "cmpreload: no CM_MAP or CM_MASK, not coloring\n");
+		return;
+	}
+	g_state = INIT;
+
+	real_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT,
+						     "malloc_usable_size");
+
+	if (map) {
+		if (cmap_load(&cm, map) < 0) {
+			fprintf(stderr, "cmpreload: %s\n", cmap_strerror());
+			goto off;
+		}
+	} else {
+		cmap_from_mask(&cm, strtoull(mask, NULL, 0));
+	}
+	if (cm.nr_funcs > CM_MAX_FUNCS) {
+		fprintf(stderr, "cmpreload: %d functions, at most %d\n",
+			cm.nr_funcs, CM_MAX_FUNCS);
+		goto off;
+	}
+	if (colors && parse_colors(colors, cmap_nr_colors(&cm), &set) < 0) {
+		fprintf(stderr, "cmpreload: bad CM_COLORS %s, %d colors\n",
+			colors, cmap_nr_colors(&cm));
+		goto off;
+	}
+	if (pool)
+		size = strtoull(pool, NULL, 0) << 20;
+
+	if (cm_init(&cm, size, colors ? &set : NULL,
+		    huge && atoi(huge) ? 0 : CM_SMALL_PAGES) < 0) {
+		fprintf(stderr, "cmpreload: pool of %zu MB: %s\n", size >> 20,
+			strerror(errno));
+		goto off;
+	}
+	cm_get_stats(&st);
+	g_chunk_size = st.chunk_size;
+	g_state = ON;
+	return;
+off:
+	g_state = OFF;
+}
+
+__attribute__((destructor))
+static void cmpreload_report(void)
+{
+	const char *quiet = getenv("CM_QUIET");
+	struct cm_stats st;
+	uint64_t total = 0;
+	int i;
+
+	if (g_state != ON || (quiet && atoi(quiet)))
+		return;
+
+	cm_get_stats(&st);
+	for (i = 0; i < NR_OUTSIDE; i++)
+		total += g_outside[i];
+	fprintf(stderr, "cmpreload: %" PRIu64 " colored allocations, %"
+		PRIu64 " page mappings (%" PRIu64 " pages out), "
+		"%" PRIu64 " of %" PRIu64 " chunks free\n",
+		st.allocs, g_page_maps, st.region_pages,
+		st.free_chunks, st.nr_chunks);
+	fprintf(stderr, "cmpreload: %" PRIu64 " outside the color set (%"
+		PRIu64 " KB):", total, g_outside_bytes >> 10);
+	for (i = 0; i < NR_OUTSIDE; i++)
+		if (g_outside[i])
+			fprintf(stderr, " %s %" PRIu64, outside_names[i],
+				g_outside[i]);
+	fprintf(stderr, "\n");
+	if (st.lost_pages)
+		fprintf(stderr, "cmpreload: %" PRIu64 " pages unmapped behind "
+			"our back\n", st.lost_pages);
+}
@@ -0,0 +1,327 @@
+#ifndef __COLORMAP_H
+#define __COLORMAP_H
+
+/*
+ * Physical address to color (cache set / DRAM bank) mapping, shared by
+ * pll, pagetype and pgtrace.
+ *
+ * A map is a list of XOR functions, one per color bit. Function i is the
+ * mask of the physical address bits it XORs, so color bit i is
+ * parity(paddr & mask[i]).
+ *
+ * Map files have one function per line, as the address bit numbers
+ * (0-63) it XORs. Functions may be grouped by the level of the memory
+ * hierarchy they select, under a [group] line: channel, rank, bankgroup,
+ * bank, slice (LLC slice) or set (LLC set). Functions before the first
+ * group line belong to "color", which keeps plain bit lists valid map
+ * files. '#' starts a comment.
+ *
+ *	# DDR4, 2 channels
+ *	[channel]
+ *	8 12 13 14 15 16 17 18 19 20 21
+ *	[bank]
+ *	13 17
+ *	14 18
+ *
+ * Tools take a map as "file" or "file:group[,group...]". The color is
+ * made of the selected groups' functions in that order, by default of
+ * all functions in file order. Files are validated: unknown groups,
+ * bad or repeated bits, empty or repeated groups, and functions that
+ * are the XOR of others (which would leave colors unused) are errors,
+ * reported by cmap_strerror().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#define CMAP_MAX_FUNCS	16
+#define CMAP_BLOCK	256	/* cmap_colors() block, stays in L1 */
+
+enum cmap_group {
+	CMAP_COLOR,
+	CMAP_CHANNEL,
+	CMAP_RANK,
+	CMAP_BANKGROUP,
+	CMAP_BANK,
+	CMAP_SLICE,
+	CMAP_SET,
+	NR_CMAP_GROUPS
+};
+
+/* in enum cmap_group order */
+static const char * const cmap_group_names[NR_CMAP_GROUPS] = {
+	"color", "channel", "rank", "bankgroup", "bank", "slice", "set",
+};
+
+struct colormap {
+	int		nr_funcs;
+	uint64_t	mask[CMAP_MAX_FUNCS];
+	uint8_t		group[CMAP_MAX_FUNCS];	/* enum cmap_group */
+};
+
+/* the reason of the last cmap_load() failure */
+static inline char *cmap_strerror(void)
+{
+	static char buf[256];
+
+	return buf;
+}
+
+static inline int cmap_fail(FILE *fp, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(cmap_strerror(), 256, fmt, ap);
+	va_end(ap);
+	if (fp)
+		fclose(fp);
+	errno = EINVAL;
+	return -1;
+}
+
+static inline int cmap_find_group(const char *name, size_t len)
+{
+	int g;
+
+	for (g = 0; g < NR_CMAP_GROUPS; g++)
+		if (strlen(cmap_group_names[g]) == len &&
+		    !strncmp(cmap_group_names[g], name, len))
+			return g;
+	return -1;
+}
+
+/*
+ * index of the first function of cm that is the XOR of earlier ones,
+ * -1 if they are all independent (gaussian elimination over GF(2))
+ */
+static inline int cmap_dependent(const struct colormap *cm)
+{
+	uint64_t basis[64] = { 0 };
+	uint64_t x;
+	int i, bit;
+
+	for (i = 0; i < cm->nr_funcs; i++) {
+		for (x = cm->mask[i]; x; x ^= basis[bit]) {
+			bit = 63 - __builtin_clzll(x);
+			if (!basis[bit]) {
+				basis[bit] = x;
+				break;
+			}
+		}
+		if (!x)
+			return i;
+	}
+	return -1;
+}
+
+/* one function per set bit of mask: the classic bank/color bitmask */
+static inline void cmap_from_mask(struct colormap *cm, uint64_t mask)
+{
+	int bit;
+
+	cm->nr_funcs = 0;
+	for (bit = 0; bit < 64 && cm->nr_funcs < CMAP_MAX_FUNCS; bit++)
+		if (mask & (1ULL << bit)) {
+			cm->group[cm->nr_funcs] = CMAP_COLOR;
+			cm->mask[cm->nr_funcs++] = 1ULL << bit;
+		}
+}
+
+/* parse all groups of a map file into cm, in file order */
+static inline int cmap_parse(struct colormap *cm, const char *filename)
+{
+	char line[1024], *p, *end;
+	int lineno = 0, group = CMAP_COLOR, seen = 0, funcs = 0;
+	uint64_t mask;
+	long bit;
+	FILE *fp;
+	int i;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		return cmap_fail(NULL, "%s: %s", filename, strerror(errno));
+
+	cm->nr_funcs = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+		p = line + strspn(line, " \t\r\n");
+		if (!*p)
+			continue;
+
+		if (*p == '[') {
+			end = strchr(p, ']');
+			if (!end)
+				return cmap_fail(fp, "%s:%d: missing ]",
+						 filename, lineno);
+			if (funcs == 0 && (seen & (1 << group)))
+				return cmap_fail(fp, "%s:%d: empty group %s",
+						 filename, lineno - 1,
+						 cmap_group_names[group]);
+			group = cmap_find_group(p + 1, end - p - 1);
+			if (group < 0)
+				return cmap_fail(fp, "%s:%d: unknown group %.*s",
+						 filename, lineno,
+						 (int)(end - p - 1), p + 1);
+			if (seen & (1 << group))
+				return cmap_fail(fp, "%s:%d: group %s repeated",
+						 filename, lineno,
+						 cmap_group_names[group]);
+			seen |= 1 << group;
+			funcs = 0;
+			continue;
+		}
+
+		mask = 0;
+		for (p = strtok(p, " \t\r\n"); p; p = strtok(NULL, " \t\r\n")) {
+			bit = strtol(p, &end, 10);
+			if (*end || bit < 0 || bit > 63)
+				return cmap_fail(fp, "%s:%d: bad bit number %s",
+						 filename, lineno, p);
+			if (mask & (1ULL << bit))
+				return cmap_fail(fp, "%s:%d: bit %ld repeated",
+						 filename, lineno, bit);
+			mask |= 1ULL << bit;
+		}
+		if (cm->nr_funcs >= CMAP_MAX_FUNCS)
+			return cmap_fail(fp, "%s:%d: more than %d functions",
+					 filename, lineno, CMAP_MAX_FUNCS);
+		for (i = 0; i < cm->nr_funcs; i++)
+			if (cm->mask[i] == mask)
+				return cmap_fail(fp, "%s:%d: function repeated",
+						 filename, lineno);
+		seen |= 1 << group;
+		cm->group[cm->nr_funcs] = group;
+		cm->mask[cm->nr_funcs++] = mask;
+		funcs++;
+	}
+	fclose(fp);
+
+	if (funcs == 0 && (seen & (1 << group)))
+		return cmap_fail(NULL, "%s: empty group %s", filename,
+				 cmap_group_names[group]);
+	if (!cm->nr_funcs)
+		return cmap_fail(NULL, "%s: no functions", filename);
+	return 0;
+}
+
+/*
+ * load a map, "file" or "file:group[,group...]". returns 0, or -1 with
+ * errno set and the reason in cmap_strerror()
+ */
+static inline int cmap_load(struct colormap *cm, const char *spec)
+{
+	char path[4096];
+	const char *sel = strrchr(spec, ':'), *p, *end;
+	struct colormap all;
+	int g, i, bad;
+
+	/* a ':' followed by group names selects them */
+	for (p = sel ? sel + 1 : NULL; p && *p; p = *end ? end + 1 : end) {
+		end = p + strcspn(p, ",");
+		if (cmap_find_group(p, end - p) < 0) {
+			sel = NULL;
+			break;
+		}
+	}
+	if (sel && !sel[1])
+		sel = NULL;
+
+	snprintf(path, sizeof(path), "%.*s",
+		 sel ? (int)(sel - spec) : (int)strlen(spec), spec);
+	if (cmap_parse(&all, path) < 0)
+		return -1;
+
+	if (!sel) {
+		*cm = all;
+	} else {
+		cm->nr_funcs = 0;
+		for (p = sel + 1; *p; p = *end ? end + 1 : end) {
+			end = p + strcspn(p, ",");
+			g = cmap_find_group(p, end - p);
+			for (i = 0; i < all.nr_funcs; i++) {
+				if (all.group[i] != g)
+					continue;
+				cm->group[cm->nr_funcs] = g;
+				cm->mask[cm->nr_funcs++] = all.mask[i];
+			}
+		}
+		if (!cm->nr_funcs)
+			return cmap_fail(NULL, "%s: no functions in %s",
+					 path, sel + 1);
+	}
+
+	bad = cmap_dependent(cm);
+	if (bad >= 0)
+		return cmap_fail(NULL, "%s: %s function %d is the XOR of "
+				 "other functions", path,
+				 cmap_group_names[cm->group[bad]], bad);
+	return 0;
+}
+
+/*
+ * Rebase the map on (address >> shift), e.g. PAGE_SHIFT to color PFNs.
+ * Bits below shift are dropped.
+ */
+static inline void cmap_shift(struct colormap *cm, int shift)
+{
+	int i;
+
+	for (i = 0; i < cm->nr_funcs; i++)
+		cm->mask[i] >>= shift;
+}
+
+static inline int cmap_nr_colors(const struct colormap *cm)
+{
+	return 1 << cm->nr_funcs;
+}
+
+static inline int cmap_color(const struct colormap *cm, uint64_t paddr)
+{
+	int i, color = 0;
+
+	for (i = 0; i < cm->nr_funcs; i++)
+		color |= __builtin_parityll(paddr & cm->mask[i]) << i;
+	return color;
+}
+
+/*
+ * colors of n addresses. Function by function over blocks of CMAP_BLOCK,
+ * with parity done by xor folding, so the inner loop is plain shifts and
+ * xors the compiler vectorizes (AVX2/AVX-512, NEON).
+ */
+static inline void cmap_colors(const struct colormap *cm,
+			       const uint64_t *__restrict paddr,
+			       uint16_t *__restrict color, size_t n)
+{
+	size_t i, j, len;
+	uint64_t x, m;
+	int f;
+
+	for (i = 0; i < n; i += CMAP_BLOCK) {
+		len = n - i < CMAP_BLOCK ? n - i : CMAP_BLOCK;
+		for (j = 0; j < len; j++)
+			color[i + j] = 0;
+		for (f = 0; f < cm->nr_funcs; f++) {
+			m = cm->mask[f];
+			for (j = 0; j < len; j++) {
+				x = paddr[i + j] & m;
+				x ^= x >> 32;
+				x ^= x >> 16;
+				x ^= x >> 8;
+				x ^= x >> 4;
+				x ^= x >> 2;
+				x ^= x >> 1;
+				color[i + j] |= (uint16_t)((x & 1) << f);
+			}
+		}
+	}
+}
+
+#endif /* __COLORMAP_H */
@@ -1,39 +1,410 @@
+#define _GNU_SOURCE
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
+#define MAX_THREADS 64
+#define BATCH 4096                 // loop iterations between counter updates
+#define DEFAULT_L1_WS_KB 16        // fits in any L1D
 
-volatile int64_t count = 0;
+// per-thread op counters, padded to avoid false sharing among the hogs
+struct counter {
+  volatile int64_t ops;
+  volatile int64_t count;        // the count kernel's own variable
+  char pad[64 - 2 * sizeof(int64_t)];
+} __attribute__((aligned(64)));
 
-// Signal handler function
-void handle_sigint(int sig) {
-  printf("\nReceived SIGINT (Ctrl+C). Exiting gracefully...\n");
-  printf("count=%ld\n", count);
-  exit(0);
+struct kernel {
+  const char *name;
+  const char *desc;
+  void (*run)(struct counter *c);
+  int (*supported)(void);
+};
+
+static struct counter counters[MAX_THREADS];
+static int nthreads = 1;
+static int l1_ws = DEFAULT_L1_WS_KB * 1024;
+static struct kernel *kernel;
+
+/*
+ * compute kernels. each one loops forever and adds the number of
+ * operations it completed to its counter every BATCH iterations.
+ */
+static void run_count(struct counter *c)
+{
+  int i;
+
+  while (1) {
+    for (i = 0; i < BATCH; i++)
+      c->count++;
+    c->ops += BATCH;
+  }
+}
+
+// integer ALU: four independent add/xor/shift chains
+static void run_int(struct counter *c)
+{
+  uint64_t a = 1, b = 2, d = 3, e = 4;
+  int i;
+
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      a = (a + i) ^ (a >> 3);
+      b = (b ^ i) + (b << 1);
+      d = (d + b) ^ (d >> 5);
+      e = (e ^ a) + (e << 2);
+      __asm__ volatile("" : "+r"(a), "+r"(b), "+r"(d), "+r"(e));
+    }
+    c->ops += BATCH * 4;
+  }
+}
+
+// scalar FP: four independent mul/add chains
+static void run_fp(struct counter *c)
+{
+  double a = 1.0, b = 1.1, d = 1.2, e = 1.3;
+  const double m = 0.999999, k = 1e-7;
+  int i;
+
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      a = a * m + k;
+      b = b * m + k;
+      d = d * m + k;
+      e = e * m + k;
+      __asm__ volatile("" : "+x"(a), "+x"(b), "+x"(d), "+x"(e));
+    }
+    c->ops += BATCH * 8;
+  }
 }
 
-int main()
+#if defined(__x86_64__) || defined(__i386__)
+static int avx2_supported(void)
 {
-  struct sigaction sa;
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
 
-  sa.sa_handler = handle_sigint; // Set handler function
-  sigemptyset(&sa.sa_mask);      // No additional signals blocked
-  sa.sa_flags = 0;               // No special flags
+// 256-bit FMA: 8 independent chains of 4 doubles (2 flops each)
+__attribute__((target("avx2,fma")))
+static void run_avx2(struct counter *c)
+{
+  __m256d v[8], m = _mm256_set1_pd(0.999999), k = _mm256_set1_pd(1e-7);
+  int i, j;
+
+  for (j = 0; j < 8; j++)
+    v[j] = _mm256_set1_pd(1.0 + j);
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      for (j = 0; j < 8; j++)
+        v[j] = _mm256_fmadd_pd(v[j], m, k);
+      __asm__ volatile("" : "+x"(v[0]), "+x"(v[1]), "+x"(v[2]), "+x"(v[3]),
+                       "+x"(v[4]), "+x"(v[5]), "+x"(v[6]), "+x"(v[7]));
+    }
+    c->ops += (int64_t)BATCH * 8 * 4 * 2;
+  }
+}
+
+static int avx512_supported(void)
+{
+  return __builtin_cpu_supports("avx512f");
+}
+
+// 512-bit FMA: 8 independent chains of 8 doubles (2 flops each)
+__attribute__((target("avx512f")))
+static void run_avx512(struct counter *c)
+{
+  __m512d v[8], m = _mm512_set1_pd(0.999999), k = _mm512_set1_pd(1e-7);
+  int i, j;
+
+  for (j = 0; j < 8; j++)
+    v[j] = _mm512_set1_pd(1.0 + j);
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      for (j = 0; j < 8; j++)
+        v[j] = _mm512_fmadd_pd(v[j], m, k);
+      __asm__ volatile("" : "+v"(v[0]), "+v"(v[1]), "+v"(v[2]), "+v"(v[3]),
+                       "+v"(v[4]), "+v"(v[5]), "+v"(v[6]), "+v"(v[7]));
+    }
+    c->ops += (int64_t)BATCH * 8 * 8 * 2;
+  }
+}
+#endif
+
+#if defined(__ARM_NEON)
+static int neon_supported(void)
+{
+  return 1;
+}
+
+// 128-bit FMA: 8 independent chains of 4 floats (2 flops each)
+static void run_neon(struct counter *c)
+{
+  float32x4_t v[8], m = vdupq_n_f32(0.9999f), k = vdupq_n_f32(1e-7f);
+  int i, j;
+
+  for (j = 0; j < 8; j++)
+    v[j] = vdupq_n_f32(1.0f + j);
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      for (j = 0; j < 8; j++)
+        v[j] = vfmaq_f32(k, v[j], m);
+      __asm__ volatile("" : "+w"(v[0]), "+w"(v[1]), "+w"(v[2]), "+w"(v[3]),
+                       "+w"(v[4]), "+w"(v[5]), "+w"(v[6]), "+w"(v[7]));
+    }
+    c->ops += (int64_t)BATCH * 8 * 4 * 2;
+  }
+}
+#endif
+
+// branch mispredict heavy: branch on pseudo-random bits (xorshift)
+static void run_branch(struct counter *c)
+{
+  uint64_t x = 88172645463325252ULL, sum = 0;
+  int i;
+
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      if (x & 1)
+        sum += x;
+      else
+        sum ^= x;
+      __asm__ volatile("" : "+r"(sum));
+    }
+    c->ops += BATCH;
+  }
+}
+
+// small working set: read-modify-write of every line of an L1-sized buffer
+static void run_l1(struct counter *c)
+{
+  volatile int64_t *buf = aligned_alloc(64, l1_ws);
+  int nlines = l1_ws / 64, i;
 
-  // Set the signal handler for SIGINT
-  if (sigaction(SIGINT, &sa, NULL) == -1) {
-    perror("sigaction");
+  if (!buf) {
+    perror("l1 working set");
     exit(1);
   }
+  memset((void *)buf, 0, l1_ws);
+  while (1) {
+    for (i = 0; i < nlines; i++)
+      buf[i * 8] += 1;
+    c->ops += nlines;
+  }
+}
+
+static int always_supported(void)
+{
+  return 1;
+}
+
+static struct kernel kernels[] = {
+  { "count",  "counter increments", run_count, always_supported },
+  { "int",    "integer ops", run_int, always_supported },
+  { "fp",     "double flops", run_fp, always_supported },
+#if defined(__x86_64__) || defined(__i386__)
+  { "avx2",   "double flops (256-bit FMA)", run_avx2, avx2_supported },
+  { "avx512", "double flops (512-bit FMA)", run_avx512, avx512_supported },
+#endif
+#if defined(__ARM_NEON)
+  { "neon",   "float flops (128-bit FMA)", run_neon, neon_supported },
+#endif
+  { "branch", "unpredictable branches", run_branch, always_supported },
+  { "l1",     "line updates", run_l1, always_supported },
+};
+
+static int64_t total_ops(void)
+{
+  int64_t sum = 0;
+  int i;
+
+  for (i = 0; i < nthreads; i++)
+    sum += counters[i].ops;
+  return sum;
+}
+
+static int64_t total_count(void)
+{
+  int64_t sum = 0;
+  int i;
+
+  for (i = 0; i < nthreads; i++)
+    sum += counters[i].count;
+  return sum;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double start_time;
+
+// final report, from main once it took a terminating signal
+static void report(int sig)
+{
+  printf("\nReceived %s. Exiting gracefully...\n",
+         (sig == SIGINT) ? "SIGINT (Ctrl+C)" : strsignal(sig));
+  if (kernel->run == run_count)
+    printf("count=%ld\n", total_count());
+  else
+    printf("ops=%ld (%s) %.2f Mops/s\n", total_ops(), kernel->desc,
+           total_ops() / (now() - start_time) / 1e6);
+}
 
+static void *worker(void *arg)
+{
+  kernel->run(arg);
+  return NULL;
+}
+
+static void usage(char *argv0)
+{
+  int i;
+
+  printf("Usage: %s [options]\n", argv0);
+  printf("  -k <kernel> : compute kernel (default: count)\n");
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    printf("                %-7s %s%s\n", kernels[i].name, kernels[i].desc,
+           kernels[i].supported() ? "" : " [not supported]");
+  printf("  -n <num>    : number of threads (default: 1)\n");
+  printf("  -c <cpu>    : pin thread i to CPU cpu+i (default: not pinned)\n");
+  printf("  -i <sec>    : report ops/s every <sec> seconds (default: 0, off)\n");
+  printf("  -t <sec>    : time to run (default: 0, until SIGINT)\n");
+  printf("  -m <size>   : working set of the l1 kernel in KB (default: %d)\n",
+         DEFAULT_L1_WS_KB);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  sigset_t sigs;
+  struct timespec ts;
+  pthread_t tid[MAX_THREADS];
+  cpu_set_t cmask;
+  int cpuid = -1, interval = 0, duration = 0;
+  int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  int64_t prev[MAX_THREADS] = { 0 };
+  double prev_time;
+  int opt, sig, i;
+
+  kernel = &kernels[0];
+  while ((opt = getopt(argc, argv, "k:n:c:i:t:m:h")) != -1) {
+    switch (opt) {
+    case 'k':
+      for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+        if (!strcmp(optarg, kernels[i].name))
+          break;
+      if (i == sizeof(kernels) / sizeof(kernels[0])) {
+        fprintf(stderr, "unknown kernel %s\n", optarg);
+        exit(1);
+      }
+      kernel = &kernels[i];
+      break;
+    case 'n':
+      nthreads = strtol(optarg, NULL, 0);
+      if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "number of threads must be 1..%d\n", MAX_THREADS);
+        exit(1);
+      }
+      break;
+    case 'c':
+      cpuid = strtol(optarg, NULL, 0);
+      break;
+    case 'i':
+      interval = strtol(optarg, NULL, 0);
+      break;
+    case 't':
+      duration = strtol(optarg, NULL, 0);
+      break;
+    case 'm':
+      l1_ws = 1024 * strtol(optarg, NULL, 0);
+      if (l1_ws <= 0) {
+        fprintf(stderr, "working set must be at least 1 KB\n");
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (!kernel->supported()) {
+    fprintf(stderr, "kernel %s is not supported on this CPU\n", kernel->name);
+    exit(1);
+  }
+
+  // SIGINT, and SIGTERM/SIGALRM so that killed or timed runs report as
+  // well. Blocked here and so in the workers: main waits for them and
+  // prints the report itself, never from a handler
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGALRM);
+  if (pthread_sigmask(SIG_BLOCK, &sigs, NULL) != 0) {
+    perror("pthread_sigmask");
+    exit(1);
+  }
+
+  printf("kernel=%s threads=%d cpu=%d\n", kernel->name, nthreads, cpuid);
   printf("Press Ctrl+C to terminate the program.\n");
-    
-  while(1) {
-    count++;
+
+  start_time = prev_time = now();
+  for (i = 0; i < nthreads; i++) {
+    pthread_create(&tid[i], NULL, worker, &counters[i]);
+    if (cpuid >= 0) {
+      CPU_ZERO(&cmask);
+      CPU_SET((cpuid + i) % ncpus, &cmask);
+      if (pthread_setaffinity_np(tid[i], sizeof(cpu_set_t), &cmask) != 0)
+        perror("pthread_setaffinity_np");
+    }
+  }
+  if (duration > 0)
+    alarm(duration);
+
+  while (1) {
+    double t, dt;
+    int64_t delta = 0;
+
+    if (interval <= 0) {
+      sigwait(&sigs, &sig);
+      break;
+    }
+    ts.tv_sec = interval;
+    ts.tv_nsec = 0;
+    if ((sig = sigtimedwait(&sigs, NULL, &ts)) > 0)
+      break;
+    t = now();
+    dt = t - prev_time;
+    for (i = 0; i < nthreads; i++) {
+      int64_t ops = counters[i].ops;
+      if (nthreads > 1)
+        printf("thread %d: %.2f Mops/s | ", i, (ops - prev[i]) / dt / 1e6);
+      delta += ops - prev[i];
+      prev[i] = ops;
+    }
+    printf("total: %.2f Mops/s (%s)\n", delta / dt / 1e6, kernel->desc);
+    fflush(stdout);
+    prev_time = t;
   }
 
-  // printf("count=%ld\n", count);
+  report(sig);
   return 0;
 }
@@ -0,0 +1,88 @@
+#ifndef __IBSYNC_H
+#define __IBSYNC_H
+
+/*
+ * Protocol between the isolbench driver and the programs it runs.
+ *
+ * isolbench hands each child one end of a socketpair, its descriptor
+ * number in ISOLBENCH_FD. Messages are text lines:
+ *
+ *	child -> driver		ready			set up, waiting for start
+ *				result <key> <value>	a number of the run
+ *	driver -> child		start			go
+ *
+ * A program calls ib_ready() once its memory is set up, right before the
+ * measured loop, and ib_result() for each number the driver records. The
+ * driver stops co-runners with SIGINT, so their results are sent from the
+ * SIGINT path. Without ISOLBENCH_FD both do nothing: programs behave the
+ * same when run by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define IB_ENV		"ISOLBENCH_FD"
+#define IB_MSG_MAX	256
+
+/* the driver's descriptor, -1 when not run by isolbench */
+static inline int ib_fd(void)
+{
+	static int fd = -2;
+	const char *env;
+
+	if (fd == -2) {
+		env = getenv(IB_ENV);
+		fd = env ? atoi(env) : -1;
+	}
+	return fd;
+}
+
+static inline void ib_send(const char *msg)
+{
+	size_t len = strlen(msg), done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = write(ib_fd(), msg + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		done += n;
+	}
+}
+
+/* tell the driver we are set up, and wait for its start */
+static inline void ib_ready(void)
+{
+	char buf[8];
+	size_t got = 0;
+	ssize_t n;
+
+	if (ib_fd() < 0)
+		return;
+	ib_send("ready\n");
+	while (got < 6) {
+		n = read(ib_fd(), buf + got, 6 - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			exit(1);	/* the driver is gone */
+		got += n;
+	}
+}
+
+static inline void ib_result(const char *key, double value)
+{
+	char msg[IB_MSG_MAX];
+
+	if (ib_fd() < 0)
+		return;
+	snprintf(msg, sizeof(msg), "result %s %.10g\n", key, value);
+	ib_send(msg);
+}
+
+#endif /* __IBSYNC_H */
@@ -0,0 +1,1202 @@
+/**
+ * isolbench: run an isolation benchmark experiment from one config
+ *
+ * Runs a subject program alone and next to co-runners, each pinned to its
+ * CPU and in its cgroup, a number of repetitions, and writes all results
+ * to one JSON file. Programs are forked and exec'ed; each gets a socket to
+ * the driver (see ibsync.h) on which it says when it is set up, waits for
+ * the start, and sends its results. No sleeps, no scraping of text output,
+ * no killall: co-runners are all ready and started before the subject is,
+ * and are stopped with SIGINT once it is done.
+ *
+ * Config format, one statement per line, '#' comments, ${name} expands a
+ * set variable or an environment variable:
+ *
+ *	set <name> <value>
+ *	output <file>			results file. default: isolbench.json
+ *	cgroup_root <dir>		of relative cgroups. default: /sys/fs/cgroup/palloc
+ *	timeout <sec>			per run. default: 600
+ *	experiment <name>		starts an experiment
+ *	repetitions <n>			runs per step (the minimum with ci). default: 1
+ *	max_repetitions <n>		with ci, at most n runs per step
+ *	ci <percent>			stop a step once the 95% confidence
+ *					interval of the metric is within
+ *					percent of its mean. default: 0, off
+ *	warmup <n>			runs per step before the measured ones,
+ *					not in the statistics. default: 0
+ *	outliers <k>			statistics without subject results more
+ *					than k deviations from the median.
+ *					default: 3, 0 keeps all
+ *	flush <0|1>			evict the caches before each run. default: 0
+ *	sweep <0|1>			steps of 0..N co-runners, or only N. default: 1
+ *	placement all|<class>[,<class>]*	co-runner CPUs by class, see below
+ *	metric <key> [higher]		subject result for slowdowns. default:
+ *					average_ns, lower is better
+ *	subject [<opt>=<value>]* <command line>
+ *	corunner [<opt>=<value>]* <command line>
+ *
+ * Task options: cpu=<n> to pin, cgroup=<dir> to join, bins=<list> to
+ * write to the cgroup's palloc.bins, sync=0 for programs without ibsync.h
+ * support (ready as soon as forked, no results). repetitions and sweep
+ * before the first experiment are the defaults of all of them.
+ *
+ * Variables not set otherwise come from the machine's topology (see
+ * topology.c): llc_ws, dram_ws, subject_cpu and corunner_cpu1..3.
+ *
+ * Each step (a number of co-runners, in a placement class) reports the
+ * mean, median, stddev, 95% confidence interval, min and max of every
+ * subject result, outliers rejected by the median absolute deviation.
+ *
+ * With placement, the co-runners' cpu= are ignored: the subject runs alone,
+ * then next to co-runners on the CPUs of each class in turn, and the
+ * report has the slowdown of each class against running alone. Every
+ * class runs the same number of co-runners, the most that each class
+ * with CPUs can fill, so the slowdowns compare. Classes, relative to the
+ * subject's CPU: smt (same core), same-l2 (a cache below the LLC),
+ * same-llc (only the LLC), other-llc (same package and node, no shared
+ * cache), other-socket (other package or NUMA node).
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "isolbench.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define MAX_ARGS		64
+#define MAX_CORUNNERS		64
+#define MAX_EXPERIMENTS		64
+#define MAX_RESULTS		16
+#define MAX_TRIALS		1000	/* runs per step */
+#define MAX_VARS		64
+
+#define DEFAULT_OUTPUT		"isolbench.json"
+#define DEFAULT_CGROUP_ROOT	"/sys/fs/cgroup/palloc"
+#define DEFAULT_TIMEOUT		600
+#define STOP_TIMEOUT_MS		5000	/* co-runner SIGINT to SIGKILL */
+#define FLUSH_SIZE		(64 << 20)	/* without LLC info */
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+struct result {
+	char		key[32];
+	double		value;
+};
+
+struct task {
+	char		*cmd;		/* argv joined, for the report */
+	char		*argv[MAX_ARGS + 1];
+	int		cpu;		/* -1: not pinned */
+	char		*cgroup;
+	char		*bins;
+	int		sync;
+
+	/* a run */
+	pid_t		pid;
+	int		fd;
+	char		buf[IB_MSG_MAX];
+	size_t		len;
+	int		ready;
+	int		status;
+	struct result	results[MAX_RESULTS];
+	int		nr_results;
+};
+
+/* the runs with the same co-runners */
+struct step {
+	int		corunners;
+	const char	*place;		/* NULL: as configured */
+	int		trials;		/* successful, without warmup */
+	int		nr_keys;
+	char		keys[MAX_RESULTS][32];
+	struct ib_stats	stats[MAX_RESULTS];
+};
+
+struct experiment {
+	char		*name;
+	int		repetitions;
+	int		max_repetitions;
+	double		ci;		/* percent of the mean, 0: off */
+	int		warmup;
+	double		outliers;
+	int		flush;
+	int		sweep;
+	unsigned	placements;	/* 1 << enum ib_place */
+	char		*metric;
+	int		higher;		/* metric: higher is better */
+	struct task	*subject;
+	struct task	*corunners[MAX_CORUNNERS];
+	int		nr_corunners;
+
+	struct step	*steps;
+	int		nr_steps;
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static char *g_output = DEFAULT_OUTPUT;
+static char *g_cgroup_root = DEFAULT_CGROUP_ROOT;
+static int g_timeout = DEFAULT_TIMEOUT;
+static int g_verbose;
+
+static struct experiment g_defaults = {
+	.repetitions = 1,
+	.outliers = 3,
+	.sweep = 1,
+	.metric = "average_ns",
+};
+static struct experiment *g_exps[MAX_EXPERIMENTS];
+static int g_nr_exps;
+
+static char *g_var_names[MAX_VARS], *g_var_values[MAX_VARS];
+static int g_nr_vars;
+
+static volatile pid_t g_running[MAX_CORUNNERS + 1];	/* to kill on SIGINT */
+
+static struct ib_topology *g_topo;	/* NULL: not available */
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static void fatal(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "isolbench: ");
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_var(const char *name, const char *value)
+{
+	int i;
+
+	for (i = 0; i < g_nr_vars; i++)
+		if (!strcmp(g_var_names[i], name))
+			break;
+	if (i == MAX_VARS)
+		fatal("more than %s variables", "64");
+	if (i == g_nr_vars) {
+		g_var_names[i] = strdup(name);
+		g_nr_vars++;
+	} else {
+		free(g_var_values[i]);
+	}
+	g_var_values[i] = strdup(value);
+}
+
+static const char *get_var(const char *name)
+{
+	int i;
+
+	for (i = 0; i < g_nr_vars; i++)
+		if (!strcmp(g_var_names[i], name))
+			return g_var_values[i];
+	return getenv(name);
+}
+
+/* ${name} expansion of line into out. returns -1 on an unset name */
+static int expand(const char *line, char *out, size_t size, char *bad)
+{
+	const char *p = line, *end, *val;
+	char name[64];
+	size_t len = 0, n;
+
+	while (*p && len + 1 < size) {
+		if (p[0] != '$' || p[1] != '{') {
+			out[len++] = *p++;
+			continue;
+		}
+		end = strchr(p, '}');
+		if (!end || end - p - 2 >= (long)sizeof(name)) {
+			strcpy(bad, "${");
+			return -1;
+		}
+		snprintf(name, sizeof(name), "%.*s", (int)(end - p - 2), p + 2);
+		val = get_var(name);
+		if (!val) {
+			strcpy(bad, name);
+			return -1;
+		}
+		n = strlen(val);
+		if (len + n >= size)
+			n = size - len - 1;
+		memcpy(out + len, val, n);
+		len += n;
+		p = end + 1;
+	}
+	out[len] = '\0';
+	return 0;
+}
+
+/* "[opt=value]* command line" */
+static struct task *parse_task(char *args)
+{
+	struct task *t = calloc(1, sizeof(*t));
+	size_t len = strlen(args) + 1;
+	char *word, *value;
+	int argc = 0;
+
+	if (!t)
+		fatal("out of %s", "memory");
+	t->cpu = -1;
+	t->sync = 1;
+	t->fd = -1;
+	for (word = strtok(args, " \t"); word; word = strtok(NULL, " \t")) {
+		value = strchr(word, '=');
+		if (argc == 0 && value) {
+			*value++ = '\0';
+			if (!strcmp(word, "cpu"))
+				t->cpu = atoi(value);
+			else if (!strcmp(word, "cgroup"))
+				t->cgroup = strdup(value);
+			else if (!strcmp(word, "bins"))
+				t->bins = strdup(value);
+			else if (!strcmp(word, "sync"))
+				t->sync = atoi(value);
+			else
+				return NULL;
+			continue;
+		}
+		if (argc == MAX_ARGS)
+			return NULL;
+		t->argv[argc++] = strdup(word);
+	}
+	if (!argc)
+		return NULL;
+	t->argv[argc] = NULL;
+
+	t->cmd = calloc(1, len);
+	for (argc = 0; t->argv[argc]; argc++) {
+		if (argc)
+			strcat(t->cmd, " ");
+		strcat(t->cmd, t->argv[argc]);
+	}
+	return t;
+}
+
+/* "all" or class names separated by commas or spaces */
+static int parse_placements(char *args, unsigned *mask)
+{
+	char *word;
+	int i;
+
+	*mask = 0;
+	for (word = strtok(args, ", \t"); word; word = strtok(NULL, ", \t")) {
+		if (!strcmp(word, "all")) {
+			*mask = (1 << NR_IB_PLACES) - 1;
+			continue;
+		}
+		for (i = 0; i < NR_IB_PLACES; i++)
+			if (!strcmp(word, ib_place_names[i]))
+				break;
+		if (i == NR_IB_PLACES)
+			return -1;
+		*mask |= 1 << i;
+	}
+	return 0;
+}
+
+static void parse_config(const char *path)
+{
+	char raw[4096], line[4096], bad[64], *p, *key, *args;
+	struct experiment *e = &g_defaults;
+	struct task *t;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(raw, sizeof(raw), fp)) {
+		lineno++;
+		if ((p = strchr(raw, '#')))
+			*p = '\0';
+		if (expand(raw, line, sizeof(line), bad) < 0) {
+			fprintf(stderr, "%s:%d: unset variable %s\n", path,
+				lineno, bad);
+			exit(1);
+		}
+		p = line + strlen(line);
+		while (p > line && strchr(" \t\r\n", p[-1]))
+			*--p = '\0';
+		key = line + strspn(line, " \t");
+		if (!*key)
+			continue;
+		args = key + strcspn(key, " \t");
+		if (*args)
+			*args++ = '\0';
+		args += strspn(args, " \t");
+
+		if (!strcmp(key, "set")) {
+			p = args + strcspn(args, " \t");
+			if (*p)
+				*p++ = '\0';
+			set_var(args, p + strspn(p, " \t"));
+		} else if (!strcmp(key, "output") && *args) {
+			g_output = strdup(args);
+		} else if (!strcmp(key, "cgroup_root") && *args) {
+			g_cgroup_root = strdup(args);
+		} else if (!strcmp(key, "timeout") && atoi(args) > 0) {
+			g_timeout = atoi(args);
+		} else if (!strcmp(key, "experiment") && *args) {
+			if (g_nr_exps == MAX_EXPERIMENTS)
+				fatal("more than %s experiments", "64");
+			e = malloc(sizeof(*e));
+			*e = g_defaults;
+			e->name = strdup(args);
+			g_exps[g_nr_exps++] = e;
+		} else if (!strcmp(key, "repetitions") && atoi(args) > 0) {
+			e->repetitions = atoi(args);
+		} else if (!strcmp(key, "max_repetitions") && atoi(args) > 0) {
+			e->max_repetitions = atoi(args);
+		} else if (!strcmp(key, "ci") && atof(args) >= 0) {
+			e->ci = atof(args);
+		} else if (!strcmp(key, "warmup") && atoi(args) >= 0) {
+			e->warmup = atoi(args);
+		} else if (!strcmp(key, "outliers") && atof(args) >= 0) {
+			e->outliers = atof(args);
+		} else if (!strcmp(key, "flush") && *args) {
+			e->flush = atoi(args);
+		} else if (!strcmp(key, "sweep") && *args) {
+			e->sweep = atoi(args);
+		} else if (!strcmp(key, "placement") && *args) {
+			if (parse_placements(args, &e->placements) < 0) {
+				fprintf(stderr, "%s:%d: bad placement class\n",
+					path, lineno);
+				exit(1);
+			}
+		} else if (!strcmp(key, "metric") && *args) {
+			p = args + strcspn(args, " \t");
+			if (*p)
+				*p++ = '\0';
+			e->metric = strdup(args);
+			e->higher = !strcmp(p + strspn(p, " \t"), "higher");
+		} else if ((!strcmp(key, "subject") || !strcmp(key, "corunner")) &&
+			   e != &g_defaults) {
+			t = parse_task(args);
+			if (!t) {
+				fprintf(stderr, "%s:%d: bad task\n", path, lineno);
+				exit(1);
+			}
+			if (key[0] == 's')
+				e->subject = t;
+			else if (e->nr_corunners == MAX_CORUNNERS)
+				fatal("more than %s co-runners", "64");
+			else
+				e->corunners[e->nr_corunners++] = t;
+		} else {
+			fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+			exit(1);
+		}
+	}
+	fclose(fp);
+
+	if (!g_nr_exps)
+		fatal("%s: no experiments", path);
+	for (lineno = 0; lineno < g_nr_exps; lineno++)
+		if (!g_exps[lineno]->subject)
+			fatal("experiment %s has no subject",
+			      g_exps[lineno]->name);
+}
+
+static char *cgroup_path(const char *cg, const char *file)
+{
+	static char path[4096];
+
+	if (cg[0] == '/')
+		snprintf(path, sizeof(path), "%s/%s", cg, file);
+	else
+		snprintf(path, sizeof(path), "%s/%s/%s", g_cgroup_root, cg,
+			 file);
+	return path;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	int fd, ret;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+/* palloc.bins of all cgroups of the experiment */
+static void set_bins(struct experiment *e)
+{
+	struct task *t;
+	int i;
+
+	for (i = -1; i < e->nr_corunners; i++) {
+		t = i < 0 ? e->subject : e->corunners[i];
+		if (!t->bins)
+			continue;
+		if (!t->cgroup)
+			fatal("bins=%s without a cgroup", t->bins);
+		if (write_file(cgroup_path(t->cgroup, "palloc.bins"),
+			       t->bins) < 0) {
+			perror(cgroup_path(t->cgroup, "palloc.bins"));
+			exit(1);
+		}
+	}
+}
+
+/* fork, pin, join the cgroup, exec. the child waits for start */
+static void task_start(struct task *t)
+{
+	char num[16];
+	cpu_set_t set;
+	int sv[2], fd;
+
+	t->len = t->nr_results = t->ready = 0;
+	t->status = -1;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	t->pid = fork();
+	if (t->pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (t->pid == 0) {
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		if (t->cpu >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(t->cpu, &set);
+			if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+				perror("sched_setaffinity");
+				_exit(127);
+			}
+		}
+		if (t->cgroup) {
+			snprintf(num, sizeof(num), "%d\n", getpid());
+			if (write_file(cgroup_path(t->cgroup, "cgroup.procs"),
+				       num) < 0) {
+				perror(cgroup_path(t->cgroup, "cgroup.procs"));
+				_exit(127);
+			}
+		}
+		if (t->sync) {
+			fd = dup(sv[1]);	/* without close-on-exec */
+			snprintf(num, sizeof(num), "%d", fd);
+			setenv(IB_ENV, num, 1);
+		} else {
+			unsetenv(IB_ENV);
+		}
+		if (!g_verbose) {
+			fd = open("/dev/null", O_WRONLY);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execvp(t->argv[0], t->argv);
+		perror(t->argv[0]);
+		_exit(127);
+	}
+	close(sv[1]);
+	t->fd = sv[0];
+	t->ready = !t->sync;
+}
+
+static void task_message(struct task *t, char *msg)
+{
+	struct result *r;
+	char key[32];
+	double value;
+
+	if (!strcmp(msg, "ready")) {
+		t->ready = 1;
+	} else if (sscanf(msg, "result %31s %lf", key, &value) == 2 &&
+		   t->nr_results < MAX_RESULTS) {
+		r = &t->results[t->nr_results++];
+		strcpy(r->key, key);
+		r->value = value;
+	}
+}
+
+/*
+ * read t's messages for up to timeout_ms. returns 1 when some came, 0 on
+ * timeout, -1 once the child closed its end
+ */
+static int task_read(struct task *t, int timeout_ms)
+{
+	struct pollfd pfd = { t->fd, POLLIN, 0 };
+	char *nl;
+	ssize_t n;
+
+	if (t->fd < 0)
+		return -1;
+	n = poll(&pfd, 1, timeout_ms);
+	if (n < 0 && errno == EINTR)
+		return 0;
+	if (n <= 0)
+		return 0;
+	n = read(t->fd, t->buf + t->len, sizeof(t->buf) - 1 - t->len);
+	if (n <= 0) {
+		close(t->fd);
+		t->fd = -1;
+		return -1;
+	}
+	t->len += n;
+	t->buf[t->len] = '\0';
+	while ((nl = strchr(t->buf, '\n'))) {
+		*nl = '\0';
+		task_message(t, t->buf);
+		t->len -= nl + 1 - t->buf;
+		memmove(t->buf, nl + 1, t->len + 1);
+	}
+	if (t->len == sizeof(t->buf) - 1)
+		t->len = 0;	/* an overlong line, drop it */
+	return 1;
+}
+
+static int task_wait_ready(struct task *t, int64_t deadline)
+{
+	while (!t->ready) {
+		if (now_ms() > deadline || task_read(t, 100) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void task_send_start(struct task *t)
+{
+	if (t->sync && write(t->fd, "start\n", 6) != 6)
+		perror(t->argv[0]);
+}
+
+/* read t's results until it exits, SIGKILL at deadline, and reap it */
+static void task_finish(struct task *t, int64_t deadline)
+{
+	int64_t left;
+
+	if (t->sync) {
+		while ((left = deadline - now_ms()) > 0 &&
+		       task_read(t, left > 100 ? 100 : left) >= 0)
+			;
+		if (t->fd >= 0) {
+			close(t->fd);
+			t->fd = -1;
+		}
+	} else {
+		close(t->fd);
+		t->fd = -1;
+		while (now_ms() < deadline && !waitpid(t->pid, &t->status, WNOHANG))
+			usleep(10000);
+		if (t->status != -1) {
+			t->pid = 0;
+			return;
+		}
+	}
+	if (now_ms() >= deadline)
+		kill(t->pid, SIGKILL);
+	waitpid(t->pid, &t->status, 0);
+	t->pid = 0;
+}
+
+static void kill_all(int sig)
+{
+	int i;
+
+	for (i = 0; i <= MAX_CORUNNERS; i++)
+		if (g_running[i] > 0)
+			kill(g_running[i], SIGKILL);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/**************************************************************************
+ * Results
+ **************************************************************************/
+static void json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(out, "\\u%04x", *s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void json_task(FILE *out, const struct task *t)
+{
+	fprintf(out, "{\"cmd\": ");
+	json_string(out, t->cmd);
+	fprintf(out, ", \"cpu\": %d", t->cpu);
+	if (t->cgroup) {
+		fprintf(out, ", \"cgroup\": ");
+		json_string(out, t->cgroup);
+	}
+	if (t->bins) {
+		fprintf(out, ", \"bins\": ");
+		json_string(out, t->bins);
+	}
+	fprintf(out, "}");
+}
+
+static void json_results(FILE *out, const struct task *t)
+{
+	int i;
+
+	fprintf(out, "{\"exit\": %d",
+		WIFEXITED(t->status) ? WEXITSTATUS(t->status) :
+		128 + WTERMSIG(t->status));
+	for (i = 0; i < t->nr_results; i++) {
+		fprintf(out, ", ");
+		json_string(out, t->results[i].key);
+		fprintf(out, ": %.10g", t->results[i].value);
+	}
+	fprintf(out, "}");
+}
+
+/**************************************************************************
+ * Experiments
+ **************************************************************************/
+
+/* evict what the previous run left in the caches, from the subject's CPU */
+static void flush_caches(const struct experiment *e)
+{
+	size_t size = FLUSH_SIZE;
+	cpu_set_t all, set;
+
+	if (g_topo && g_topo->llc)
+		size = 2 * g_topo->cache[g_topo->llc].size;
+	sched_getaffinity(0, sizeof(all), &all);
+	if (e->subject->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(e->subject->cpu, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+	if (ib_flush_caches(size) < 0)
+		perror("flush");
+	sched_setaffinity(0, sizeof(all), &all);
+}
+
+/*
+ * one run of the subject next to the first nr co-runners, place their
+ * placement class (NULL: as configured). rep < 0: a warmup run
+ */
+static int run_once(FILE *out, struct experiment *e, int nr, int rep,
+		    const char *place, int first)
+{
+	struct task *s = e->subject;
+	int64_t deadline = now_ms() + (int64_t)g_timeout * 1000;
+	double start, elapsed;
+	int i, failed = 0;
+
+	for (i = 0; i < nr; i++) {
+		task_start(e->corunners[i]);
+		g_running[i + 1] = e->corunners[i]->pid;
+	}
+	task_start(s);
+	g_running[0] = s->pid;
+
+	/* all set up before anyone starts */
+	for (i = 0; i < nr && !failed; i++)
+		if (task_wait_ready(e->corunners[i], deadline) < 0) {
+			fprintf(stderr, "isolbench: co-runner %s did not get "
+				"ready\n", e->corunners[i]->cmd);
+			failed = 1;
+		}
+	if (!failed && task_wait_ready(s, deadline) < 0) {
+		fprintf(stderr, "isolbench: subject %s did not get ready\n",
+			s->cmd);
+		failed = 1;
+	}
+	if (!failed) {
+		/* after the tasks' own setup, which warms the caches again */
+		if (e->flush)
+			flush_caches(e);
+		for (i = 0; i < nr; i++)
+			task_send_start(e->corunners[i]);
+		start = now_sec();
+		task_send_start(s);
+	}
+
+	task_finish(s, failed ? now_ms() : deadline);
+	elapsed = failed ? 0 : now_sec() - start;
+	g_running[0] = 0;
+	for (i = 0; i < nr; i++) {
+		kill(e->corunners[i]->pid, SIGINT);
+		task_finish(e->corunners[i], now_ms() + STOP_TIMEOUT_MS);
+		g_running[i + 1] = 0;
+	}
+	if (!WIFEXITED(s->status) || WEXITSTATUS(s->status))
+		failed = 1;
+
+	fprintf(out, "%s\n        {\"corunners\": %d, \"repetition\": %d, "
+		"\"elapsed_s\": %.6f,", first ? "" : ",", nr, rep, elapsed);
+	if (rep < 0)
+		fprintf(out, " \"warmup\": true,");
+	if (place) {
+		fprintf(out, " \"placement\": \"%s\", \"corunner_cpus\": [",
+			place);
+		for (i = 0; i < nr; i++)
+			fprintf(out, "%s%d", i ? ", " : "", e->corunners[i]->cpu);
+		fprintf(out, "],");
+	}
+	fprintf(out, "\n         \"subject\": ");
+	json_results(out, s);
+	fprintf(out, ",\n         \"corunner_results\": [");
+	for (i = 0; i < nr; i++) {
+		fprintf(out, "%s", i ? ", " : "");
+		json_results(out, e->corunners[i]);
+	}
+	fprintf(out, "]}");
+	fflush(out);
+
+	printf("%s: %d corunner(s)%s%s, %s %d:", e->name, nr,
+	       place ? " " : "", place ? place : "",
+	       rep < 0 ? "warmup" : "rep", rep < 0 ? rep + e->warmup : rep);
+	for (i = 0; i < s->nr_results; i++)
+		printf(" %s %.2f", s->results[i].key, s->results[i].value);
+	printf("%s\n", failed ? " FAILED" : "");
+	return failed ? -1 : 0;
+}
+
+/* index of key in st->keys, -1 if none */
+static int step_find(const struct step *st, const char *key)
+{
+	int k;
+
+	for (k = 0; k < st->nr_keys; k++)
+		if (!strcmp(st->keys[k], key))
+			return k;
+	return -1;
+}
+
+/* index of key in st->keys, added if new. -1 when full */
+static int step_key(struct step *st, const char *key)
+{
+	int k = step_find(st, key);
+
+	if (k >= 0)
+		return k;
+	k = st->nr_keys;
+	if (k == MAX_RESULTS)
+		return -1;
+	strcpy(st->keys[k], key);
+	st->nr_keys++;
+	return k;
+}
+
+/* statistics of e's metric in st. NULL if the subject did not report it */
+static const struct ib_stats *step_metric(const struct experiment *e,
+					  const struct step *st)
+{
+	int k = step_find(st, e->metric);
+
+	return k >= 0 && st->stats[k].n ? &st->stats[k] : NULL;
+}
+
+/*
+ * warmup, then repetitions runs, or with ci until the metric's confidence
+ * interval is narrow enough, and the statistics of the subject's results
+ */
+static int run_step(FILE *out, struct experiment *e, int nr, const char *place,
+		    int *runs, struct step **step)
+{
+	static double values[MAX_RESULTS][MAX_TRIALS], tmp[MAX_TRIALS];
+	int max = e->ci > 0 && e->max_repetitions > e->repetitions ?
+		e->max_repetitions : e->repetitions;
+	int count[MAX_RESULTS] = { 0 };
+	const struct ib_stats *ms;
+	struct ib_stats cur;
+	struct task *s = e->subject;
+	struct step *st;
+	int rep, i, k, failed = 0;
+
+	e->steps = realloc(e->steps, (e->nr_steps + 1) * sizeof(*e->steps));
+	if (!e->steps)
+		fatal("out of %s", "memory");
+	st = &e->steps[e->nr_steps++];
+	memset(st, 0, sizeof(*st));
+	st->corunners = nr;
+	st->place = place;
+	if (max > MAX_TRIALS)
+		max = MAX_TRIALS;
+
+	for (rep = -e->warmup; rep < max; rep++) {
+		if (run_once(out, e, nr, rep, place, !(*runs)++) < 0) {
+			failed = 1;
+			continue;
+		}
+		if (rep < 0)
+			continue;
+		st->trials++;
+		for (i = 0; i < s->nr_results; i++) {
+			k = step_key(st, s->results[i].key);
+			if (k >= 0)
+				values[k][count[k]++] = s->results[i].value;
+		}
+
+		/*
+		 * adaptive stopping, on all samples: trimming them would
+		 * narrow the interval it stops on
+		 */
+		k = step_find(st, e->metric);
+		if (e->ci <= 0 || rep + 1 < e->repetitions || k < 0)
+			continue;
+		memcpy(tmp, values[k], count[k] * sizeof(*tmp));
+		ib_stats_compute(tmp, count[k], 0, &cur);
+		if (cur.n >= 3 && cur.ci <= e->ci / 100 * fabs(cur.mean))
+			break;
+	}
+	for (k = 0; k < st->nr_keys; k++)
+		ib_stats_compute(values[k], count[k], e->outliers,
+				 &st->stats[k]);
+
+	printf("%s: %d corunner(s)%s%s, %d run(s):", e->name, nr,
+	       place ? " " : "", place ? place : "", st->trials);
+	ms = step_metric(e, st);
+	if (ms)
+		printf(" %s mean %.2f +- %.2f median %.2f stddev %.2f "
+		       "(%d outlier(s))\n", e->metric, ms->mean, ms->ci,
+		       ms->median, ms->stddev, ms->outliers);
+	else
+		printf(" no %s\n", e->metric);
+	if (step)
+		*step = st;
+	return failed ? -1 : 0;
+}
+
+/* the CPUs of class place next to subject, up to one per co-runner */
+static int place_cpus(const struct experiment *e, int subject, int place,
+		      int cpus[MAX_CORUNNERS])
+{
+	int c, n = 0;
+
+	for (c = 0; c < g_topo->nr_cpus && n < e->nr_corunners; c++)
+		if (g_topo->cpu[c].online && c != subject &&
+		    ib_topo_place(g_topo, subject, c) == place)
+			cpus[n++] = c;
+	return n;
+}
+
+/*
+ * alone, then next to co-runners on the CPUs of each placement class, as
+ * many in each as the smallest class with CPUs has. slowdown[] of each
+ * class: its mean metric at that many co-runners over the mean alone
+ * (inverted for higher-is-better metrics), 0 without runs
+ */
+static int run_placements(FILE *out, struct experiment *e,
+			  double slowdown[NR_IB_PLACES], int nr_cpus[NR_IB_PLACES])
+{
+	int saved[MAX_CORUNNERS], cpus[MAX_CORUNNERS];
+	int subject = e->subject->cpu, nr, i, n, place;
+	int failed = 0, runs = 0, common = MAX_CORUNNERS;
+	const struct ib_stats *ms;
+	struct step *st = NULL;
+	double solo = 0;
+
+	if (!g_topo)
+		fatal("experiment %s: placement without a topology", e->name);
+	if (subject < 0)
+		e->subject->cpu = subject = g_topo->subject;
+	for (i = 0; i < e->nr_corunners; i++)
+		saved[i] = e->corunners[i]->cpu;
+	for (place = 0; place < NR_IB_PLACES; place++)
+		if ((e->placements & (1 << place)) &&
+		    (n = place_cpus(e, subject, place, cpus)))
+			common = n < common ? n : common;
+
+	for (place = -1; place < NR_IB_PLACES; place++) {
+		/* place -1: alone */
+		n = 0;
+		if (place >= 0) {
+			n = place_cpus(e, subject, place, cpus);
+			n = n < common ? n : common;
+			slowdown[place] = 0;
+			nr_cpus[place] = n;
+			if (!(e->placements & (1 << place)))
+				continue;
+			if (!n) {
+				printf("%s: no %s CPUs next to CPU %d\n", e->name,
+				       ib_place_names[place], subject);
+				continue;
+			}
+		}
+		for (i = 0; i < n; i++)
+			e->corunners[i]->cpu = cpus[i];
+
+		for (nr = e->sweep && n ? 1 : n; nr <= n; nr++)
+			if (run_step(out, e, nr, place < 0 ? "alone" :
+				     ib_place_names[place], &runs, &st) < 0)
+				failed = 1;
+		/*
+		 * st points into e->steps, which moves as it grows: use it
+		 * only before the next run_step()
+		 */
+		ms = st ? step_metric(e, st) : NULL;
+		if (place < 0)
+			solo = ms ? ms->mean : 0;
+		else if (ms && solo && ms->mean)
+			slowdown[place] = e->higher ? solo / ms->mean :
+				ms->mean / solo;
+	}
+
+	for (i = 0; i < e->nr_corunners; i++)
+		e->corunners[i]->cpu = saved[i];
+	return failed ? -1 : 0;
+}
+
+static void json_steps(FILE *out, const struct experiment *e)
+{
+	const struct step *st;
+	const struct ib_stats *m;
+	int i, k;
+
+	fprintf(out, ",\n     \"steps\": [");
+	for (i = 0; i < e->nr_steps; i++) {
+		st = &e->steps[i];
+		fprintf(out, "%s\n        {\"corunners\": %d, ", i ? "," : "",
+			st->corunners);
+		if (st->place)
+			fprintf(out, "\"placement\": \"%s\", ", st->place);
+		fprintf(out, "\"runs\": %d, \"stats\": {", st->trials);
+		for (k = 0; k < st->nr_keys; k++) {
+			m = &st->stats[k];
+			fprintf(out, "%s\n          ", k ? "," : "");
+			json_string(out, st->keys[k]);
+			fprintf(out, ": {\"n\": %d, \"outliers\": %d, "
+				"\"mean\": %.10g, \"median\": %.10g, "
+				"\"stddev\": %.10g, \"ci95\": %.10g, "
+				"\"min\": %.10g, \"max\": %.10g}", m->n,
+				m->outliers, m->mean, m->median, m->stddev,
+				m->ci, m->min, m->max);
+		}
+		fprintf(out, "}}");
+	}
+	fprintf(out, "]");
+}
+
+static int run_experiment(FILE *out, struct experiment *e, int first)
+{
+	double slowdown[NR_IB_PLACES];
+	int nr_cpus[NR_IB_PLACES];
+	int nr, i, failed = 0, runs = 0;
+
+	set_bins(e);
+	fprintf(out, "%s\n    {\"name\": ", first ? "" : ",");
+	json_string(out, e->name);
+	fprintf(out, ", \"repetitions\": %d, \"max_repetitions\": %d, "
+		"\"ci\": %g, \"warmup\": %d, \"outliers\": %g, \"flush\": %d, "
+		"\"sweep\": %d,\n     \"metric\": ", e->repetitions,
+		e->max_repetitions, e->ci, e->warmup, e->outliers, e->flush,
+		e->sweep);
+	json_string(out, e->metric);
+	fprintf(out, ", \"subject\": ");
+	json_task(out, e->subject);
+	fprintf(out, ",\n     \"corunners\": [");
+	for (i = 0; i < e->nr_corunners; i++) {
+		fprintf(out, "%s\n       ", i ? "," : "");
+		json_task(out, e->corunners[i]);
+	}
+	fprintf(out, "],\n     \"runs\": [");
+
+	if (e->placements) {
+		failed = run_placements(out, e, slowdown, nr_cpus);
+	} else {
+		for (nr = e->sweep ? 0 : e->nr_corunners;
+		     nr <= e->nr_corunners; nr++)
+			if (run_step(out, e, nr, NULL, &runs, NULL) < 0)
+				failed = 1;
+	}
+	fprintf(out, "]");
+	json_steps(out, e);
+
+	if (e->placements) {
+		fprintf(out, ",\n     \"subject_cpu\": %d, \"slowdown\": {",
+			e->subject->cpu);
+		printf("%s: slowdown of %s next to CPU %d\n", e->name,
+		       e->metric, e->subject->cpu);
+		for (i = 0, runs = 0; i < NR_IB_PLACES; i++) {
+			if (!(e->placements & (1 << i)))
+				continue;
+			fprintf(out, "%s\"%s\": ", runs++ ? ", " : "",
+				ib_place_names[i]);
+			if (slowdown[i])
+				fprintf(out, "{\"corunners\": %d, \"slowdown\": "
+					"%.4f}", nr_cpus[i], slowdown[i]);
+			else
+				fprintf(out, "null");
+			printf("  %-12s %2d corunner(s)  ", ib_place_names[i],
+			       nr_cpus[i]);
+			if (slowdown[i])
+				printf("%.3f\n", slowdown[i]);
+			else
+				printf("-\n");
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "}");
+	return failed ? -1 : 0;
+}
+
+static void default_var(const char *name, int value)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%d", value);
+	if (!get_var(name))
+		set_var(name, buf);
+}
+
+/* defaults of the variables the topology profile derives */
+static void set_topology_vars(void)
+{
+	struct ib_topology *topo = malloc(sizeof(*topo));
+	char name[32];
+	int i;
+
+	if (!topo || ib_topology(topo, -1) < 0) {
+		free(topo);
+		return;
+	}
+	g_topo = topo;
+	if (topo->llc_ws) {
+		default_var("llc_ws", topo->llc_ws);
+		default_var("dram_ws", topo->dram_ws);
+	}
+	default_var("subject_cpu", topo->subject);
+	for (i = 0; i < IB_CORUNNERS; i++) {
+		snprintf(name, sizeof(name), "corunner_cpu%d", i + 1);
+		default_var(name, topo->corunners[i]);
+	}
+}
+
+/* programs next to isolbench come first in PATH, as ../bench in the scripts */
+static void set_path(void)
+{
+	char exe[4096], path[8192];
+	const char *old = getenv("PATH");
+	ssize_t n;
+
+	n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (n <= 0)
+		return;
+	exe[n] = '\0';
+	snprintf(path, sizeof(path), "%s:%s", dirname(exe),
+		 old ? old : "/usr/bin:/bin");
+	setenv("PATH", path, 1);
+}
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: $ %s [<option>]* <config>\n\n", argv[0]);
+	printf("-o <file> : results file, overrides the config's output\n");
+	printf("-D <name>=<value> : set a config variable\n");
+	printf("-v : show the programs' output\n");
+	printf("-h : help\n");
+	printf("\nExamples: \n$ isolbench -D llc_ws=1024 ../scripts/isolbench.conf\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *output = NULL, *value, host[256];
+	time_t now = time(NULL);
+	int opt, i, failed = 0;
+	FILE *out;
+
+	while ((opt = getopt(argc, argv, "o:D:vh")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'D':
+			value = strchr(optarg, '=');
+			if (!value)
+				usage(argc, argv);
+			*value++ = '\0';
+			set_var(optarg, value);
+			break;
+		case 'v':
+			g_verbose = 1;
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argc, argv);
+
+	set_topology_vars();
+	parse_config(argv[optind]);
+	if (output)
+		g_output = output;
+	set_path();
+	signal(SIGINT, kill_all);
+	signal(SIGTERM, kill_all);
+	signal(SIGPIPE, SIG_IGN);
+
+	out = fopen(g_output, "w");
+	if (!out) {
+		perror(g_output);
+		exit(1);
+	}
+	if (gethostname(host, sizeof(host)) < 0)
+		strcpy(host, "unknown");
+	fprintf(out, "{\"host\": ");
+	json_string(out, host);
+	fprintf(out, ", \"time\": %ld, \"config\": ", (long)now);
+	json_string(out, argv[optind]);
+	fprintf(out, ",\n  \"experiments\": [");
+	for (i = 0; i < g_nr_exps; i++)
+		if (run_experiment(out, g_exps[i], i == 0) < 0)
+			failed = 1;
+	fprintf(out, "]}\n");
+	fclose(out);
+	printf("results: %s\n", g_output);
+	return failed;
+}
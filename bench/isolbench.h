@@ -0,0 +1,296 @@
+#ifndef __ISOLBENCH_H
+#define __ISOLBENCH_H
+
+/*
+ * libisolbench: the pieces the benchmarks share, and an API to run them
+ * inside other programs.
+ *
+ * Memory (huge pages with fallback), CPU pinning, scheduling priority,
+ * physical addresses from /proc/self/pagemap, color maps (colormap.h),
+ * timing, and the memory kernels: strided reads and writes (bandwidth),
+ * and pointer chasing over one or more chains (latency, pll).
+ *
+ * A service can measure interference in situ: an ib_hog is a thread
+ * streaming through its own buffer, as bandwidth does, and an ib_probe a
+ * chase buffer that returns the average access latency of a short run, as
+ * latency does.
+ *
+ *	struct ib_probe *probe = ib_probe_create(96 << 10, 0);
+ *	struct ib_hog *hog = ib_hog_start(16 << 20, IB_WRITE, 1, 0);
+ *	double ns = ib_probe_run(probe, 1000000);	(latency next to the hog)
+ *	ib_hog_stop(hog, &st);
+ *
+ * ib_stats_compute() summarizes repeated measurements (mean, median,
+ * stddev, 95% confidence interval, outliers rejected by the median
+ * absolute deviation), and ib_flush_caches() evicts the caches between
+ * them.
+ *
+ * ib_counters are hardware performance counters (perf_event_open) of the
+ * calling thread, started and stopped around a timed region. Events the
+ * PMU does not have (in VMs, say) are left out with a warning, and all
+ * ib_counters_*() calls take NULL, so a benchmark calls them whether or
+ * not counters were asked for.
+ *
+ * ib_topology() describes the machine from sysfs (caches, cores, clusters,
+ * packages, NUMA nodes) and CPUID / MIDR, and derives what the scripts
+ * used to look up per CPU part: working sets that fit the LLC or go to
+ * DRAM, LLC set-index color bits and co-runner CPUs. The topology program prints it.
+ *
+ * All functions return -1 or NULL with errno set on failure.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "colormap.h"
+#include "ibsync.h"
+
+#define IB_LINE_SIZE	64
+#define IB_MAX_CHAINS	64	/* ib_chase() memory-level parallelism */
+
+/* ib_alloc() flags */
+#define IB_MEM_HUGE	1	/* 1GB, then 2MB huge pages, then small pages */
+#define IB_MEM_STRICT	2	/* with IB_MEM_HUGE: no small page fallback */
+
+/* ib_counters_open() */
+#define IB_MAX_COUNTERS		16
+#define IB_COUNTERS_DEFAULT	"cycles,instructions,llc-refs,llc-misses,dtlb-misses,stalls"
+
+/* ib_topology() */
+#define IB_MAX_CPUS	512
+#define IB_MAX_LEVELS	4	/* cache levels */
+#define IB_CORUNNERS	3	/* default placement: subject + 3, as the scripts */
+
+enum ib_access { IB_READ, IB_WRITE };
+
+/* where a CPU is relative to the subject's, ib_topo_place() */
+enum ib_place {
+	IB_PLACE_SMT,		/* same core */
+	IB_PLACE_L2,		/* shares a cache level below the LLC */
+	IB_PLACE_LLC,		/* shares only the LLC */
+	IB_PLACE_OTHER_LLC,	/* same package and node, no shared cache */
+	IB_PLACE_OTHER_SOCKET,	/* other package or NUMA node */
+	NR_IB_PLACES
+};
+
+/* in enum ib_place order */
+static const char * const ib_place_names[NR_IB_PLACES] = {
+	"smt", "same-l2", "same-llc", "other-llc", "other-socket",
+};
+
+struct ib_hog_stats {
+	uint64_t	bytes;		/* read or written */
+	double		seconds;
+	double		mbs;		/* MB (2^20 bytes) per second */
+};
+
+struct ib_cache {
+	size_t		size;		/* bytes, 0: no such level */
+	int		ways;
+	int		line;
+	int		sets;
+};
+
+struct ib_cpu {
+	int		online;
+	int		package;
+	int		cluster;	/* -1: unknown */
+	int		core;		/* SMT siblings share it */
+	int		node;		/* NUMA node */
+	int		capacity;	/* cpu_capacity, big.LITTLE. 0: unknown */
+	int		cache[IB_MAX_LEVELS + 1];	/* per level, the first
+							   CPU sharing the data
+							   cache. -1: none */
+};
+
+struct ib_topology {
+	char		model[64];
+	char		id[32];		/* "x86 6/143", "midr 0x410fd083" */
+	int		nr_cpus;	/* highest possible CPU id + 1 */
+	int		nr_online;
+	int		nr_packages;
+	int		nr_nodes;
+	struct ib_cpu	cpu[IB_MAX_CPUS];
+
+	/* caches of the subject CPU, by level */
+	struct ib_cache	cache[IB_MAX_LEVELS + 1];
+	int		llc;		/* its level, 0: no cache info */
+
+	/* derived */
+	int		subject;
+	int		corunners[IB_CORUNNERS];
+	int		llc_ws;		/* KB, fits the subject's LLC share */
+	int		dram_ws;	/* KB, well beyond the LLC */
+	uint64_t	llc_set_mask;	/* PALLOC mask coloring LLC sets,
+					   0: unknown or not a power of 2 */
+	int		from_table;	/* working sets by CPU part, no sysfs
+					   cache info */
+};
+
+struct ib_stats {
+	int		n;		/* values kept */
+	int		outliers;	/* values rejected */
+	double		mean;
+	double		median;
+	double		stddev;
+	double		ci;		/* 95% confidence half-width of the mean */
+	double		min;
+	double		max;
+};
+
+struct ib_counters {
+	int		nr;				/* available events */
+	char		name[IB_MAX_COUNTERS][24];
+	uint64_t	value[IB_MAX_COUNTERS];		/* as of the last stop */
+	int		fd[IB_MAX_COUNTERS];
+	int		scaled;		/* multiplexed: values are estimates */
+};
+
+struct ib_hog;
+struct ib_probe;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline uint64_t ib_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * populated, zeroed, read-write mapping of size bytes. *page_size, if not
+ * NULL, gets the page size it is made of
+ */
+void *ib_alloc(size_t size, int flags, size_t *page_size);
+/* size rounded up to that page size: huge pages unmap whole only */
+void ib_free(void *ptr, size_t size);
+
+/* pin the calling thread to cpu, EINVAL beyond the configured CPUs */
+int ib_pin_cpu(int cpu);
+
+/* SCHED_FIFO priority (1-99) / nice value (-20..19) of the calling thread */
+int ib_set_rt_prio(int prio);
+int ib_set_nice(int nice);
+
+/*
+ * physical addresses of the n units, unit bytes apart, at buf. EPERM when
+ * the kernel hides frame numbers (not root), EFAULT when a page is not
+ * present
+ */
+int ib_virt_to_phys(const void *buf, int64_t n, size_t unit, uint64_t *paddr);
+
+/* the map file spec of colormap.h, or one function per bit of mask */
+int ib_colormap(struct colormap *cm, const char *spec, uint64_t mask);
+
+/*
+ * one int64_t every stride bytes of buf, from start to end (bytes, 8
+ * aligned): ib_read() returns their sum, ib_write() stores val
+ */
+int64_t ib_read(const void *buf, size_t start, size_t stride, size_t end);
+void ib_write(void *buf, size_t start, size_t stride, size_t end, int64_t val);
+
+/* random order of idx[0..n), the same for a seed */
+void ib_shuffle(int64_t *idx, int64_t n, uint64_t seed);
+
+/*
+ * link the units of buf (unit bytes, at least 16) given by idx[0..n) into
+ * nr_chains (up to IB_MAX_CHAINS) cyclic chains of n / nr_chains units, in
+ * idx order. heads[i] gets the first unit of chain i
+ */
+void ib_chase_link(void *buf, size_t unit, const int64_t *idx, int64_t n,
+		   int nr_chains, void **heads);
+
+/*
+ * follow the nr_chains chains, steps steps each, interleaved (memory-level
+ * parallelism nr_chains); ib_chase_write() also writes the word after each
+ * link. heads are left where the chains got to. Stops early once *stop is
+ * set (stop may be NULL). returns the number of accesses
+ */
+int64_t ib_chase(void **heads, int nr_chains, int64_t steps,
+		 const volatile int *stop);
+int64_t ib_chase_write(void **heads, int nr_chains, int64_t steps,
+		       const volatile int *stop);
+
+/* fewest values ib_stats_compute() rejects outliers from */
+#define IB_MIN_REJECT 8
+
+/*
+ * statistics of values[0..n) (sorted in place), without those more than
+ * reject scaled median absolute deviations (about standard deviations,
+ * at least 1% of the median) from the median. reject 0, or fewer than
+ * IB_MIN_REJECT values, keeps all
+ */
+void ib_stats_compute(double *values, int n, double reject,
+		      struct ib_stats *st);
+
+/* evict the caches of the calling CPU and the LLC: write size bytes */
+int ib_flush_caches(size_t size);
+
+/*
+ * counters of the calling thread for events, comma separated (NULL:
+ * IB_COUNTERS_DEFAULT): cycles, instructions, llc-refs, llc-misses,
+ * dtlb-misses, stalls (backend), stalls-frontend, branch-misses,
+ * task-clock, page-faults, or r<hex> for a raw PMU event. User space
+ * only. Stopped until ib_counters_start(). NULL with EINVAL on an unknown
+ * event name
+ */
+struct ib_counters *ib_counters_open(const char *events);
+void ib_counters_close(struct ib_counters *c);
+
+/*
+ * start / stop counting. value[] counts all started regions since the
+ * open or the last reset; stop updates it
+ */
+void ib_counters_start(struct ib_counters *c);
+void ib_counters_stop(struct ib_counters *c);
+void ib_counters_reset(struct ib_counters *c);
+
+/*
+ * one line, "name count ..." of value[] - since[] (since may be NULL),
+ * with the IPC and LLC miss ratio when they can be told
+ */
+void ib_counters_print(FILE *out, const char *prefix,
+		       const struct ib_counters *c, const uint64_t *since);
+
+/* ib_result() of every event */
+void ib_counters_result(const struct ib_counters *c);
+
+/* a thread streaming through size bytes on cpu (-1: unpinned) */
+struct ib_hog *ib_hog_start(size_t size, enum ib_access access, int cpu,
+			    int flags);
+void ib_hog_stop(struct ib_hog *hog, struct ib_hog_stats *st);
+
+/* a chase buffer of size bytes, lines in random order */
+struct ib_probe *ib_probe_create(size_t size, int flags);
+/* average latency (ns) of accesses dependent loads, on the calling thread */
+double ib_probe_run(struct ib_probe *probe, int64_t accesses);
+void ib_probe_destroy(struct ib_probe *probe);
+
+/*
+ * probe the machine, with the subject on cpu (-1: the first online CPU).
+ * llc_ws and dram_ws are 0 when neither sysfs nor the CPU part tell the
+ * cache sizes
+ */
+int ib_topology(struct ib_topology *topo, int cpu);
+
+/* lowest cache level CPUs a and b share, 0: none */
+int ib_topo_shared(const struct ib_topology *topo, int a, int b);
+
+/*
+ * placement class of cpu next to subject. Without cache info, CPUs of the
+ * subject's cluster count as same-llc
+ */
+enum ib_place ib_topo_place(const struct ib_topology *topo, int subject,
+			    int cpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ISOLBENCH_H */
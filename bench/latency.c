@@ -27,7 +27,8 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
-#include "list.h"
+#include <getopt.h>
+#include "isolbench.h"
 
 /**************************************************************************
  * Public Definitions
@@ -43,11 +44,6 @@
 /**************************************************************************
  * Public Types
  **************************************************************************/
-struct item {
-	int data;
-	int in_use;
-	struct list_head list;
-} __attribute__((aligned(CACHE_LINE_SIZE)));;
 
 /**************************************************************************
  * Global Variables
@@ -61,15 +57,6 @@ int g_mem_size = DEFAULT_ALLOC_SIZE_KB*1024;
 /**************************************************************************
  * Implementation
  **************************************************************************/
-uint64_t get_elapsed(struct timespec *start, struct timespec *end)
-{
-	uint64_t dur;
-
-	dur = ((uint64_t)end->tv_sec * 1000000000 + end->tv_nsec) - 
-		((uint64_t)start->tv_sec * 1000000000 + start->tv_nsec);
-	return dur;
-}
-
 void usage(int argc, char *argv[])
 {
 	printf("Usage: $ %s [<option>]*\n\n", argv[0]);
@@ -78,32 +65,39 @@ void usage(int argc, char *argv[])
 	printf("-c: CPU to run.\n");
 	printf("-i: iterations. default=%d\n", DEFAULT_ITER);
 	printf("-p: priority\n");
+	printf("--counters[=<event>,...]: hardware counters of the timed chase. default=%s\n", IB_COUNTERS_DEFAULT);
 	printf("-h: help\n");
 	exit(1);
 }
 
 int main(int argc, char* argv[])
 {
-	struct item *list;
+	char *mem;
+	int64_t *perm;
 	int workingset_size = 1024;
-	int i, j;
-	struct list_head head;
-	struct list_head *pos;
-	struct timespec start, end;
-	uint64_t nsdiff;
+	int i;
+	void *head;
+	uint64_t start, nsdiff;
 	double avglat;
-	uint64_t readsum = 0;
 	int serial = 0;
 	int repeat = DEFAULT_ITER;
 	int cpuid = 0;
-	struct sched_param param;
-        cpu_set_t cmask;
-	int num_processors;
 	int opt, prio;
+	int counters = 0;
+	char *events = NULL;
+	struct ib_counters *pmu = NULL;
+
+	static struct option long_options[] = {
+		{"counters", optional_argument, 0,  'C' },
+		{0,          0,                 0,  0 }
+	};
+	int option_index = 0;
+
 	/*
 	 * get command line options 
 	 */
-	while ((opt = getopt(argc, argv, "m:sc:i:p:hr:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "m:sc:i:p:hr:",
+				  long_options, &option_index)) != -1) {
 		switch (opt) {
 		case 'm': /* set memory size */
 			g_mem_size = 1024 * strtol(optarg, NULL, 0);
@@ -113,25 +107,19 @@ int main(int argc, char* argv[])
 			break;
 		case 'c': /* set CPU affinity */
 			cpuid = strtol(optarg, NULL, 0);
-			num_processors = sysconf(_SC_NPROCESSORS_CONF);
-			CPU_ZERO(&cmask);
-			CPU_SET(cpuid % num_processors, &cmask);
-			if (sched_setaffinity(0, num_processors, &cmask) < 0)
+			if (ib_pin_cpu(cpuid) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned to cpu %d\n", cpuid);
 			break;
 		case 'r':
-			prio = strtol(optarg, NULL, 0);
-			param.sched_priority = prio; /* 1(low)- 99(high) for SCHED_FIFO or SCHED_RR
-						        0 for SCHED_OTHER or SCHED_BATCH */
-			if(sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+			prio = strtol(optarg, NULL, 0); /* 1(low)- 99(high) */
+			if (ib_set_rt_prio(prio) < 0)
 				perror("sched_setscheduler failed");
-			}
 			break;
 		case 'p': /* set priority (nice value: -20..19) */
 			prio = strtol(optarg, NULL, 0);
-			if (setpriority(PRIO_PROCESS, 0, prio) < 0)
+			if (ib_set_nice(prio) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned priority %d\n", prio);
@@ -140,6 +128,10 @@ int main(int argc, char* argv[])
 			repeat = strtol(optarg, NULL, 0);
 			fprintf(stderr, "repeat=%d\n", repeat);
 			break;
+		case 'C': /* hardware counters */
+			counters = 1;
+			events = optarg;
+			break;
 		case 'h':
 			usage(argc, argv);
 			break;
@@ -147,58 +139,43 @@ int main(int argc, char* argv[])
 	}
 
 	workingset_size = g_mem_size / CACHE_LINE_SIZE;
-	srand(0);
-	INIT_LIST_HEAD(&head);
 
-	/* allocate */
-	list = (struct item *)malloc(sizeof(struct item) * workingset_size + CACHE_LINE_SIZE);
-	for (i = 0; i < workingset_size; i++) {
-		list[i].data = i;
-		list[i].in_use = 0;
-		INIT_LIST_HEAD(&list[i].list);
-		// printf("%d 0x%x\n", list[i].data, &list[i].data);
+	/* allocate: one chase link per cache line */
+	mem = ib_alloc((size_t)workingset_size * CACHE_LINE_SIZE, 0, NULL);
+	perm = malloc(workingset_size * sizeof(*perm));
+	if (!mem || !perm) {
+		perror("alloc failed");
+		exit(1);
 	}
 	printf("allocated: wokingsetsize=%d entries\n", workingset_size);
 
-	/* initialize */
-
-	int *perm = (int *)malloc(workingset_size * sizeof(int));
+	/* initialize: the lines in random order, or in address order */
 	for (i = 0; i < workingset_size; i++)
 		perm[i] = i;
-
-	if (!serial) {
-		for (i = 0; i < workingset_size; i++) {
-			int tmp = perm[i];
-			int next = rand() % workingset_size;
-			perm[i] = perm[next];
-			perm[next] = tmp;
-		}
-	}
-	for (i = 0; i < workingset_size; i++) {
-		list_add(&list[perm[i]].list, &head);
-		// printf("%d\n", perm[i]);
-	}
+	if (!serial)
+		ib_shuffle(perm, workingset_size, 0);
+	ib_chase_link(mem, CACHE_LINE_SIZE, perm, workingset_size, 1, &head);
 	fprintf(stderr, "initialized.\n");
+	if (counters && !(pmu = ib_counters_open(events)))
+		exit(1);
+	ib_ready();
 
 	/* actual access */
-	clock_gettime(CLOCK_REALTIME, &start);
-	for (j = 0; j < repeat; j++) {
-		pos = (&head)->next;
-		for (i = 0; i < workingset_size; i++) {
-			struct item *tmp = list_entry(pos, struct item, list);
-			readsum += tmp->data; // READ
-			pos = pos->next;
-			// printf("%d ", tmp->data, &tmp->data);
-		}
-	}
-	clock_gettime(CLOCK_REALTIME, &end);
+	start = ib_now_ns();
+	ib_counters_start(pmu);
+	ib_chase(&head, 1, (int64_t)workingset_size * repeat, NULL);
+	ib_counters_stop(pmu);
+	nsdiff = ib_now_ns() - start;
 
-	nsdiff = get_elapsed(&start, &end);
 	avglat = (double)nsdiff/workingset_size/repeat;
 	printf("duration %.0f us\naverage %.2f ns | ", (double)nsdiff/1000, avglat);
 	printf("bandwidth %.2f MB (%.2f MiB)/s\n",
 	       (double)64*1000/avglat, 
 	       (double)64*1000000000/avglat/1024/1024);
-	printf("readsum  %lld\n", (unsigned long long)readsum);
+	ib_result("duration_us", (double)nsdiff/1000);
+	ib_result("average_ns", avglat);
+	ib_result("bandwidth_mbs", (double)64*1000/avglat);
+	ib_counters_print(stdout, "counters: ", pmu, NULL);
+	ib_counters_result(pmu);
 	return 0;
 }
@@ -0,0 +1,1116 @@
+/**
+ * libisolbench: benchmark building blocks. See isolbench.h.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "isolbench.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define PAGEMAP_BATCH	4096		/* entries per pagemap read */
+#define PFN_MASK	((1ULL << 55) - 1)
+#define PAGE_PRESENT	(1ULL << 63)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+struct ib_hog {
+	pthread_t	thread;
+	void		*buf;
+	size_t		size;
+	size_t		map_size;	/* size in whole pages, for ib_free() */
+	enum ib_access	access;
+	int		cpu;
+	volatile int	stop;
+	int64_t		sum;		/* keeps the reads */
+	uint64_t	bytes;
+	uint64_t	start;
+	uint64_t	end;
+};
+
+struct ib_probe {
+	void		*buf;
+	size_t		size;
+	size_t		map_size;
+	void		*head;
+	int64_t		lines;
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static int g_pagemap_fd = -1;
+static pthread_mutex_t g_pagemap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static void *map(size_t size, int extra)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | extra, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+void *ib_alloc(size_t size, int flags, size_t *page_size)
+{
+	size_t psize = getpagesize();
+	void *p = NULL;
+
+	if (flags & IB_MEM_HUGE) {
+		psize = 1UL << 30;
+		p = map(size, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+		if (!p) {
+			psize = 2UL << 20;
+			p = map(size, MAP_HUGETLB);
+		}
+		if (!p && (flags & IB_MEM_STRICT))
+			return NULL;
+	}
+	if (!p) {
+		psize = getpagesize();
+		p = map(size, 0);
+		if (!p)
+			return NULL;
+	}
+	if (page_size)
+		*page_size = psize;
+	return p;
+}
+
+/* huge page mappings are unmapped in whole pages only */
+static size_t page_round(size_t size, size_t page_size)
+{
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+void ib_free(void *ptr, size_t size)
+{
+	if (ptr)
+		munmap(ptr, size);
+}
+
+int ib_pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= sysconf(_SC_NPROCESSORS_CONF)) {
+		errno = EINVAL;
+		return -1;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int ib_set_rt_prio(int prio)
+{
+	struct sched_param param = { .sched_priority = prio };
+
+	return sched_setscheduler(0, SCHED_FIFO, &param);
+}
+
+int ib_set_nice(int nice)
+{
+	return setpriority(PRIO_PROCESS, 0, nice);
+}
+
+int ib_virt_to_phys(const void *buf, int64_t n, size_t unit, uint64_t *paddr)
+{
+	uint64_t entries[PAGEMAP_BATCH], first = 0, value;
+	size_t psize = getpagesize();
+	uintptr_t va;
+	int64_t i;
+	ssize_t len = 0, got;
+	int err = 0;
+
+	pthread_mutex_lock(&g_pagemap_lock);
+	if (g_pagemap_fd < 0)
+		g_pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+	if (g_pagemap_fd < 0)
+		err = errno;
+
+	for (i = 0; i < n && !err; i++) {
+		va = (uintptr_t)buf + i * unit;
+		if (!len || va / psize < first ||
+		    va / psize >= first + len / sizeof(uint64_t)) {
+			first = va / psize;
+			got = pread(g_pagemap_fd, entries, sizeof(entries),
+				    first * sizeof(uint64_t));
+			if (got < (ssize_t)sizeof(uint64_t)) {
+				err = got < 0 ? errno : EFAULT;
+				break;
+			}
+			len = got;
+		}
+		value = entries[va / psize - first];
+		if (!(value & PAGE_PRESENT))
+			err = EFAULT;
+		else if (!(value & PFN_MASK))
+			err = EPERM;
+		else
+			paddr[i] = (value & PFN_MASK) * psize + va % psize;
+	}
+	pthread_mutex_unlock(&g_pagemap_lock);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int ib_colormap(struct colormap *cm, const char *spec, uint64_t mask)
+{
+	if (spec)
+		return cmap_load(cm, spec);
+	cmap_from_mask(cm, mask);
+	return 0;
+}
+
+/**************************************************************************
+ * Kernels
+ **************************************************************************/
+int64_t ib_read(const void *buf, size_t start, size_t stride, size_t end)
+{
+	const char *p = buf;
+	int64_t sum = 0;
+	size_t i;
+
+	for (i = start; i < end; i += stride)
+		sum += *(const int64_t *)(p + i);
+	return sum;
+}
+
+void ib_write(void *buf, size_t start, size_t stride, size_t end, int64_t val)
+{
+	char *p = buf;
+	size_t i;
+
+	for (i = start; i < end; i += stride)
+		*(int64_t *)(p + i) = val;
+}
+
+void ib_shuffle(int64_t *idx, int64_t n, uint64_t seed)
+{
+	uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+	int64_t i, j, tmp;
+
+	for (i = n - 1; i > 0; i--) {
+		/* xorshift64* */
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		j = (x * 0x2545F4914F6CDD1DULL) % (i + 1);
+		tmp = idx[i];
+		idx[i] = idx[j];
+		idx[j] = tmp;
+	}
+}
+
+void ib_chase_link(void *buf, size_t unit, const int64_t *idx, int64_t n,
+		   int nr_chains, void **heads)
+{
+	char *base = buf;
+	int64_t len = n / nr_chains, i, next;
+	int c;
+
+	for (c = 0; c < nr_chains; c++) {
+		for (i = 0; i < len; i++) {
+			next = idx[c * len + (i + 1) % len];
+			*(void **)(base + idx[c * len + i] * unit) =
+				base + next * unit;
+		}
+		heads[c] = base + idx[c * len] * unit;
+	}
+}
+
+int64_t ib_chase(void **heads, int nr_chains, int64_t steps,
+		 const volatile int *stop)
+{
+	void *p[IB_MAX_CHAINS], *one = heads[0];
+	int64_t i;
+	int c;
+
+	if (nr_chains == 1) {
+		/* in a register: nothing but the loads on the dependency chain */
+		for (i = 0; i < steps && !(stop && *stop); i++)
+			one = *(void **)one;
+		heads[0] = one;
+		return i;
+	}
+
+	memcpy(p, heads, nr_chains * sizeof(*p));
+	for (i = 0; i < steps && !(stop && *stop); i++)
+		for (c = 0; c < nr_chains; c++)
+			p[c] = *(void **)p[c];
+	memcpy(heads, p, nr_chains * sizeof(*p));
+	return i * nr_chains;
+}
+
+int64_t ib_chase_write(void **heads, int nr_chains, int64_t steps,
+		       const volatile int *stop)
+{
+	void *p[IB_MAX_CHAINS];
+	int64_t i;
+	int c;
+
+	memcpy(p, heads, nr_chains * sizeof(*p));
+	for (i = 0; i < steps && !(stop && *stop); i++)
+		for (c = 0; c < nr_chains; c++) {
+			((int64_t *)p[c])[1] = 0xff;
+			p[c] = *(void **)p[c];
+		}
+	memcpy(heads, p, nr_chains * sizeof(*p));
+	return i * nr_chains;
+}
+
+/**************************************************************************
+ * Statistics
+ **************************************************************************/
+
+/* two-sided 95% Student t quantiles by degrees of freedom, 1..30 */
+static const double t95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+/* beyond 30, the next lower tabulated df: wider, never too narrow */
+static double t_quantile(int df)
+{
+	if (df <= 30)
+		return t95[df - 1];
+	if (df < 40)
+		return t95[29];
+	if (df < 60)
+		return 2.021;
+	if (df < 120)
+		return 2.000;
+	return 1.980;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double median(const double *sorted, int n)
+{
+	return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+void ib_stats_compute(double *values, int n, double reject,
+		      struct ib_stats *st)
+{
+	double dev[n ? n : 1], med, mad, sum = 0, sq = 0;
+	int i, lo = 0, hi = n;
+
+	memset(st, 0, sizeof(*st));
+	if (!n)
+		return;
+	qsort(values, n, sizeof(*values), cmp_double);
+	med = median(values, n);
+
+	/*
+	 * 1.4826 MAD estimates the standard deviation of normal data. Few
+	 * values give a MAD near 0, that would reject good ones: none below
+	 * IB_MIN_REJECT values, and at least 1% of the median
+	 */
+	if (reject > 0 && n >= IB_MIN_REJECT) {
+		for (i = 0; i < n; i++)
+			dev[i] = fabs(values[i] - med);
+		qsort(dev, n, sizeof(*dev), cmp_double);
+		mad = 1.4826 * median(dev, n);
+		if (mad < 0.01 * fabs(med))
+			mad = 0.01 * fabs(med);
+		while (lo < hi && mad > 0 && med - values[lo] > reject * mad)
+			lo++;
+		while (hi > lo && mad > 0 && values[hi - 1] - med > reject * mad)
+			hi--;
+	}
+
+	st->n = hi - lo;
+	st->outliers = n - st->n;
+	st->min = values[lo];
+	st->max = values[hi - 1];
+	st->median = median(values + lo, st->n);
+	for (i = lo; i < hi; i++)
+		sum += values[i];
+	st->mean = sum / st->n;
+	for (i = lo; i < hi; i++)
+		sq += (values[i] - st->mean) * (values[i] - st->mean);
+	if (st->n > 1) {
+		st->stddev = sqrt(sq / (st->n - 1));
+		st->ci = t_quantile(st->n - 1) * st->stddev / sqrt(st->n);
+	}
+}
+
+int ib_flush_caches(size_t size)
+{
+	static void *buf;
+	static size_t buf_size;
+
+	if (size > buf_size) {
+		ib_free(buf, buf_size);
+		buf_size = 0;
+		buf = ib_alloc(size, 0, NULL);
+		if (!buf)
+			return -1;
+		buf_size = size;
+	}
+	/* a different value every time: the lines are dirtied for sure */
+	ib_write(buf, 0, IB_LINE_SIZE, size, ib_now_ns());
+	return 0;
+}
+
+/**************************************************************************
+ * Performance counters
+ **************************************************************************/
+#define HW_CACHE(cache, op, result) \
+	((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+	const char	*name;
+	uint32_t	type;
+	uint64_t	config;
+} events[] = {
+	{ "cycles",		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions",	PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "llc-refs",		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+	{ "llc-misses",		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "dtlb-misses",	PERF_TYPE_HW_CACHE,
+	  HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+		   PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	{ "stalls",		PERF_TYPE_HARDWARE,
+	  PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+	{ "stalls-frontend",	PERF_TYPE_HARDWARE,
+	  PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+	{ "branch-misses",	PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "task-clock",		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "page-faults",	PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+	return syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+/* an event name to its type and config. -1 if unknown */
+static int parse_event(const char *name, uint32_t *type, uint64_t *config)
+{
+	char *end;
+	int i;
+
+	if (name[0] == 'r' && name[1]) {
+		*type = PERF_TYPE_RAW;
+		*config = strtoull(name + 1, &end, 16);
+		return *end ? -1 : 0;
+	}
+	for (i = 0; i < (int)(sizeof(events) / sizeof(events[0])); i++)
+		if (!strcmp(name, events[i].name)) {
+			*type = events[i].type;
+			*config = events[i].config;
+			return 0;
+		}
+	return -1;
+}
+
+struct ib_counters *ib_counters_open(const char *spec)
+{
+	struct perf_event_attr attr;
+	struct ib_counters *c;
+	char buf[256], *name, *save;
+	uint32_t type;
+	uint64_t config;
+	int fd;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	snprintf(buf, sizeof(buf), "%s", spec && *spec ? spec :
+		 IB_COUNTERS_DEFAULT);
+	for (name = strtok_r(buf, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		if (parse_event(name, &type, &config) < 0) {
+			fprintf(stderr, "counters: unknown event %s\n", name);
+			free(c);
+			errno = EINVAL;
+			return NULL;
+		}
+		if (c->nr == IB_MAX_COUNTERS)
+			break;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd = perf_event_open(&attr);
+		if (fd < 0) {
+			/* no such PMU event here (VMs), or not permitted */
+			fprintf(stderr, "counters: %s not available: %s\n",
+				name, strerror(errno));
+			continue;
+		}
+		snprintf(c->name[c->nr], sizeof(c->name[0]), "%s", name);
+		c->fd[c->nr++] = fd;
+	}
+	if (!c->nr)
+		fprintf(stderr, "counters: none available\n");
+	return c;
+}
+
+void ib_counters_close(struct ib_counters *c)
+{
+	int i;
+
+	if (!c)
+		return;
+	for (i = 0; i < c->nr; i++)
+		close(c->fd[i]);
+	free(c);
+}
+
+void ib_counters_start(struct ib_counters *c)
+{
+	int i;
+
+	for (i = 0; c && i < c->nr; i++)
+		ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void ib_counters_stop(struct ib_counters *c)
+{
+	uint64_t v[3];		/* value, time enabled, time running */
+	int i;
+
+	for (i = 0; c && i < c->nr; i++)
+		ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	for (i = 0; c && i < c->nr; i++) {
+		if (read(c->fd[i], v, sizeof(v)) != sizeof(v))
+			continue;
+		if (v[2] && v[2] < v[1]) {
+			/* shared the PMU with other events part of the time */
+			v[0] = (double)v[0] * v[1] / v[2];
+			c->scaled = 1;
+		}
+		c->value[i] = v[0];
+	}
+}
+
+void ib_counters_reset(struct ib_counters *c)
+{
+	int i;
+
+	for (i = 0; c && i < c->nr; i++) {
+		ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+		c->value[i] = 0;
+	}
+	if (c)
+		c->scaled = 0;
+}
+
+/* index of an event in c, -1 if not counted */
+static int counter(const struct ib_counters *c, const char *name)
+{
+	int i;
+
+	for (i = 0; i < c->nr; i++)
+		if (!strcmp(c->name[i], name))
+			return i;
+	return -1;
+}
+
+void ib_counters_print(FILE *out, const char *prefix,
+		       const struct ib_counters *c, const uint64_t *since)
+{
+	uint64_t v[IB_MAX_COUNTERS];
+	int i, a, b;
+
+	if (!c || !c->nr)
+		return;
+	fprintf(out, "%s", prefix);
+	for (i = 0; i < c->nr; i++) {
+		v[i] = c->value[i] - (since ? since[i] : 0);
+		fprintf(out, "%s%s %" PRIu64, i ? " " : "", c->name[i], v[i]);
+	}
+	a = counter(c, "instructions");
+	b = counter(c, "cycles");
+	if (a >= 0 && b >= 0 && v[b])
+		fprintf(out, " | ipc %.2f", (double)v[a] / v[b]);
+	a = counter(c, "llc-misses");
+	b = counter(c, "llc-refs");
+	if (a >= 0 && b >= 0 && v[b])
+		fprintf(out, " | llc miss ratio %.2f", (double)v[a] / v[b]);
+	fprintf(out, "%s\n", c->scaled ? " (multiplexed, scaled)" : "");
+}
+
+void ib_counters_result(const struct ib_counters *c)
+{
+	int i;
+
+	for (i = 0; c && i < c->nr; i++)
+		ib_result(c->name[i], c->value[i]);
+}
+
+/**************************************************************************
+ * Interference generators and probes
+ **************************************************************************/
+static void *hog_thread(void *arg)
+{
+	struct ib_hog *hog = arg;
+
+	if (hog->cpu >= 0)
+		ib_pin_cpu(hog->cpu);
+	hog->start = ib_now_ns();
+	while (!hog->stop) {
+		if (hog->access == IB_READ)
+			hog->sum += ib_read(hog->buf, 0, IB_LINE_SIZE, hog->size);
+		else
+			ib_write(hog->buf, 0, IB_LINE_SIZE, hog->size, 0xff);
+		hog->bytes += hog->size;
+	}
+	hog->end = ib_now_ns();
+	return NULL;
+}
+
+struct ib_hog *ib_hog_start(size_t size, enum ib_access access, int cpu,
+			    int flags)
+{
+	struct ib_hog *hog = calloc(1, sizeof(*hog));
+	size_t page_size;
+	int err;
+
+	if (!hog)
+		return NULL;
+	hog->buf = ib_alloc(size, flags, &page_size);
+	if (!hog->buf) {
+		free(hog);
+		return NULL;
+	}
+	hog->size = size;
+	hog->map_size = page_round(size, page_size);
+	hog->access = access;
+	hog->cpu = cpu;
+	err = pthread_create(&hog->thread, NULL, hog_thread, hog);
+	if (err) {
+		ib_free(hog->buf, hog->map_size);
+		free(hog);
+		errno = err;
+		return NULL;
+	}
+	return hog;
+}
+
+void ib_hog_stop(struct ib_hog *hog, struct ib_hog_stats *st)
+{
+	hog->stop = 1;
+	pthread_join(hog->thread, NULL);
+	if (st) {
+		st->bytes = hog->bytes;
+		st->seconds = (hog->end - hog->start) / 1e9;
+		st->mbs = st->seconds ? hog->bytes / st->seconds / (1 << 20) : 0;
+	}
+	ib_free(hog->buf, hog->map_size);
+	free(hog);
+}
+
+struct ib_probe *ib_probe_create(size_t size, int flags)
+{
+	struct ib_probe *probe = calloc(1, sizeof(*probe));
+	size_t page_size = 1;
+	int64_t *idx, i;
+
+	if (!probe)
+		return NULL;
+	probe->lines = size / IB_LINE_SIZE;
+	probe->size = size;
+	probe->buf = ib_alloc(size, flags, &page_size);
+	probe->map_size = page_round(size, page_size);
+	idx = malloc(probe->lines * sizeof(*idx));
+	if (!probe->buf || !idx || !probe->lines) {
+		ib_free(probe->buf, probe->map_size);
+		free(idx);
+		free(probe);
+		errno = size < IB_LINE_SIZE ? EINVAL : ENOMEM;
+		return NULL;
+	}
+	for (i = 0; i < probe->lines; i++)
+		idx[i] = i;
+	ib_shuffle(idx, probe->lines, 0);
+	ib_chase_link(probe->buf, IB_LINE_SIZE, idx, probe->lines, 1,
+		      &probe->head);
+	free(idx);
+	return probe;
+}
+
+double ib_probe_run(struct ib_probe *probe, int64_t accesses)
+{
+	uint64_t start = ib_now_ns();
+	int64_t n;
+
+	n = ib_chase(&probe->head, 1, accesses, NULL);
+	return n ? (double)(ib_now_ns() - start) / n : 0;
+}
+
+void ib_probe_destroy(struct ib_probe *probe)
+{
+	ib_free(probe->buf, probe->map_size);
+	free(probe);
+}
+
+/**************************************************************************
+ * Topology
+ **************************************************************************/
+#define SYS_CPU		"/sys/devices/system/cpu"
+#define SYS_NODE	"/sys/devices/system/node"
+#define PAGE_SHIFT	12
+
+/*
+ * working sets by CPU part, where sysfs has no cache info (older ARM
+ * kernels): the values test-isolbench.sh used to pick from /proc/cpuinfo
+ */
+static const struct {
+	int		part;		/* MIDR, ARM Ltd. */
+	const char	*name;
+	int		llc_ws;
+	int		dram_ws;
+} cpu_parts[] = {
+	{ 0xc05, "Cortex-A5",	48,	4096 },
+	{ 0xc07, "Cortex-A7",	48,	4096 },
+	{ 0xc09, "Cortex-A9",	96,	4096 },
+	{ 0xc0f, "Cortex-A15",	96,	4096 },
+	{ 0xd03, "Cortex-A53",	48,	4096 },
+	{ 0xd08, "Cortex-A72",	64,	4096 },
+	{ 0xd0b, "Cortex-A76",	768,	16384 },
+};
+
+/* first line of a sysfs file, without the newline. -1 if unreadable */
+static int read_line(const char *path, char *buf, int size)
+{
+	FILE *fp = fopen(path, "r");
+	char *nl;
+
+	if (!fp)
+		return -1;
+	if (!fgets(buf, size, fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	if ((nl = strchr(buf, '\n')))
+		*nl = '\0';
+	return 0;
+}
+
+/* an integer file, with an optional K/M suffix. def if unreadable */
+static long read_long(const char *path, long def)
+{
+	char buf[64], *end;
+	long val;
+
+	if (read_line(path, buf, sizeof(buf)) < 0)
+		return def;
+	val = strtol(buf, &end, 0);
+	if (end == buf)
+		return def;
+	if (*end == 'K')
+		val <<= 10;
+	else if (*end == 'M')
+		val <<= 20;
+	return val;
+}
+
+/* calls fn(cpu, arg) for each CPU of a cpulist ("0-3,8"). returns the count */
+static int for_each_cpu(const char *list, void (*fn)(int, void *), void *arg)
+{
+	const char *p = list;
+	int lo, hi, n = 0;
+	char *end;
+
+	while (*p) {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (; lo <= hi; lo++, n++)
+			if (fn && lo >= 0 && lo < IB_MAX_CPUS)
+				fn(lo, arg);
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+static void set_online(int cpu, void *arg)
+{
+	((struct ib_topology *)arg)->cpu[cpu].online = 1;
+}
+
+static int g_node;	/* of set_node() */
+
+static void set_node(int cpu, void *arg)
+{
+	((struct ib_topology *)arg)->cpu[cpu].node = g_node;
+}
+
+/* nr_cpus: ids run to the highest listed one, "0-3,8" is 9 */
+static void set_possible(int cpu, void *arg)
+{
+	struct ib_topology *topo = arg;
+
+	if (cpu >= topo->nr_cpus)
+		topo->nr_cpus = cpu + 1;
+}
+
+/* node ids can be sparse ("0,8"): read the CPUs of each listed one */
+static void probe_node(int node, void *arg)
+{
+	struct ib_topology *topo = arg;
+	char path[256], buf[4096];
+
+	g_node = node;
+	snprintf(path, sizeof(path), SYS_NODE "/node%d/cpulist", node);
+	if (read_line(path, buf, sizeof(buf)) == 0 &&
+	    for_each_cpu(buf, set_node, topo))
+		topo->nr_nodes++;
+}
+
+static int first_cpu(const char *list)
+{
+	return atoi(list);
+}
+
+static void probe_id(struct ib_topology *topo)
+{
+	char buf[256], *val;
+	unsigned long midr = 0;
+	int i, impl = -1, part = -1;
+	FILE *fp;
+
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int regs[12], eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		int family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf;
+
+		if (family == 0xf)
+			family += (eax >> 20) & 0xff;
+		if (family >= 6)
+			model |= ((eax >> 16) & 0xf) << 4;
+		snprintf(topo->id, sizeof(topo->id), "x86 %d/%d", family,
+			 model);
+	}
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) &&
+	    eax >= 0x80000004) {
+		for (i = 0; i < 3; i++)
+			__get_cpuid(0x80000002 + i, &regs[i * 4],
+				    &regs[i * 4 + 1], &regs[i * 4 + 2],
+				    &regs[i * 4 + 3]);
+		memcpy(buf, regs, sizeof(regs));
+		buf[sizeof(regs)] = '\0';
+		val = buf + strspn(buf, " ");
+		snprintf(topo->model, sizeof(topo->model), "%s", val);
+		return;
+	}
+#endif
+	/* ARM: MIDR from sysfs (arm64) or /proc/cpuinfo */
+	snprintf(buf, sizeof(buf),
+		 SYS_CPU "/cpu%d/regs/identification/midr_el1", topo->subject);
+	midr = read_long(buf, 0);
+	fp = fopen("/proc/cpuinfo", "r");
+	while (fp && fgets(buf, sizeof(buf), fp)) {
+		val = strchr(buf, ':');
+		if (!val)
+			continue;
+		val++;
+		if (!strncmp(buf, "CPU implementer", 15) && impl < 0)
+			impl = strtol(val, NULL, 0);
+		else if (!strncmp(buf, "CPU part", 8) && part < 0)
+			part = strtol(val, NULL, 0);
+		else if (!strncmp(buf, "model name", 10) && !topo->model[0])
+			snprintf(topo->model, sizeof(topo->model), "%s",
+				 val + strspn(val, " \t"));
+	}
+	if (fp)
+		fclose(fp);
+	if (midr) {
+		impl = (midr >> 24) & 0xff;
+		part = (midr >> 4) & 0xfff;
+	}
+	if (impl < 0 || part < 0)
+		return;
+	if (midr)
+		snprintf(topo->id, sizeof(topo->id), "midr 0x%08lx", midr);
+	else
+		snprintf(topo->id, sizeof(topo->id), "arm 0x%02x/0x%03x", impl,
+			 part);
+	for (i = 0; i < (int)(sizeof(cpu_parts) / sizeof(cpu_parts[0])); i++)
+		if (impl == 0x41 && part == cpu_parts[i].part) {
+			snprintf(topo->model, sizeof(topo->model), "%s",
+				 cpu_parts[i].name);
+			topo->llc_ws = cpu_parts[i].llc_ws;
+			topo->dram_ws = cpu_parts[i].dram_ws;
+		}
+}
+
+static void probe_cpu(struct ib_topology *topo, int cpu)
+{
+	struct ib_cpu *c = &topo->cpu[cpu];
+	char path[256], buf[256];
+	int idx, level;
+
+	for (level = 0; level <= IB_MAX_LEVELS; level++)
+		c->cache[level] = -1;
+	snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/", cpu);
+	strcpy(buf, path);
+	c->package = read_long(strcat(buf, "physical_package_id"), 0);
+	strcpy(buf, path);
+	c->cluster = read_long(strcat(buf, "cluster_id"), -1);
+	strcpy(buf, path);
+	c->core = read_long(strcat(buf, "core_id"), cpu);
+	snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cpu_capacity", cpu);
+	c->capacity = read_long(path, 0);
+
+	for (idx = 0; ; idx++) {
+		snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/level",
+			 cpu, idx);
+		level = read_long(path, -1);
+		if (level < 0)
+			break;
+		snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/type",
+			 cpu, idx);
+		if (level > IB_MAX_LEVELS ||
+		    read_line(path, buf, sizeof(buf)) < 0 ||
+		    !strcmp(buf, "Instruction"))
+			continue;
+		snprintf(path, sizeof(path),
+			 SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+		c->cache[level] = read_line(path, buf, sizeof(buf)) < 0 ?
+			cpu : first_cpu(buf);
+		if (cpu != topo->subject)
+			continue;
+
+		snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/",
+			 cpu, idx);
+		strcpy(buf, path);
+		topo->cache[level].size = read_long(strcat(buf, "size"), 0);
+		strcpy(buf, path);
+		topo->cache[level].ways =
+			read_long(strcat(buf, "ways_of_associativity"), 0);
+		strcpy(buf, path);
+		topo->cache[level].line =
+			read_long(strcat(buf, "coherency_line_size"), 64);
+		strcpy(buf, path);
+		topo->cache[level].sets =
+			read_long(strcat(buf, "number_of_sets"), 0);
+		if (!topo->cache[level].sets && topo->cache[level].ways)
+			topo->cache[level].sets = topo->cache[level].size /
+				topo->cache[level].ways / topo->cache[level].line;
+		if (topo->cache[level].size && level > topo->llc)
+			topo->llc = level;
+	}
+}
+
+static int same_core(const struct ib_topology *topo, int a, int b)
+{
+	return topo->cpu[a].package == topo->cpu[b].package &&
+		topo->cpu[a].core == topo->cpu[b].core;
+}
+
+int ib_topo_shared(const struct ib_topology *topo, int a, int b)
+{
+	int level;
+
+	for (level = 1; level <= IB_MAX_LEVELS; level++)
+		if (topo->cpu[a].cache[level] >= 0 &&
+		    topo->cpu[a].cache[level] == topo->cpu[b].cache[level])
+			return level;
+	return 0;
+}
+
+enum ib_place ib_topo_place(const struct ib_topology *topo, int subject,
+			    int cpu)
+{
+	const struct ib_cpu *s = &topo->cpu[subject], *c = &topo->cpu[cpu];
+	int level;
+
+	if (s->package != c->package || s->node != c->node)
+		return IB_PLACE_OTHER_SOCKET;
+	if (same_core(topo, subject, cpu))
+		return IB_PLACE_SMT;
+	if (!topo->llc)
+		return s->cluster >= 0 && s->cluster == c->cluster ?
+			IB_PLACE_LLC : IB_PLACE_OTHER_LLC;
+	level = ib_topo_shared(topo, subject, cpu);
+	if (!level)
+		return IB_PLACE_OTHER_LLC;
+	return level < topo->llc ? IB_PLACE_L2 : IB_PLACE_LLC;
+}
+
+/*
+ * llc_ws: half the subject core's share of the LLC, so it stays there next
+ * to co-runners, but at least twice the private level below it (so it is
+ * not served from there). dram_ws: four times the LLC
+ */
+static void derive_ws(struct ib_topology *topo)
+{
+	size_t llc = topo->cache[topo->llc].size, below = 0, ws;
+	int c, d, cores = 0;
+
+	for (c = 0; c < topo->nr_cpus; c++) {
+		if (!topo->cpu[c].online ||
+		    ib_topo_shared(topo, topo->subject, c) != topo->llc)
+			continue;
+		for (d = 0; d < c; d++)
+			if (topo->cpu[d].online && same_core(topo, c, d))
+				break;
+		cores += d == c;
+	}
+	if (topo->llc > 1)
+		below = topo->cache[topo->llc - 1].size;
+
+	ws = llc / (cores ? cores : 1) / 2;
+	if (ws <= below)
+		ws = 2 * below < llc / 2 ? 2 * below : llc / 2;
+	topo->llc_ws = ws >> 10;
+	topo->dram_ws = 4 * llc >> 10;
+	if (topo->dram_ws < 4096)
+		topo->dram_ws = 4096;
+}
+
+/*
+ * the two highest LLC set index bits above the page offset: four cache
+ * partitions, as set_pbpc uses. On LLCs with hashed slices this is the
+ * nominal set index of a slice. Set counts that are not a power of two
+ * (sliced LLCs reported whole) have no such bits
+ */
+static void derive_llc_set_mask(struct ib_topology *topo)
+{
+	const struct ib_cache *llc = &topo->cache[topo->llc];
+	int lo = 0, hi = 0;
+
+	if (!llc->sets || !llc->line || (llc->sets & (llc->sets - 1)) ||
+	    (llc->line & (llc->line - 1)))
+		return;
+	while ((1 << (lo + 1)) <= llc->line)
+		lo++;
+	while ((1L << (hi + 1)) <= llc->sets)
+		hi++;
+	hi += lo;		/* top index bit + 1 */
+	for (lo = hi - 2; lo < hi; lo++)
+		if (lo >= PAGE_SHIFT)
+			topo->llc_set_mask |= 1ULL << lo;
+}
+
+/*
+ * other cores sharing the subject's LLC first, then the rest, SMT siblings
+ * last; wrapping around on machines with fewer CPUs, as bandwidth -c does
+ */
+static void derive_corunners(struct ib_topology *topo)
+{
+	int order[IB_MAX_CPUS], n = 0, pass, c, i;
+
+	for (pass = 0; pass < 3; pass++)
+		for (c = 0; c < topo->nr_cpus; c++) {
+			if (!topo->cpu[c].online || c == topo->subject)
+				continue;
+			if (same_core(topo, c, topo->subject))
+				i = 2;
+			else if (topo->llc &&
+				 ib_topo_shared(topo, c, topo->subject) ==
+				 topo->llc)
+				i = 0;
+			else
+				i = 1;
+			if (i == pass)
+				order[n++] = c;
+		}
+	for (i = 0; i < IB_CORUNNERS; i++)
+		topo->corunners[i] = n ? order[i % n] : topo->subject;
+}
+
+int ib_topology(struct ib_topology *topo, int cpu)
+{
+	char buf[4096];
+	int c, d;
+
+	memset(topo, 0, sizeof(*topo));
+	if (read_line(SYS_CPU "/possible", buf, sizeof(buf)) < 0)
+		return -1;
+	for_each_cpu(buf, set_possible, topo);
+	if (read_line(SYS_CPU "/online", buf, sizeof(buf)) < 0)
+		return -1;
+	topo->nr_online = for_each_cpu(buf, set_online, topo);
+	topo->subject = cpu;
+	if (cpu < 0)
+		topo->subject = first_cpu(buf);
+	if (topo->subject >= topo->nr_cpus || !topo->cpu[topo->subject].online) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (c = 0; c < topo->nr_cpus; c++)
+		if (topo->cpu[c].online)
+			probe_cpu(topo, c);
+	for (c = 0; c < topo->nr_cpus; c++) {
+		for (d = 0; d < c; d++)
+			if (topo->cpu[d].online &&
+			    topo->cpu[d].package == topo->cpu[c].package)
+				break;
+		topo->nr_packages += topo->cpu[c].online && d == c;
+	}
+	if (read_line(SYS_NODE "/possible", buf, sizeof(buf)) == 0)
+		for_each_cpu(buf, probe_node, topo);
+	if (!topo->nr_nodes)
+		topo->nr_nodes = 1;	/* no NUMA support */
+
+	probe_id(topo);
+	if (topo->llc) {
+		topo->from_table = 0;
+		derive_ws(topo);
+		derive_llc_set_mask(topo);
+	} else {
+		topo->from_table = topo->llc_ws > 0;
+	}
+	derive_corunners(topo);
+	return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef __PAGETYPE_REC_H
+#define __PAGETYPE_REC_H
+
+/*
+ * pagetype binary output (pagetype -F bin) and a small reader for it.
+ * pll and bandwidth write their page traces (-T) in the same format, see
+ * pgtrace.h, and pgtrace analyzes any of them.
+ *
+ * The stream is one struct pgt_header followed by fixed-size records in
+ * output order: the -l/-L listing first, then the summary. Fields are in
+ * host byte order.
+ *
+ *	struct pgt_reader r;
+ *	struct pgt_record rec[1024];
+ *	int i, n;
+ *
+ *	if (pgt_open(&r, "pages.bin") < 0)
+ *		...
+ *	while ((n = pgt_read(&r, rec, 1024)) > 0)
+ *		for (i = 0; i < n; i++)
+ *			if (rec[i].kind == PGT_PAGE)
+ *				...
+ *	pgt_close(&r);
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define PGT_MAGIC	"pagetype"
+#define PGT_VERSION	1
+
+struct pgt_header {
+	char		magic[8];	/* PGT_MAGIC, not NUL terminated */
+	uint32_t	version;	/* PGT_VERSION */
+	uint32_t	record_size;	/* sizeof(struct pgt_record) */
+	uint32_t	page_size;
+	uint32_t	nr_colors;
+};
+
+enum pgt_kind {
+	PGT_PAGE,	/* -L: one page */
+	PGT_RANGE,	/* -l: count pages with the same flags */
+	PGT_FLAGS,	/* summary: count pages with these flags */
+	PGT_COLOR,	/* summary: count pages of this color */
+	PGT_TOTAL,	/* summary: count pages in all */
+	PGT_ACCESS,	/* trace: one sampled access, count is its sequence
+			   number and flags its byte offset in the page */
+	NR_PGT_KINDS
+};
+
+struct pgt_record {
+	uint32_t	kind;		/* enum pgt_kind */
+	int32_t		color;		/* first page's color, -1 if none */
+	uint64_t	vpn;		/* virtual page number with -p, else 0 */
+	uint64_t	pfn;
+	uint64_t	count;		/* base pages; a 2MB page is 512 */
+	uint64_t	flags;		/* kpageflags bits as pagetype reports them */
+};
+
+/* in enum pgt_kind order; no designated initializers, C++ includes this */
+static const char * const pgt_kind_names[NR_PGT_KINDS] = {
+	"page", "range", "flags", "color", "total", "access",
+};
+
+struct pgt_reader {
+	FILE			*file;
+	struct pgt_header	hdr;
+};
+
+/* open a pagetype -F bin stream, "-" for stdin. returns 0 or -1/errno */
+static inline int pgt_open(struct pgt_reader *r, const char *path)
+{
+	r->file = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+	if (!r->file)
+		return -1;
+
+	if (fread(&r->hdr, sizeof(r->hdr), 1, r->file) != 1 ||
+	    memcmp(r->hdr.magic, PGT_MAGIC, sizeof(r->hdr.magic)) ||
+	    r->hdr.version != PGT_VERSION ||
+	    r->hdr.record_size != sizeof(struct pgt_record)) {
+		if (r->file != stdin)
+			fclose(r->file);
+		r->file = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* read up to n records. returns the number read, 0 at the end */
+static inline int pgt_read(struct pgt_reader *r, struct pgt_record *rec, int n)
+{
+	return fread(rec, sizeof(*rec), n, r->file);
+}
+
+static inline void pgt_close(struct pgt_reader *r)
+{
+	if (r->file && r->file != stdin)
+		fclose(r->file);
+	r->file = NULL;
+}
+
+#endif /* __PAGETYPE_REC_H */
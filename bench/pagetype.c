@@ -8,6 +8,7 @@
  * Released under the General Public License (GPL).
  */
 
+#define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,9 +19,18 @@
 #include <getopt.h>
 #include <limits.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/errno.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <ftw.h>
+
+#include "pagetype-rec.h"
+#include "colormap.h"
 
 
 /*
@@ -49,6 +59,9 @@
 
 #define KPF_BYTES		8
 #define PROC_KPAGEFLAGS		"/proc/kpageflags"
+#define PROC_KPAGECOUNT		"/proc/kpagecount"
+#define PROC_KPAGECGROUP	"/proc/kpagecgroup"
+#define PALLOC_MASK		"/sys/kernel/debug/palloc/palloc_mask"
 
 /* copied from kpageflags_read() */
 #define KPF_LOCKED		0
@@ -160,16 +173,26 @@ static int		opt_raw;	/* for kernel developers */
 static int		opt_list;	/* list pages (in ranges) */
 static int		opt_no_summary;	/* don't show summary */
 static pid_t		opt_pid;	/* process to walk */
+static char		*opt_cgroup;	/* cgroup whose processes to walk */
+static double		opt_watch;	/* re-walk interval in seconds */
+
+enum { FMT_TEXT, FMT_CSV, FMT_JSON, FMT_BIN };
+static int		opt_format;	/* listing and summary output format */
+
+static unsigned long	*cg_pfns;
+static unsigned long	nr_cg_pfns, max_cg_pfns;
+static unsigned long	nr_cg_mapped;	/* before deduplication */
+static int		nr_cg_tasks;
 
-#define MAX_ADDR_RANGES	1024
 static int		nr_addr_ranges;
-static unsigned long	opt_offset[MAX_ADDR_RANGES];
-static unsigned long	opt_size[MAX_ADDR_RANGES];
+static int		max_addr_ranges;
+static unsigned long	*opt_offset;
+static unsigned long	*opt_size;
 
-#define MAX_VMAS	10240
 static int		nr_vmas;
-static unsigned long	pg_start[MAX_VMAS];
-static unsigned long	pg_end[MAX_VMAS];
+static int		max_vmas;
+static unsigned long	*pg_start;
+static unsigned long	*pg_end;
 
 #define MAX_BIT_FILTERS	64
 static int		nr_bit_filters;
@@ -180,6 +203,8 @@ static int		page_size;
 
 static int		pagemap_fd;
 static int		kpageflags_fd;
+static int		kpagecount_fd = -1;
+static int		kpagecgroup_fd = -1;
 
 static int		opt_hwpoison;
 static int		opt_unpoison;
@@ -193,11 +218,103 @@ static int		hwpoison_forget_fd;
 #define HASH_MASK	(HASH_SIZE - 1)
 #define HASH_KEY(flags)	(flags & HASH_MASK)
 
-static unsigned long	total_pages;
-static unsigned long	nr_pages[HASH_SIZE];
-static uint64_t 	page_flags[HASH_SIZE];
+struct page_stats {
+	unsigned long	total_pages;
+	unsigned long	nr_pages[HASH_SIZE];
+	uint64_t	page_flags[HASH_SIZE];
+	unsigned long	nr_color_pages[HASH_SIZE];
+};
+
+/*
+ * -C color capacity: page classes per (zone, color). Before v4.18 the
+ * kernel flags a free buddy block at its head page only, so the flagless
+ * pages after a buddy page, up to its natural alignment, are taken as the
+ * rest of its block. From v4.18 every page of the block is flagged, and
+ * flagless pages are allocated ones.
+ */
+#define MAX_ORDER	11	/* buddy orders 0..MAX_ORDER-1 */
+#define FRAG_ORDER	9	/* pageblock (huge page) order */
+#define MAX_ZONES	64
+
+struct zone_span {
+	int		node;
+	char		name[16];
+	unsigned long	start;
+	unsigned long	end;
+};
+
+struct color_cap {
+	unsigned long	free;
+	unsigned long	used;
+	unsigned long	huge;
+	unsigned long	slab;
+	unsigned long	free_order[MAX_ORDER];	/* free pages by block order */
+};
+
+static int		opt_capacity;
+static int		buddy_tails;	/* every free page has KPF_BUDDY */
+static int		nr_zones;
+static struct zone_span	zones[MAX_ZONES];
+static int		nr_colors = 1;
+
+/* -O: share counts in buckets of map count 0, 1, 2, 3-4, 5-8, 9+ */
+#define NR_SHARE_BUCKETS	6
+
+struct color_owner {
+	unsigned long	anon;
+	unsigned long	file;
+	unsigned long	ksm;
+	unsigned long	other;
+	unsigned long	share[NR_SHARE_BUCKETS];
+};
+
+/* -O: pages per (memory cgroup, color), open addressed, grown at 70% */
+#define CG_OWNER_INIT	1024
+
+struct cg_owner {
+	uint64_t	ino;		/* memcg inode, 0 for none */
+	int		color;
+	unsigned long	pages;
+};
+
+static int		opt_owners;
 
-static unsigned long    nr_color_pages[HASH_SIZE];
+/* a pending -l range */
+struct page_range {
+	unsigned long	voff;
+	unsigned long	index;
+	unsigned long	count;
+	uint64_t	flags;
+};
+
+/*
+ * Per-walker state. The main walker prints directly to stdout; the
+ * workers of a parallel scan keep their tallies and listing output to
+ * themselves, and merge_walk() folds them back in PFN order.
+ */
+struct walk_ctx {
+	struct page_stats	stats;
+	struct page_range	range;		/* -l: range being extended */
+	struct page_range	*ranges;	/* -l: finished ranges (workers) */
+	unsigned long		nr_ranges;
+	unsigned long		max_ranges;
+	FILE			*out;		/* -L: listing output, tmpfile */
+	unsigned long		start, count;	/* PFN range of a worker */
+	struct color_cap	*cap;		/* -C: [zone][color], see cap_of() */
+	int			zone;		/* -C: zone of the last page */
+	unsigned long		free_head;	/* -C: free pages being followed */
+	unsigned long		free_count;
+	unsigned long		free_limit;	/* -C: end of the head's block */
+	struct color_owner	*own;		/* -O: [color] */
+	struct cg_owner		*cg_own;	/* -O: [cg_size], power of 2 */
+	unsigned long		cg_size;
+	unsigned long		cg_used;
+};
+
+#define MAX_WORKERS	256
+static int		opt_threads;	/* scan threads (0: online CPUs) */
+
+static struct walk_ctx	main_ctx;
 
 
 /*
@@ -231,6 +348,19 @@ static void fatal(const char *x, ...)
 	exit(EXIT_FAILURE);
 }
 
+/* grow the arrays of a (pointer, count, capacity) table to hold one more */
+static void grow_table(int nr, int *max, size_t size, void **a, void **b)
+{
+	if (nr < *max)
+		return;
+
+	*max = *max ? *max * 2 : 256;
+	*a = realloc(*a, *max * size);
+	*b = realloc(*b, *max * size);
+	if (!*a || !*b)
+		fatal("out of memory\n");
+}
+
 static int checked_open(const char *pathname, int flags)
 {
 	int fd = open(pathname, flags);
@@ -257,12 +387,8 @@ static unsigned long do_u64_read(int fd, char *name,
 	if (index > ULONG_MAX / 8)
 		fatal("index overflow: %lu\n", index);
 
-	if (lseek(fd, index * 8, SEEK_SET) < 0) {
-		perror(name);
-		exit(EXIT_FAILURE);
-	}
-
-	bytes = read(fd, buf, count * 8);
+	/* pread: the fds are shared by the scan threads */
+	bytes = pread(fd, buf, count * 8, index * 8);
 	if (bytes < 0) {
 		perror(name);
 		exit(EXIT_FAILURE);
@@ -280,6 +406,21 @@ static unsigned long kpageflags_read(uint64_t *buf,
 	return do_u64_read(kpageflags_fd, PROC_KPAGEFLAGS, buf, index, pages);
 }
 
+/*
+ * -O: the map counts and memcg inodes of the same pages. A short read
+ * leaves the remaining entries 0.
+ */
+static void kpageowner_read(uint64_t *count, uint64_t *cgroup,
+			    unsigned long index, unsigned long pages)
+{
+	unsigned long n;
+
+	n = do_u64_read(kpagecount_fd, PROC_KPAGECOUNT, count, index, pages);
+	memset(count + n, 0, (pages - n) * sizeof(uint64_t));
+	n = do_u64_read(kpagecgroup_fd, PROC_KPAGECGROUP, cgroup, index, pages);
+	memset(cgroup + n, 0, (pages - n) * sizeof(uint64_t));
+}
+
 static unsigned long pagemap_read(uint64_t *buf,
 				  unsigned long index,
 				  unsigned long pages)
@@ -307,10 +448,7 @@ static unsigned long pagemap_pfn(uint64_t val)
 #define BITOP_WORD(nr)		((nr) / BITS_PER_LONG)
 #define PAGE_SHIFT 12
 
-#define MAX_BANK_FUNCTIONS 16
-#define MAX_BITS_PER_FUNCTION 32
-static int g_bank_function_cnt = 0;
-static uint64_t g_bank_functions[MAX_BANK_FUNCTIONS]; // each function is represented as a bitmask
+static struct colormap g_cmap;	/* -f/-k color map, rebased on PFNs */
 
 /**
  * __ffs - find first set bit in word
@@ -411,21 +549,7 @@ found_middle:
 
 static inline int pfn_to_color(uint64_t pfn)
 {
-	int color = 0;
-	int bit_pos = 0;
-	for (size_t func_idx = 0; func_idx < g_bank_function_cnt; func_idx++) {
-		int bit_result = 0;
-
-		// XOR all the specified bits for this function
-		for_each_set_bit(bit_pos, &g_bank_functions[func_idx], BITS_PER_LONG) {
-			bit_result ^= ((pfn >> (bit_pos - PAGE_SHIFT)) & 0x1);
-		}
-		// Set the corresponding bit in the color
-		if (bit_result) {
-			color |= (1 << func_idx);
-		}
-	}
-	return color;
+	return cmap_color(&g_cmap, pfn);
 }
 
 /*
@@ -434,7 +558,7 @@ static inline int pfn_to_color(uint64_t pfn)
 
 static char *page_flag_name(uint64_t flags)
 {
-	static char buf[65];
+	static __thread char buf[65];
 	int present;
 	int i, j;
 
@@ -475,49 +599,151 @@ static char *page_flag_longname(uint64_t flags)
  * page list and summary
  */
 
-static void show_page_range(unsigned long voffset,
-			    unsigned long offset, uint64_t flags)
+/*
+ * one listing or summary row in the -F format; every format carries the
+ * same fields as struct pgt_record
+ */
+static void emit_record(FILE *out, int kind, unsigned long vpn,
+			unsigned long pfn, unsigned long count,
+			uint64_t flags, int color)
+{
+	struct pgt_record rec;
+
+	switch (opt_format) {
+	case FMT_CSV:
+		fprintf(out, "%s,%lu,%lu,%lu,0x%llx,%d\n", pgt_kind_names[kind],
+			vpn, pfn, count, (unsigned long long)flags, color);
+		break;
+	case FMT_JSON:
+		fprintf(out, "{\"type\":\"%s\",\"vpn\":%lu,\"pfn\":%lu,"
+			"\"count\":%lu,\"flags\":%llu,\"color\":%d}\n",
+			pgt_kind_names[kind], vpn, pfn, count,
+			(unsigned long long)flags, color);
+		break;
+	case FMT_BIN:
+		rec.kind = kind;
+		rec.color = color;
+		rec.vpn = vpn;
+		rec.pfn = pfn;
+		rec.count = count;
+		rec.flags = flags;
+		fwrite(&rec, sizeof(rec), 1, out);
+		break;
+	}
+}
+
+static void emit_header(void)
 {
-	static uint64_t      flags0;
-	static unsigned long voff;
-	static unsigned long index;
-	static unsigned long count;
+	struct pgt_header hdr = { .version = PGT_VERSION };
+
+	switch (opt_format) {
+	case FMT_CSV:
+		printf("type,vpn,pfn,count,flags,color\n");
+		break;
+	case FMT_BIN:
+		memcpy(hdr.magic, PGT_MAGIC, sizeof(hdr.magic));
+		hdr.record_size = sizeof(struct pgt_record);
+		hdr.page_size = page_size;
+		hdr.nr_colors = min_t(int, cmap_nr_colors(&g_cmap), HASH_SIZE);
+		fwrite(&hdr, sizeof(hdr), 1, stdout);
+		break;
+	}
+}
+
+static void emit_page_range(struct walk_ctx *ctx, struct page_range *r)
+{
+	if (ctx != &main_ctx) {
+		if (ctx->nr_ranges >= ctx->max_ranges) {
+			ctx->max_ranges = ctx->max_ranges ? ctx->max_ranges * 2 : 1024;
+			ctx->ranges = realloc(ctx->ranges,
+					      ctx->max_ranges * sizeof(*r));
+			if (!ctx->ranges)
+				fatal("out of memory\n");
+		}
+		ctx->ranges[ctx->nr_ranges++] = *r;
+		return;
+	}
 
-	if (flags == flags0 && offset == index + count &&
-	    (!opt_pid || voffset == voff + count)) {
-		count++;
+	if (opt_format) {
+		emit_record(stdout, PGT_RANGE, r->voff, r->index, r->count,
+			    r->flags, pfn_to_color(r->index));
 		return;
 	}
 
-	if (count) {
-		if (opt_pid)
-			printf("%lx\t", voff);
-		printf("%lx\t%lx\t%s\n",
-				index, count, page_flag_name(flags0));
+	if (opt_pid)
+		printf("%lx\t", r->voff);
+	printf("%lx\t%lx\t%s\n",
+			r->index, r->count, page_flag_name(r->flags));
+}
+
+/* extend the pending range by count pages, or emit it and start anew */
+static void show_page_range(struct walk_ctx *ctx, unsigned long voffset,
+			    unsigned long offset, unsigned long count,
+			    uint64_t flags)
+{
+	struct page_range *r = &ctx->range;
+
+	if (flags == r->flags && offset == r->index + r->count &&
+	    (!opt_pid || voffset == r->voff + r->count)) {
+		r->count += count;
+		return;
 	}
 
-	flags0 = flags;
-	index  = offset;
-	voff   = voffset;
-	count  = 1;
+	if (r->count)
+		emit_page_range(ctx, r);
+
+	r->flags = flags;
+	r->index = offset;
+	r->voff  = voffset;
+	r->count = count;
 }
 
-static void show_page(unsigned long voffset,
-		      unsigned long offset, uint64_t flags)
+static void show_page(struct walk_ctx *ctx, unsigned long voffset,
+		      unsigned long offset, uint64_t flags, int color)
 {
+	if (opt_format) {
+		emit_record(ctx->out, PGT_PAGE, voffset, offset, 1, flags, color);
+		return;
+	}
 	if (opt_pid)
-		printf("%lx\t", voffset);
-	printf("%lx\tcolor=%d\t%s\n", offset, pfn_to_color(offset), page_flag_name(flags));
+		fprintf(ctx->out, "%lx\t", voffset);
+	fprintf(ctx->out, "%lx\tcolor=%d\t%s\n", offset, color,
+		page_flag_name(flags));
+}
+
+static void show_summary_records(void)
+{
+	struct page_stats *st = &main_ctx.stats;
+	int i;
+
+	for (i = 0; i < HASH_SIZE; i++)
+		if (st->nr_pages[i])
+			emit_record(stdout, PGT_FLAGS, 0, 0, st->nr_pages[i],
+				    st->page_flags[i], -1);
+	for (i = 0; i < HASH_SIZE; i++)
+		if (st->nr_color_pages[i])
+			emit_record(stdout, PGT_COLOR, 0, 0,
+				    st->nr_color_pages[i], 0, i);
+	emit_record(stdout, PGT_TOTAL, 0, 0, st->total_pages, 0, -1);
 }
 
 static void show_summary(void)
 {
+	struct page_stats *st = &main_ctx.stats;
+	unsigned long *nr_pages = st->nr_pages;
+	uint64_t *page_flags = st->page_flags;
+	unsigned long *nr_color_pages = st->nr_color_pages;
 	int i;
 
+	if (opt_format) {
+		show_summary_records();
+		return;
+	}
+
 	printf("             flags\tpage-count       MB"
 		"  symbolic-flags\t\t\tlong-symbolic-flags\n");
 
-	for (i = 0; i < ARRAY_SIZE(nr_pages); i++) {
+	for (i = 0; i < HASH_SIZE; i++) {
 		if (nr_pages[i])
 			printf("0x%016llx\t%10lu %8lu  %s\t%s\n",
 				(unsigned long long)page_flags[i],
@@ -528,9 +754,9 @@ static void show_summary(void)
 	}
 
 	printf("             total\t%10lu %8lu\n",
-			total_pages, pages2mb(total_pages));
+			st->total_pages, pages2mb(st->total_pages));
 
-	for (i = 0; i < ARRAY_SIZE(nr_color_pages); i++) {
+	for (i = 0; i < HASH_SIZE; i++) {
 		if (nr_color_pages[i])
 			printf("             color[%d]\t%10lu %8lu\n", i,
 			       nr_color_pages[i], 
@@ -539,6 +765,261 @@ static void show_summary(void)
 }
 
 
+static void show_capacity_table(const char *title, struct color_cap *cap)
+{
+	struct color_cap *c;
+	unsigned long frag;
+	int i, k, top;
+
+	printf("\n%s\n", title);
+	printf("   color\t      free     used     huge     slab   free-MB  frag%%  max-order\n");
+	for (i = 0; i < nr_colors; i++) {
+		c = &cap[i];
+		if (!c->free && !c->used && !c->huge && !c->slab)
+			continue;
+		for (k = 0, frag = 0, top = -1; k < MAX_ORDER; k++) {
+			if (k < FRAG_ORDER)
+				frag += c->free_order[k];
+			if (c->free_order[k])
+				top = k;
+		}
+		printf("%8d\t%10lu %8lu %8lu %8lu %9lu %6.1f %10d\n", i,
+		       c->free, c->used, c->huge, c->slab, pages2mb(c->free),
+		       c->free ? 100.0 * frag / c->free : 0.0, top);
+	}
+}
+
+static void add_capacity(struct color_cap *dst, struct color_cap *src)
+{
+	int i, k;
+
+	for (i = 0; i < nr_colors; i++) {
+		dst[i].free += src[i].free;
+		dst[i].used += src[i].used;
+		dst[i].huge += src[i].huge;
+		dst[i].slab += src[i].slab;
+		for (k = 0; k < MAX_ORDER; k++)
+			dst[i].free_order[k] += src[i].free_order[k];
+	}
+}
+
+/*
+ * free/used/huge/slab pages per color, for each zone, each node and the
+ * whole system. frag% is the share of free pages in blocks smaller than
+ * FRAG_ORDER; max-order is the largest free block order seen.
+ */
+static void show_capacity(void)
+{
+	struct color_cap *node_cap, *all_cap;
+	char title[128];
+	int z, n, max_node = 0;
+
+	node_cap = calloc(nr_colors, sizeof(struct color_cap));
+	all_cap = calloc(nr_colors, sizeof(struct color_cap));
+
+	printf("\n\ncolor capacity (pages; free: buddy, used: not free, huge or slab)\n");
+	for (z = 0; z < nr_zones; z++) {
+		snprintf(title, sizeof(title), "node %d zone %s (pfn %lx-%lx)",
+			 zones[z].node, zones[z].name, zones[z].start, zones[z].end);
+		show_capacity_table(title, &main_ctx.cap[z * nr_colors]);
+		max_node = max_t(int, max_node, zones[z].node);
+	}
+
+	for (n = 0; n <= max_node; n++) {
+		memset(node_cap, 0, nr_colors * sizeof(struct color_cap));
+		for (z = 0; z < nr_zones; z++)
+			if (zones[z].node == n)
+				add_capacity(node_cap, &main_ctx.cap[z * nr_colors]);
+		snprintf(title, sizeof(title), "node %d", n);
+		show_capacity_table(title, node_cap);
+		add_capacity(all_cap, node_cap);
+	}
+	add_capacity(all_cap, &main_ctx.cap[nr_zones * nr_colors]);
+	show_capacity_table("all", all_cap);
+
+	free(node_cap);
+	free(all_cap);
+}
+
+/* -O: memcg inode to cgroup directory, resolved by walking the hierarchy */
+#define CG_OWNERS_SHOWN	5	/* cgroups listed per color */
+
+static struct cg_name {
+	uint64_t	ino;
+	char		*path;
+} *cg_names;
+static int		nr_cg_names;
+
+static int cg_name_visit(const char *path, const struct stat *sb,
+			 int type, struct FTW *ftw)
+{
+	int i;
+
+	if (type != FTW_D)
+		return 0;
+	for (i = 0; i < nr_cg_names; i++)
+		if (cg_names[i].ino == sb->st_ino && !cg_names[i].path)
+			cg_names[i].path = strdup(path);
+	return 0;
+}
+
+static const char *cg_name(uint64_t ino)
+{
+	int i;
+
+	if (!ino)
+		return "(none)";
+	for (i = 0; i < nr_cg_names; i++)
+		if (cg_names[i].ino == ino && cg_names[i].path)
+			return cg_names[i].path;
+	return "(unknown)";
+}
+
+static int cmp_cg_owner(const void *a, const void *b)
+{
+	const struct cg_owner *x = a, *y = b;
+
+	if (x->color != y->color)
+		return x->color - y->color;
+	return (x->pages < y->pages) - (x->pages > y->pages);
+}
+
+/*
+ * anon/file/ksm pages and map count buckets per color, and the memory
+ * cgroups the pages of each color are charged to
+ */
+static void show_owners(void)
+{
+	struct cg_owner *owners;
+	struct color_owner *o;
+	unsigned long rest;
+	int i, k, n = 0, shown;
+
+	printf("\npage ownership per color\n");
+	printf("   color\t      anon      file       ksm     other |"
+	       "    map=0        1        2      3-4      5-8       9+\n");
+	for (i = 0; i < nr_colors; i++) {
+		o = &main_ctx.own[i];
+		if (!o->anon && !o->file && !o->ksm && !o->other)
+			continue;
+		printf("%8d\t%10lu%10lu%10lu%10lu |", i,
+		       o->anon, o->file, o->ksm, o->other);
+		for (k = 0; k < NR_SHARE_BUCKETS; k++)
+			printf(" %8lu", o->share[k]);
+		printf("\n");
+	}
+
+	owners = malloc(main_ctx.cg_used * sizeof(*owners));
+	cg_names = calloc(main_ctx.cg_used, sizeof(*cg_names));
+	if (!owners || !cg_names)
+		fatal("out of memory\n");
+	for (i = 0; i < main_ctx.cg_size; i++) {
+		if (!main_ctx.cg_own[i].pages)
+			continue;
+		owners[n++] = main_ctx.cg_own[i];
+		for (k = 0; k < nr_cg_names; k++)
+			if (cg_names[k].ino == main_ctx.cg_own[i].ino)
+				break;
+		if (k == nr_cg_names)
+			cg_names[nr_cg_names++].ino = main_ctx.cg_own[i].ino;
+	}
+	qsort(owners, n, sizeof(*owners), cmp_cg_owner);
+	nftw(access("/sys/fs/cgroup/memory", F_OK) ? "/sys/fs/cgroup" :
+	     "/sys/fs/cgroup/memory", cg_name_visit, 64, FTW_PHYS);
+
+	printf("\nmemory cgroups per color\n");
+	printf("   color\t     pages       MB  cgroup\n");
+	for (i = 0; i < n; i += k) {
+		rest = 0;
+		for (k = 0, shown = 0; i + k < n &&
+			     owners[i + k].color == owners[i].color; k++) {
+			if (shown++ < CG_OWNERS_SHOWN)
+				printf("%8d\t%10lu %8lu  %s\n",
+				       owners[i + k].color, owners[i + k].pages,
+				       pages2mb(owners[i + k].pages),
+				       cg_name(owners[i + k].ino));
+			else
+				rest += owners[i + k].pages;
+		}
+		if (rest)
+			printf("%8d\t%10lu %8lu  (%d other cgroups)\n",
+			       owners[i].color, rest, pages2mb(rest),
+			       shown - CG_OWNERS_SHOWN);
+	}
+
+	for (i = 0; i < nr_cg_names; i++)
+		free(cg_names[i].path);
+	free(cg_names);
+	free(owners);
+}
+
+/* parse a bin list ("0-3,8") into allowed[]. returns the number of bins */
+static int parse_bins(const char *str, char *allowed, int max)
+{
+	const char *p = str;
+	char *end;
+	long lo, hi;
+	int n = 0;
+
+	while (*p && *p != '\n') {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (; lo <= hi; lo++)
+			if (lo >= 0 && lo < max) {
+				allowed[lo] = 1;
+				n++;
+			}
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+/*
+ * color histogram of the cgroup's distinct pages. pages whose color is
+ * not in the cgroup's palloc.bins (when there is one) are flagged.
+ */
+static void show_cgroup_summary(void)
+{
+	unsigned long *nr_color_pages = main_ctx.stats.nr_color_pages;
+	unsigned long total = main_ctx.stats.total_pages, outside = 0;
+	static char allowed[HASH_SIZE];
+	char buf[PATH_MAX], bins[4096] = "";
+	int i, nr_bins = 0;
+	FILE *file;
+
+	snprintf(buf, sizeof(buf), "%s/palloc.bins", opt_cgroup);
+	file = fopen(buf, "r");
+	if (file) {
+		if (fgets(bins, sizeof(bins), file))
+			nr_bins = parse_bins(bins, allowed, HASH_SIZE);
+		fclose(file);
+		bins[strcspn(bins, "\n")] = '\0';
+	}
+
+	printf("\ncgroup %s: %d tasks, %lu mapped pages, %lu distinct pages\n",
+	       opt_cgroup, nr_cg_tasks, nr_cg_mapped, nr_cg_pfns);
+	if (nr_bins)
+		printf("palloc.bins: %s\n", bins);
+	printf("   color\t     pages       MB      %%\n");
+	for (i = 0; i < HASH_SIZE; i++) {
+		if (!nr_color_pages[i])
+			continue;
+		printf("%8d\t%10lu %8lu %6.2f%s\n", i, nr_color_pages[i],
+		       pages2mb(nr_color_pages[i]),
+		       total ? 100.0 * nr_color_pages[i] / total : 0.0,
+		       (nr_bins && !allowed[i]) ? "  <- outside palloc.bins" : "");
+		if (nr_bins && !allowed[i])
+			outside += nr_color_pages[i];
+	}
+	if (nr_bins)
+		printf("outside palloc.bins: %lu pages (%.2f%%)\n", outside,
+		       total ? 100.0 * outside / total : 0.0);
+}
+
+
 /*
  * page flag filters
  */
@@ -652,8 +1133,9 @@ static int unpoison_page(unsigned long offset)
  * page frame walker
  */
 
-static int hash_slot(uint64_t flags)
+static int hash_slot(struct page_stats *st, uint64_t flags)
 {
+	uint64_t *page_flags = st->page_flags;
 	int k = HASH_KEY(flags);
 	int i;
 
@@ -664,8 +1146,8 @@ static int hash_slot(uint64_t flags)
 		return 0;
 
 	/* search through the remaining (HASH_SIZE-1) slots */
-	for (i = 1; i < ARRAY_SIZE(page_flags); i++, k++) {
-		if (!k || k >= ARRAY_SIZE(page_flags))
+	for (i = 1; i < HASH_SIZE; i++, k++) {
+		if (!k || k >= HASH_SIZE)
 			k = 1;
 		if (page_flags[k] == 0) {
 			page_flags[k] = flags;
@@ -679,9 +1161,219 @@ static int hash_slot(uint64_t flags)
 	exit(EXIT_FAILURE);
 }
 
-static void add_page(unsigned long voffset,
-		     unsigned long offset, uint64_t flags)
+/*
+ * color capacity accounting
+ */
+
+/* the (zone, color) tallies of pfn. pages outside any zone go last */
+static struct color_cap *cap_of(struct walk_ctx *ctx, unsigned long pfn,
+				int color)
+{
+	int z = ctx->zone;
+
+	if (z >= nr_zones || pfn < zones[z].start || pfn >= zones[z].end) {
+		for (z = 0; z < nr_zones; z++)
+			if (pfn >= zones[z].start && pfn < zones[z].end)
+				break;
+		ctx->zone = z;
+	}
+	return &ctx->cap[z * nr_colors + color];
+}
+
+static void alloc_capacity(struct walk_ctx *ctx)
+{
+	ctx->cap = calloc((nr_zones + 1) * nr_colors, sizeof(struct color_cap));
+	if (!ctx->cap)
+		fatal("out of memory\n");
+}
+
+/* v4.18 flags the tail pages of a free block with KPF_BUDDY too */
+static int kernel_flags_buddy_tails(void)
+{
+	struct utsname u;
+	int major = 0, minor = 0;
+
+	if (uname(&u) || sscanf(u.release, "%d.%d", &major, &minor) != 2)
+		return 1;
+	return major > 4 || (major == 4 && minor >= 18);
+}
+
+/*
+ * The kernel does not report the order of a free block. The buddy
+ * allocator merges free buddies, so a run of free pages is taken apart
+ * into the largest aligned blocks from its start: 1 << order pages for
+ * the head, then the next head after them.
+ */
+static void end_free_block(struct walk_ctx *ctx)
+{
+	unsigned long pfn = ctx->free_head, end = pfn + ctx->free_count, i;
+	struct color_cap *c;
+	int order;
+
+	while (pfn < end) {
+		order = pfn ? __builtin_ctzl(pfn) : MAX_ORDER - 1;
+		order = min_t(int, order, MAX_ORDER - 1);
+		while ((1UL << order) > end - pfn)
+			order--;
+		for (i = pfn; i < pfn + (1UL << order); i++) {
+			c = cap_of(ctx, i, pfn_to_color(i));
+			c->free++;
+			c->free_order[order]++;
+		}
+		pfn += 1UL << order;
+	}
+	ctx->free_count = 0;
+}
+
+/*
+ * pages without flags are allocated (kernel pages), not free, unless the
+ * kernel flags head pages only and they are within a buddy page's block
+ */
+static void account_capacity(struct walk_ctx *ctx, unsigned long pfn,
+			     int color, uint64_t flags)
+{
+	struct color_cap *c;
+	int order;
+	int next = ctx->free_count && pfn == ctx->free_head + ctx->free_count;
+
+	if (flags & BIT(BUDDY)) {
+		if (!next) {
+			if (ctx->free_count)
+				end_free_block(ctx);
+			ctx->free_head = pfn;
+			ctx->free_count = 0;
+		}
+		ctx->free_count++;
+		order = pfn ? __builtin_ctzl(pfn) : MAX_ORDER - 1;
+		order = min_t(int, order, MAX_ORDER - 1);
+		ctx->free_limit = pfn + (1UL << order);
+		return;
+	}
+	if (!buddy_tails && !flags && next && pfn < ctx->free_limit) {
+		ctx->free_count++;
+		return;
+	}
+	if (ctx->free_count)
+		end_free_block(ctx);
+
+	c = cap_of(ctx, pfn, color);
+	if (flags & (BIT(HUGE) | BIT(THP)))
+		c->huge++;
+	else if (flags & BIT(SLAB))
+		c->slab++;
+	else
+		c->used++;
+}
+
+/*
+ * page ownership accounting
+ */
+
+static void alloc_owners(struct walk_ctx *ctx)
+{
+	ctx->own = calloc(nr_colors, sizeof(struct color_owner));
+	ctx->cg_size = CG_OWNER_INIT;
+	ctx->cg_used = 0;
+	ctx->cg_own = calloc(ctx->cg_size, sizeof(struct cg_owner));
+	if (!ctx->own || !ctx->cg_own)
+		fatal("out of memory\n");
+}
+
+static int share_bucket(uint64_t mapcount)
+{
+	if (mapcount <= 2)
+		return mapcount;
+	if (mapcount <= 4)
+		return 3;
+	if (mapcount <= 8)
+		return 4;
+	return 5;
+}
+
+/* inode numbers are clustered: mix them (murmur3 finalizer) */
+static unsigned long cg_owner_hash(uint64_t ino, int color)
+{
+	uint64_t h = (ino << 16 | color) * 0x9e3779b97f4a7c15ULL;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static struct cg_owner *cg_owner_slot(struct cg_owner *table,
+				      unsigned long size, uint64_t ino,
+				      int color)
+{
+	unsigned long i = cg_owner_hash(ino, color) & (size - 1);
+
+	while (table[i].pages &&
+	       (table[i].ino != ino || table[i].color != color))
+		i = (i + 1) & (size - 1);
+	return &table[i];
+}
+
+static void grow_cg_owners(struct walk_ctx *ctx)
+{
+	unsigned long size = ctx->cg_size * 2, i;
+	struct cg_owner *table = calloc(size, sizeof(*table));
+
+	if (!table)
+		fatal("out of memory\n");
+	for (i = 0; i < ctx->cg_size; i++)
+		if (ctx->cg_own[i].pages)
+			*cg_owner_slot(table, size, ctx->cg_own[i].ino,
+				       ctx->cg_own[i].color) = ctx->cg_own[i];
+	free(ctx->cg_own);
+	ctx->cg_own = table;
+	ctx->cg_size = size;
+}
+
+static void add_cg_owner(struct walk_ctx *ctx, uint64_t ino, int color,
+			 unsigned long pages)
+{
+	struct cg_owner *o;
+
+	o = cg_owner_slot(ctx->cg_own, ctx->cg_size, ino, color);
+	if (!o->pages) {
+		if ((ctx->cg_used + 1) * 10 > ctx->cg_size * 7) {
+			grow_cg_owners(ctx);
+			o = cg_owner_slot(ctx->cg_own, ctx->cg_size, ino, color);
+		}
+		o->ino = ino;
+		o->color = color;
+		ctx->cg_used++;
+	}
+	o->pages += pages;
+}
+
+static void account_owner(struct walk_ctx *ctx, int color, uint64_t flags,
+			  uint64_t mapcount, uint64_t cgroup)
+{
+	struct color_owner *o = &ctx->own[color];
+
+	if (flags & BIT(KSM))
+		o->ksm++;
+	else if (flags & BIT(ANON))
+		o->anon++;
+	else if (flags & (BIT(MMAP) | BIT(LRU)))
+		o->file++;
+	else
+		o->other++;
+
+	o->share[share_bucket(mapcount)]++;
+	add_cg_owner(ctx, cgroup, color, 1);
+}
+
+static void add_page(struct walk_ctx *ctx, unsigned long voffset,
+		     unsigned long offset, int color, uint64_t flags,
+		     uint64_t mapcount, uint64_t cgroup)
 {
+	struct page_stats *st = &ctx->stats;
+
+	if (opt_capacity)
+		account_capacity(ctx, offset, color, flags);
+
 	flags = kpageflags_flags(flags);
 
 	if (!bit_mask_ok(flags))
@@ -692,50 +1384,196 @@ static void add_page(unsigned long voffset,
 	if (opt_unpoison)
 		unpoison_page(offset);
 
+	if (opt_owners)
+		account_owner(ctx, color, flags, mapcount, cgroup);
+
 	if (opt_list == 1)
-		show_page_range(voffset, offset, flags);
+		show_page_range(ctx, voffset, offset, 1, flags);
 	else if (opt_list == 2)
-		show_page(voffset, offset, flags);
+		show_page(ctx, voffset, offset, flags, color);
 
-	nr_pages[hash_slot(flags)]++;
+	st->nr_pages[hash_slot(st, flags)]++;
 
-	total_pages++;
+	st->total_pages++;
 
-	nr_color_pages[pfn_to_color(offset)]++;
+	st->nr_color_pages[color]++;
 }
 
 #define KPAGEFLAGS_BATCH	(64 << 10)	/* 64k pages */
-static void walk_pfn(unsigned long voffset,
+static void walk_pfn(struct walk_ctx *ctx, unsigned long voffset,
 		     unsigned long index,
 		     unsigned long count)
 {
 	uint64_t buf[KPAGEFLAGS_BATCH];
+	uint64_t *mapcount = NULL, *cgroup = NULL;
+	uint64_t *pfns;
+	uint16_t *colors;
 	unsigned long batch;
 	unsigned long pages;
 	unsigned long i;
 
+	pfns = malloc(KPAGEFLAGS_BATCH * (sizeof(*pfns) + sizeof(*colors)));
+	if (!pfns)
+		fatal("out of memory\n");
+	colors = (uint16_t *)(pfns + KPAGEFLAGS_BATCH);
+
+	if (opt_owners) {
+		mapcount = malloc(2 * KPAGEFLAGS_BATCH * sizeof(uint64_t));
+		if (!mapcount)
+			fatal("out of memory\n");
+		cgroup = mapcount + KPAGEFLAGS_BATCH;
+	}
+
 	while (count) {
 		batch = min_t(unsigned long, count, KPAGEFLAGS_BATCH);
 		pages = kpageflags_read(buf, index, batch);
 		if (pages == 0)
 			break;
+		if (opt_owners)
+			kpageowner_read(mapcount, cgroup, index, pages);
+
+		for (i = 0; i < pages; i++)
+			pfns[i] = index + i;
+		cmap_colors(&g_cmap, pfns, colors, pages);
 
 		for (i = 0; i < pages; i++)
-			add_page(voffset + i, index + i, buf[i]);
+			add_page(ctx, voffset + i, index + i, colors[i], buf[i],
+				 opt_owners ? mapcount[i] : 0,
+				 opt_owners ? cgroup[i] : 0);
 
 		index += pages;
 		count -= pages;
 	}
+	free(mapcount);
+	free(pfns);
+}
+
+/*
+ * Largest hole (in pages) between two present PFNs of a pagemap batch
+ * that is read through rather than split into two kpageflags reads.
+ */
+#define KPAGEFLAGS_GAP	64
+
+struct pfn_ref {
+	unsigned long pfn;
+	unsigned long idx;	/* index in the pagemap batch */
+};
+
+static int cmp_pfn_ref(const void *a, const void *b)
+{
+	const struct pfn_ref *x = a, *y = b;
+
+	if (x->pfn != y->pfn)
+		return x->pfn < y->pfn ? -1 : 1;
+	return x->idx < y->idx ? -1 : (x->idx > y->idx);
+}
+
+/*
+ * Look up the kpageflags of refs[0..n-1] with as few reads as possible:
+ * the PFNs are sorted and deduplicated, and nearby ones are fetched with
+ * one bulk read. flags[] and valid[] are indexed by pagemap batch index.
+ * With -O, mapcount[] and cgroup[] are filled from the same bulk reads.
+ */
+static void kpageflags_lookup(struct pfn_ref *refs, unsigned long n,
+			      uint64_t *flags, char *valid,
+			      uint64_t *mapcount, uint64_t *cgroup)
+{
+	static uint64_t buf[KPAGEFLAGS_BATCH];
+	static uint64_t cnt_buf[KPAGEFLAGS_BATCH];
+	static uint64_t cg_buf[KPAGEFLAGS_BATCH];
+	unsigned long i, j, start, end, pages;
+
+	qsort(refs, n, sizeof(*refs), cmp_pfn_ref);
+
+	for (i = 0; i < n; i = j) {
+		start = refs[i].pfn;
+		end = start + 1;
+		for (j = i + 1; j < n; j++) {
+			if (refs[j].pfn >= start + KPAGEFLAGS_BATCH ||
+			    refs[j].pfn > end + KPAGEFLAGS_GAP)
+				break;
+			end = max_t(unsigned long, end, refs[j].pfn + 1);
+		}
+
+		pages = kpageflags_read(buf, start, end - start);
+		if (opt_owners && pages)
+			kpageowner_read(cnt_buf, cg_buf, start, pages);
+		for (; i < j; i++) {
+			if (refs[i].pfn - start >= pages)
+				continue;
+			flags[refs[i].idx] = buf[refs[i].pfn - start];
+			valid[refs[i].idx] = 1;
+			if (opt_owners) {
+				mapcount[refs[i].idx] = cnt_buf[refs[i].pfn - start];
+				cgroup[refs[i].idx] = cg_buf[refs[i].pfn - start];
+			}
+		}
+	}
+}
+
+/* cgroup walk: PFNs are collected first and classified once */
+static void add_cgroup_pfn(unsigned long pfn)
+{
+	if (nr_cg_pfns >= max_cg_pfns) {
+		max_cg_pfns = max_cg_pfns ? max_cg_pfns * 2 : (1 << 20);
+		cg_pfns = realloc(cg_pfns, max_cg_pfns * sizeof(unsigned long));
+		if (!cg_pfns)
+			fatal("out of memory\n");
+	}
+	cg_pfns[nr_cg_pfns++] = pfn;
+	nr_cg_mapped++;
+}
+
+/*
+ * watch mode: the (vpn, pfn) mappings of each task from the previous walk,
+ * in virtual address order
+ */
+struct watch_map {
+	unsigned long	vpn;
+	unsigned long	pfn;
+};
+
+struct watch_task {
+	pid_t		pid;
+	int		seen;
+	struct watch_map *old, *cur;
+	unsigned long	nr_old, nr_cur, max_old, max_cur;
+};
+
+static struct watch_task *watch_tasks;
+static int		nr_watch_tasks, max_watch_tasks;
+static struct watch_task *watch_cur;	/* task being walked */
+
+static void watch_add_page(unsigned long vpn, unsigned long pfn)
+{
+	struct watch_task *t = watch_cur;
+
+	if (t->nr_cur >= t->max_cur) {
+		t->max_cur = t->max_cur ? t->max_cur * 2 : 4096;
+		t->cur = realloc(t->cur, t->max_cur * sizeof(*t->cur));
+		if (!t->cur)
+			fatal("out of memory\n");
+	}
+	t->cur[t->nr_cur].vpn = vpn;
+	t->cur[t->nr_cur].pfn = pfn;
+	t->nr_cur++;
 }
 
 #define PAGEMAP_BATCH	(64 << 10)
 static void walk_vma(unsigned long index, unsigned long count)
 {
-	uint64_t buf[PAGEMAP_BATCH];
+	static uint64_t buf[PAGEMAP_BATCH];
+	static uint64_t flags[PAGEMAP_BATCH];
+	static uint64_t mapcount[PAGEMAP_BATCH];
+	static uint64_t cgroup[PAGEMAP_BATCH];
+	static uint64_t pfns[PAGEMAP_BATCH];
+	static uint16_t colors[PAGEMAP_BATCH];
+	static char valid[PAGEMAP_BATCH];
+	static struct pfn_ref refs[PAGEMAP_BATCH];
 	unsigned long batch;
 	unsigned long pages;
 	unsigned long pfn;
-	unsigned long i;
+	unsigned long i, n;
 
 	while (count) {
 		batch = min_t(unsigned long, count, PAGEMAP_BATCH);
@@ -743,12 +1581,39 @@ static void walk_vma(unsigned long index, unsigned long count)
 		if (pages == 0)
 			break;
 
-		for (i = 0; i < pages; i++) {
-			pfn = pagemap_pfn(buf[i]);
-			if (pfn)
-				walk_pfn(index + i, pfn, 1);
+		for (i = 0, n = 0; i < pages; i++) {
+			valid[i] = 0;
+			pfn = pfns[i] = pagemap_pfn(buf[i]);
+			if (pfn) {
+				refs[n].pfn = pfn;
+				refs[n].idx = i;
+				n++;
+			}
 		}
 
+		if (opt_watch || opt_cgroup) {
+			for (i = 0; i < n; i++) {
+				if (opt_watch)
+					watch_add_page(index + refs[i].idx,
+						       refs[i].pfn);
+				else
+					add_cgroup_pfn(refs[i].pfn);
+			}
+			index += pages;
+			count -= pages;
+			continue;
+		}
+
+		kpageflags_lookup(refs, n, flags, valid, mapcount, cgroup);
+		cmap_colors(&g_cmap, pfns, colors, pages);
+
+		/* report in virtual address order */
+		for (i = 0; i < pages; i++)
+			if (valid[i])
+				add_page(&main_ctx, index + i, pfns[i],
+					 colors[i], flags[i],
+					 mapcount[i], cgroup[i]);
+
 		index += pages;
 		count -= pages;
 	}
@@ -760,6 +1625,9 @@ static void walk_task(unsigned long index, unsigned long count)
 	unsigned long start;
 	int i = 0;
 
+	if (!nr_vmas)
+		return;
+
 	while (index < end) {
 
 		while (pg_end[i] <= index)
@@ -778,14 +1646,512 @@ static void walk_task(unsigned long index, unsigned long count)
 
 static void add_addr_range(unsigned long offset, unsigned long size)
 {
-	if (nr_addr_ranges >= MAX_ADDR_RANGES)
-		fatal("too many addr ranges\n");
+	grow_table(nr_addr_ranges, &max_addr_ranges, sizeof(unsigned long),
+		   (void **)&opt_offset, (void **)&opt_size);
 
 	opt_offset[nr_addr_ranges] = offset;
 	opt_size[nr_addr_ranges] = min_t(unsigned long, size, ULONG_MAX-offset);
 	nr_addr_ranges++;
 }
 
+/*
+ * parallel physical memory scan
+ */
+
+/* read the populated zones' PFN spans from /proc/zoneinfo */
+static void read_zoneinfo(void)
+{
+	FILE *file = fopen("/proc/zoneinfo", "r");
+	unsigned long start, spanned = 0;
+	char buf[256], name[16];
+	int node = 0;
+
+	nr_zones = 0;
+	if (!file)
+		return;
+	while (fgets(buf, sizeof(buf), file)) {
+		if (sscanf(buf, "Node %d, zone %15s", &node, name) == 2)
+			continue;
+		if (sscanf(buf, " spanned %lu", &spanned) == 1)
+			continue;
+		if (sscanf(buf, " start_pfn: %lu", &start) == 1 && spanned &&
+		    nr_zones < MAX_ZONES) {
+			zones[nr_zones].node = node;
+			strcpy(zones[nr_zones].name, name);
+			zones[nr_zones].start = start;
+			zones[nr_zones].end = start + spanned;
+			nr_zones++;
+		}
+	}
+	fclose(file);
+}
+
+/* one past the highest PFN of any zone, or 0 if unknown */
+static unsigned long read_max_pfn(void)
+{
+	unsigned long max_pfn = 0;
+	int i;
+
+	for (i = 0; i < nr_zones; i++)
+		max_pfn = max_t(unsigned long, max_pfn, zones[i].end);
+	return max_pfn;
+}
+
+static void *scan_worker(void *arg)
+{
+	struct walk_ctx *ctx = arg;
+
+	/* a file, not memory: -L of all RAM runs to gigabytes */
+	if (opt_list == 2) {
+		ctx->out = tmpfile();
+		if (!ctx->out)
+			fatal("tmpfile failed: %s\n", strerror(errno));
+	}
+
+	walk_pfn(ctx, 0, ctx->start, ctx->count);
+
+	if (ctx->free_count)
+		end_free_block(ctx);
+	if (ctx->range.count)
+		emit_page_range(ctx, &ctx->range);
+	return NULL;
+}
+
+/* -L: append a worker's listing to stdout, merged in PFN order */
+static void copy_listing(FILE *out)
+{
+	char buf[1 << 16];
+	size_t n;
+
+	fflush(out);
+	rewind(out);
+	while ((n = fread(buf, 1, sizeof(buf), out)) > 0)
+		if (fwrite(buf, 1, n, stdout) != n)
+			fatal("write failed: %s\n", strerror(errno));
+	if (ferror(out))
+		fatal("listing read failed: %s\n", strerror(errno));
+	fclose(out);
+}
+
+/* fold a worker's tallies and listing into main_ctx */
+static void merge_walk(struct walk_ctx *ctx)
+{
+	struct page_stats *st = &main_ctx.stats;
+	unsigned long i;
+
+	for (i = 0; i < HASH_SIZE; i++) {
+		if (ctx->stats.nr_pages[i])
+			st->nr_pages[hash_slot(st, ctx->stats.page_flags[i])] +=
+				ctx->stats.nr_pages[i];
+		st->nr_color_pages[i] += ctx->stats.nr_color_pages[i];
+	}
+	st->total_pages += ctx->stats.total_pages;
+
+	if (opt_capacity) {
+		unsigned long *dst = (unsigned long *)main_ctx.cap;
+		unsigned long *src = (unsigned long *)ctx->cap;
+		for (i = 0; i < (nr_zones + 1) * nr_colors *
+			     sizeof(struct color_cap) / sizeof(long); i++)
+			dst[i] += src[i];
+		free(ctx->cap);
+	}
+
+	if (opt_owners) {
+		unsigned long *dst = (unsigned long *)main_ctx.own;
+		unsigned long *src = (unsigned long *)ctx->own;
+		for (i = 0; i < nr_colors * sizeof(struct color_owner) /
+			     sizeof(long); i++)
+			dst[i] += src[i];
+		for (i = 0; i < ctx->cg_size; i++)
+			if (ctx->cg_own[i].pages)
+				add_cg_owner(&main_ctx, ctx->cg_own[i].ino,
+					     ctx->cg_own[i].color,
+					     ctx->cg_own[i].pages);
+		free(ctx->own);
+		free(ctx->cg_own);
+	}
+
+	/* ranges may continue across workers: coalesce them again */
+	for (i = 0; i < ctx->nr_ranges; i++)
+		show_page_range(&main_ctx, ctx->ranges[i].voff,
+				ctx->ranges[i].index, ctx->ranges[i].count,
+				ctx->ranges[i].flags);
+
+	free(ctx->ranges);
+	if (ctx->out)
+		copy_listing(ctx->out);
+}
+
+/*
+ * Split [index, index + count) into one contiguous PFN range per thread
+ * and scan them in parallel. Ranges are aligned to 1024 pages.
+ */
+static void walk_pfn_parallel(unsigned long index, unsigned long count)
+{
+	struct walk_ctx *ctx;
+	pthread_t tid[MAX_WORKERS];
+	unsigned long max_pfn = read_max_pfn();
+	unsigned long chunk;
+	int nr = opt_threads, i;
+
+	if (max_pfn && index < max_pfn)
+		count = min_t(unsigned long, count, max_pfn - index);
+	if (nr <= 0)
+		nr = sysconf(_SC_NPROCESSORS_ONLN);
+	nr = min_t(int, nr, MAX_WORKERS);
+	chunk = ((count / nr) + 1023) & ~1023UL;
+
+	/* unknown memory size, or too small to split */
+	if (!max_pfn || nr <= 1 || chunk < KPAGEFLAGS_BATCH) {
+		walk_pfn(&main_ctx, 0, index, count);
+		return;
+	}
+
+	ctx = calloc(nr, sizeof(*ctx));
+	if (!ctx)
+		fatal("out of memory\n");
+	for (i = 0; i < nr && count; i++) {
+		if (opt_capacity)
+			alloc_capacity(&ctx[i]);
+		if (opt_owners)
+			alloc_owners(&ctx[i]);
+		ctx[i].start = index;
+		ctx[i].count = min_t(unsigned long, chunk, count);
+		index += ctx[i].count;
+		count -= ctx[i].count;
+		if (pthread_create(&tid[i], NULL, scan_worker, &ctx[i]))
+			fatal("pthread_create failed\n");
+	}
+	nr = i;
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(tid[i], NULL);
+		merge_walk(&ctx[i]);
+	}
+	free(ctx);
+}
+
+/* open pid's pagemap and load its VMAs. returns -1 if the task is gone */
+static int load_task(pid_t pid)
+{
+	FILE *file;
+	char buf[5000];
+
+	if (pagemap_fd > 0)
+		close(pagemap_fd);
+	nr_vmas = 0;
+
+	sprintf(buf, "/proc/%d/pagemap", pid);
+	pagemap_fd = open(buf, O_RDONLY);
+	if (pagemap_fd < 0) {
+		perror(buf);
+		return -1;
+	}
+
+	sprintf(buf, "/proc/%d/maps", pid);
+	file = fopen(buf, "r");
+	if (!file) {
+		perror(buf);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		unsigned long vm_start;
+		unsigned long vm_end;
+		unsigned long long pgoff;
+		int major, minor;
+		char r, w, x, s;
+		unsigned long ino;
+		int n;
+
+		n = sscanf(buf, "%lx-%lx %c%c%c%c %llx %x:%x %lu",
+			   &vm_start,
+			   &vm_end,
+			   &r, &w, &x, &s,
+			   &pgoff,
+			   &major, &minor,
+			   &ino);
+		if (n < 10) {
+			fprintf(stderr, "unexpected line: %s\n", buf);
+			continue;
+		}
+		grow_table(nr_vmas, &max_vmas, sizeof(unsigned long),
+			   (void **)&pg_start, (void **)&pg_end);
+		pg_start[nr_vmas] = vm_start / page_size;
+		pg_end[nr_vmas] = vm_end / page_size;
+		nr_vmas++;
+	}
+	fclose(file);
+	return 0;
+}
+
+/*
+ * cgroup walk: collect the PFNs mapped by every process of the cgroup,
+ * then classify each distinct PFN once.
+ */
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* sort and remove duplicate (shared) PFNs */
+static void dedup_cgroup_pfns(void)
+{
+	unsigned long i, n = 0;
+
+	qsort(cg_pfns, nr_cg_pfns, sizeof(unsigned long), cmp_ulong);
+	for (i = 0; i < nr_cg_pfns; i++)
+		if (!n || cg_pfns[i] != cg_pfns[n - 1])
+			cg_pfns[n++] = cg_pfns[i];
+	nr_cg_pfns = n;
+}
+
+/* the processes of the cgroup: cgroup.procs (v1 and v2) or tasks (v1) */
+static FILE *open_cgroup_procs(const char *path)
+{
+	char buf[PATH_MAX];
+	FILE *file;
+
+	snprintf(buf, sizeof(buf), "%s/cgroup.procs", path);
+	file = fopen(buf, "r");
+	if (file)
+		return file;
+	snprintf(buf, sizeof(buf), "%s/tasks", path);
+	file = fopen(buf, "r");
+	if (!file) {
+		perror(buf);
+		exit(EXIT_FAILURE);
+	}
+	return file;
+}
+
+static void walk_cgroup(void)
+{
+	static struct pfn_ref refs[PAGEMAP_BATCH];
+	static uint64_t flags[PAGEMAP_BATCH];
+	static uint64_t mapcount[PAGEMAP_BATCH];
+	static uint64_t cgroup[PAGEMAP_BATCH];
+	static uint16_t colors[PAGEMAP_BATCH];
+	static char valid[PAGEMAP_BATCH];
+	unsigned long i, j, n;
+	FILE *file;
+	int pid;
+
+	file = open_cgroup_procs(opt_cgroup);
+	while (fscanf(file, "%d", &pid) == 1) {
+		if (load_task(pid) < 0)
+			continue;	/* exited meanwhile */
+		for (i = 0; i < nr_addr_ranges; i++)
+			walk_task(opt_offset[i], opt_size[i]);
+		nr_cg_tasks++;
+	}
+	fclose(file);
+
+	dedup_cgroup_pfns();
+
+	for (i = 0; i < nr_cg_pfns; i += n) {
+		n = min_t(unsigned long, nr_cg_pfns - i, PAGEMAP_BATCH);
+		for (j = 0; j < n; j++) {
+			refs[j].pfn = cg_pfns[i + j];
+			refs[j].idx = j;
+			valid[j] = 0;
+		}
+		kpageflags_lookup(refs, n, flags, valid, mapcount, cgroup);
+		cmap_colors(&g_cmap, cg_pfns + i, colors, n);
+		for (j = 0; j < n; j++)
+			if (valid[j])
+				add_page(&main_ctx, 0, cg_pfns[i + j], colors[j],
+					 flags[j], mapcount[j], cgroup[j]);
+	}
+}
+
+/*
+ * watch mode. Only the pagemap is re-read each interval: it is diffed
+ * against the previous walk and just the pages whose mapping changed are
+ * re-colored, so kpageflags is never touched. Counts are per mapping, a
+ * page shared by several tasks of a cgroup counts once per task.
+ */
+static long		watch_count[HASH_SIZE];
+static long		watch_prev[HASH_SIZE];
+static unsigned long	watch_new, watch_gone, watch_moved;
+static volatile sig_atomic_t watch_stop;
+
+static void watch_sigint(int sig)
+{
+	watch_stop = 1;
+}
+
+static struct watch_task *watch_find(pid_t pid)
+{
+	struct watch_task *t;
+	int i;
+
+	for (i = 0; i < nr_watch_tasks; i++)
+		if (watch_tasks[i].pid == pid)
+			return &watch_tasks[i];
+
+	if (nr_watch_tasks >= max_watch_tasks) {
+		max_watch_tasks = max_watch_tasks ? max_watch_tasks * 2 : 64;
+		watch_tasks = realloc(watch_tasks,
+				      max_watch_tasks * sizeof(*watch_tasks));
+		if (!watch_tasks)
+			fatal("out of memory\n");
+	}
+	t = &watch_tasks[nr_watch_tasks++];
+	memset(t, 0, sizeof(*t));
+	t->pid = pid;
+	return t;
+}
+
+/* merge the old and new mappings of a task, both sorted by vpn */
+static void watch_diff(struct watch_task *t)
+{
+	struct watch_map *tmp;
+	unsigned long i = 0, j = 0, max;
+
+	while (i < t->nr_old || j < t->nr_cur) {
+		if (j >= t->nr_cur ||
+		    (i < t->nr_old && t->old[i].vpn < t->cur[j].vpn)) {
+			watch_count[pfn_to_color(t->old[i].pfn)]--;
+			watch_gone++;
+			i++;
+		} else if (i >= t->nr_old || t->cur[j].vpn < t->old[i].vpn) {
+			watch_count[pfn_to_color(t->cur[j].pfn)]++;
+			watch_new++;
+			j++;
+		} else {
+			if (t->old[i].pfn != t->cur[j].pfn) {
+				watch_count[pfn_to_color(t->old[i].pfn)]--;
+				watch_count[pfn_to_color(t->cur[j].pfn)]++;
+				watch_moved++;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	tmp = t->old;
+	t->old = t->cur;
+	t->cur = tmp;
+	max = t->max_old;
+	t->max_old = t->max_cur;
+	t->max_cur = max;
+	t->nr_old = t->nr_cur;
+	t->nr_cur = 0;
+}
+
+static void watch_walk_pid(pid_t pid)
+{
+	struct watch_task *t = watch_find(pid);
+	int i;
+
+	if (load_task(pid) < 0)
+		return;		/* exited meanwhile, dropped below */
+
+	watch_cur = t;
+	for (i = 0; i < nr_addr_ranges; i++)
+		walk_task(opt_offset[i], opt_size[i]);
+	watch_diff(t);
+	t->seen = 1;
+}
+
+static unsigned long watch_walk(void)
+{
+	unsigned long pages = 0;
+	FILE *file;
+	int i, pid;
+
+	for (i = 0; i < nr_watch_tasks; i++)
+		watch_tasks[i].seen = 0;
+
+	if (opt_cgroup) {
+		file = open_cgroup_procs(opt_cgroup);
+		while (fscanf(file, "%d", &pid) == 1)
+			watch_walk_pid(pid);
+		fclose(file);
+	} else
+		watch_walk_pid(opt_pid);
+
+	/* tasks that went away: their pages are gone */
+	for (i = 0; i < nr_watch_tasks; ) {
+		struct watch_task *t = &watch_tasks[i];
+
+		if (t->seen) {
+			pages += t->nr_old;
+			i++;
+			continue;
+		}
+		watch_diff(t);
+		free(t->old);
+		free(t->cur);
+		*t = watch_tasks[--nr_watch_tasks];
+	}
+	return pages;
+}
+
+static double watch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void watch_loop(void)
+{
+	struct timespec interval;
+	double start, t0, t1;
+	unsigned long pages;
+	int i, round = 0;
+
+	if (!opt_pid && !opt_cgroup)
+		fatal("-w needs a task to watch, use -p or -g\n");
+	if (!nr_addr_ranges)
+		add_addr_range(0, ULONG_MAX);
+	nr_colors = min_t(int, cmap_nr_colors(&g_cmap), HASH_SIZE);
+
+	interval.tv_sec = (time_t)opt_watch;
+	interval.tv_nsec = (opt_watch - interval.tv_sec) * 1e9;
+	signal(SIGINT, watch_sigint);
+
+	printf("%8s %6s %10s %8s %8s %8s %8s |", "time", "tasks", "pages",
+	       "new", "gone", "moved", "scan ms");
+	for (i = 0; i < nr_colors; i++)
+		printf(" %8d", i);
+	printf("\n");
+
+	start = watch_now();
+	while (!watch_stop) {
+		watch_new = watch_gone = watch_moved = 0;
+		t0 = watch_now();
+		pages = watch_walk();
+		t1 = watch_now();
+
+		printf("%8.2f %6d %10lu %8lu %8lu %8lu %8.1f |", t0 - start,
+		       nr_watch_tasks, pages, watch_new, watch_gone,
+		       watch_moved, (t1 - t0) * 1e3);
+		for (i = 0; i < nr_colors; i++)
+			printf(" %8ld", watch_count[i]);
+		printf("\n");
+
+		/* per-color drift since the previous interval */
+		if (round++ &&
+		    memcmp(watch_prev, watch_count, sizeof(watch_count))) {
+			printf("%64s", "|");
+			for (i = 0; i < nr_colors; i++)
+				printf(" %+8ld", watch_count[i] - watch_prev[i]);
+			printf("\n");
+		}
+		memcpy(watch_prev, watch_count, sizeof(watch_count));
+		fflush(stdout);
+
+		nanosleep(&interval, NULL);
+	}
+}
+
 static void walk_addr_ranges(void)
 {
 	int i;
@@ -795,13 +2161,38 @@ static void walk_addr_ranges(void)
 	if (!nr_addr_ranges)
 		add_addr_range(0, ULONG_MAX);
 
-	for (i = 0; i < nr_addr_ranges; i++)
+	read_zoneinfo();
+	if (opt_capacity) {
+		if (opt_pid || opt_cgroup)
+			fatal("-C works on physical memory only, not with -p/-g\n");
+		nr_colors = min_t(int, cmap_nr_colors(&g_cmap), HASH_SIZE);
+		buddy_tails = kernel_flags_buddy_tails();
+		alloc_capacity(&main_ctx);
+	}
+	if (opt_owners) {
+		kpagecount_fd = checked_open(PROC_KPAGECOUNT, O_RDONLY);
+		kpagecgroup_fd = checked_open(PROC_KPAGECGROUP, O_RDONLY);
+		nr_colors = min_t(int, cmap_nr_colors(&g_cmap), HASH_SIZE);
+		alloc_owners(&main_ctx);
+	}
+
+	if (opt_cgroup)
+		walk_cgroup();
+
+	for (i = 0; i < nr_addr_ranges && !opt_cgroup; i++) {
 		if (!opt_pid)
-			walk_pfn(0, opt_offset[i], opt_size[i]);
+			walk_pfn_parallel(opt_offset[i], opt_size[i]);
 		else
 			walk_task(opt_offset[i], opt_size[i]);
+		if (main_ctx.free_count)
+			end_free_block(&main_ctx);
+	}
 
 	close(kpageflags_fd);
+	if (opt_owners) {
+		close(kpagecount_fd);
+		close(kpagecgroup_fd);
+	}
 }
 
 
@@ -828,12 +2219,29 @@ static void usage(void)
 "            -a|--addr    addr-spec    Walk a range of pages\n"
 "            -b|--bits    bits-spec    Walk pages with specified bits\n"
 "            -p|--pid     pid          Walk process address space\n"
+"            -g|--cgroup  path         Walk the address spaces of a cgroup's\n"
+"                                      processes, counting shared pages once\n"
+"            -k|--mask    mask         Color by the physical address bits of mask\n"
+"                                      (PALLOC palloc_mask), instead of -f\n"
 #if 0 /* planned features */
 "            -f|--file    filename     Walk file address space\n"
 #endif
 "            -l|--list                 Show page details in ranges\n"
 "            -L|--list-each            Show page details one by one\n"
 "            -N|--no-summary           Don't show summay info\n"
+"            -F|--format  text|csv|json|bin\n"
+"                                      Listing and summary format. csv, json\n"
+"                                      (one object per line) and bin (see\n"
+"                                      pagetype-rec.h) carry type, vpn, pfn,\n"
+"                                      count, flags and color per row\n"
+"            -t|--threads num          Threads for the physical memory scan\n"
+"                                      (default: number of online CPUs)\n"
+"            -C|--capacity             Show free/used/huge/slab pages per color,\n"
+"                                      per node and per zone\n"
+"            -O|--owners               Show anon/file/ksm pages, map counts and\n"
+"                                      owning memory cgroups per color\n"
+"            -w|--watch   seconds      Re-walk the -p/-g tasks every interval and\n"
+"                                      show how the per-color counts drift\n"
 "            -X|--hwpoison             hwpoison pages\n"
 "            -x|--unpoison             unpoison pages\n"
 "            -h|--help                 Show this usage message\n"
@@ -879,87 +2287,87 @@ static unsigned long long parse_number(const char *str)
 
 static void parse_pid(const char *str)
 {
-	FILE *file;
-	char buf[5000];
-
 	opt_pid = parse_number(str);
 
-	sprintf(buf, "/proc/%d/pagemap", opt_pid);
-	pagemap_fd = checked_open(buf, O_RDONLY);
-
-	sprintf(buf, "/proc/%d/maps", opt_pid);
-	file = fopen(buf, "r");
-	if (!file) {
-		perror(buf);
+	if (load_task(opt_pid) < 0)
 		exit(EXIT_FAILURE);
-	}
+}
 
-	while (fgets(buf, sizeof(buf), file) != NULL) {
-		unsigned long vm_start;
-		unsigned long vm_end;
-		unsigned long long pgoff;
-		int major, minor;
-		char r, w, x, s;
-		unsigned long ino;
-		int n;
+/* the per-color tallies are HASH_SIZE long */
+static void check_color_map(void)
+{
+	if (g_cmap.nr_funcs > HASH_SHIFT)
+		fatal("%d color functions, at most %d are supported\n",
+		      g_cmap.nr_funcs, HASH_SHIFT);
+}
 
-		n = sscanf(buf, "%lx-%lx %c%c%c%c %llx %x:%x %lu",
-			   &vm_start,
-			   &vm_end,
-			   &r, &w, &x, &s,
-			   &pgoff,
-			   &major, &minor,
-			   &ino);
-		if (n < 10) {
-			fprintf(stderr, "unexpected line: %s\n", buf);
-			continue;
-		}
-		pg_start[nr_vmas] = vm_start / page_size;
-		pg_end[nr_vmas] = vm_end / page_size;
-		if (++nr_vmas >= MAX_VMAS) {
-			fprintf(stderr, "too many VMAs\n");
-			break;
+/* -k: one color bit per set bit of a physical address mask (PALLOC style) */
+static void parse_color_mask(const char *str)
+{
+	uint64_t mask = parse_number(str);
+
+	cmap_from_mask(&g_cmap, mask & ~((1ULL << PAGE_SHIFT) - 1));
+	cmap_shift(&g_cmap, PAGE_SHIFT);
+	check_color_map();
+}
+
+static void parse_format(const char *str)
+{
+	static const char * const names[] = {
+		[FMT_TEXT] = "text",
+		[FMT_CSV]  = "csv",
+		[FMT_JSON] = "json",
+		[FMT_BIN]  = "bin",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		if (!strcmp(str, names[i])) {
+			opt_format = i;
+			return;
 		}
-	}
+	fatal("unknown output format: %s\n", str);
+}
+
+/* without -f/-k, color a cgroup's pages the way PALLOC does */
+static void read_palloc_mask(void)
+{
+	char buf[64];
+	FILE *file;
+
+	file = fopen(PALLOC_MASK, "r");
+	if (!file)
+		return;
+	if (fgets(buf, sizeof(buf), file))
+		parse_color_mask(buf);
 	fclose(file);
 }
 
 static void parse_map_file(const char *filename)
 {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open map file %s\n", filename);
-        exit(1);
-    }
-
-    char line[256];
-    int function_index = 0;
-
-    while (fgets(line, sizeof(line), fp)) {
-        // Skip empty lines and comments
-        if (line[0] == '\n' || line[0] == '#') continue;
-        char* token = strtok(line, " \t\n");
-        int bit_index = 0;
-        while (token != NULL && bit_index < MAX_BITS_PER_FUNCTION) {
-            g_bank_functions[function_index] |= (1 << atoi(token));
-            token = strtok(NULL, " \t\n");
-            bit_index++;
-        }
-        function_index++;
-        if (function_index >= MAX_BANK_FUNCTIONS) break;
-    }
-	g_bank_function_cnt = function_index;
-    fclose(fp);
-	// Print loaded bank mapping functions
-	printf("Loaded %d bank mapping functions:\n", g_bank_function_cnt);
-	for (int i = 0; i < g_bank_function_cnt; i++) {
-		int bit_index;
-		printf("Function %u: XOR bits ", i);
-		for_each_set_bit(bit_index, &g_bank_functions[i], BITS_PER_LONG) {
-			printf("%d ", bit_index);
-		}
-		printf("\n");
+	unsigned long mask;
+	int i, bit;
+
+	if (cmap_load(&g_cmap, filename) < 0) {
+		fprintf(stderr, "%s\n", cmap_strerror());
+		exit(1);
 	}
+
+	/* to stderr: stdout may be a -F bin stream */
+	fprintf(stderr, "Loaded %d bank mapping functions:\n", g_cmap.nr_funcs);
+	for (i = 0; i < g_cmap.nr_funcs; i++) {
+		mask = g_cmap.mask[i];
+		fprintf(stderr, "Function %u (%s): XOR bits ", i,
+			cmap_group_names[g_cmap.group[i]]);
+		for_each_set_bit(bit, &mask, BITS_PER_LONG)
+			fprintf(stderr, "%d ", bit);
+		fprintf(stderr, "\n");
+		if (mask & ((1UL << PAGE_SHIFT) - 1))
+			fprintf(stderr, "Function %u: bits below %d ignored\n",
+				i, PAGE_SHIFT);
+	}
+	cmap_shift(&g_cmap, PAGE_SHIFT);
+	check_color_map();
 }
 
 static void parse_addr_range(const char *optarg)
@@ -1073,12 +2481,19 @@ static void parse_bits_mask(const char *optarg)
 static struct option opts[] = {
 	{ "raw"       , 0, NULL, 'r' },
 	{ "pid"       , 1, NULL, 'p' },
+	{ "cgroup"    , 1, NULL, 'g' },
+	{ "mask"      , 1, NULL, 'k' },
 	{ "file"      , 1, NULL, 'f' },
 	{ "addr"      , 1, NULL, 'a' },
 	{ "bits"      , 1, NULL, 'b' },
 	{ "list"      , 0, NULL, 'l' },
 	{ "list-each" , 0, NULL, 'L' },
 	{ "no-summary", 0, NULL, 'N' },
+	{ "threads"   , 1, NULL, 't' },
+	{ "capacity"  , 0, NULL, 'C' },
+	{ "owners"    , 0, NULL, 'O' },
+	{ "watch"     , 1, NULL, 'w' },
+	{ "format"    , 1, NULL, 'F' },
 	{ "hwpoison"  , 0, NULL, 'X' },
 	{ "unpoison"  , 0, NULL, 'x' },
 	{ "help"      , 0, NULL, 'h' },
@@ -1090,9 +2505,10 @@ int main(int argc, char *argv[])
 	int c;
 
 	page_size = getpagesize();
+	main_ctx.out = stdout;
 
 	while ((c = getopt_long(argc, argv,
-				"rp:f:a:b:lLNXxh", opts, NULL)) != -1) {
+				"rp:g:k:f:a:b:lLNF:t:COw:Xxh", opts, NULL)) != -1) {
 		switch (c) {
 		case 'r':
 			opt_raw = 1;
@@ -1100,6 +2516,12 @@ int main(int argc, char *argv[])
 		case 'p':
 			parse_pid(optarg);
 			break;
+		case 'g':
+			opt_cgroup = optarg;
+			break;
+		case 'k':
+			parse_color_mask(optarg);
+			break;
 		case 'f':
 			parse_map_file(optarg);
 			break;
@@ -1118,6 +2540,23 @@ int main(int argc, char *argv[])
 		case 'N':
 			opt_no_summary = 1;
 			break;
+		case 'F':
+			parse_format(optarg);
+			break;
+		case 't':
+			opt_threads = parse_number(optarg);
+			break;
+		case 'C':
+			opt_capacity = 1;
+			break;
+		case 'O':
+			opt_owners = 1;
+			break;
+		case 'w':
+			opt_watch = strtod(optarg, NULL);
+			if (opt_watch <= 0)
+				fatal("invalid watch interval: %s\n", optarg);
+			break;
 		case 'X':
 			opt_hwpoison = 1;
 			prepare_hwpoison_fd();
@@ -1135,25 +2574,51 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (opt_list && opt_pid)
-		printf("voffset\t");
-	if (opt_list == 1)
-		printf("offset\tlen\tflags\n");
-	if (opt_list == 2)
-		printf("offset\tflags\n");
+	if ((opt_cgroup || opt_watch) && !g_cmap.nr_funcs)
+		read_palloc_mask();
+
+	if (opt_watch) {
+		if (opt_capacity || opt_owners || opt_list || opt_format)
+			fatal("-w can't be combined with -C/-O/-l/-L/-F\n");
+		watch_loop();
+		return 0;
+	}
+
+	/* listings can run to millions of lines */
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+	if (opt_format) {
+		if (opt_capacity || opt_owners)
+			fatal("-C and -O have text output only\n");
+		emit_header();
+	} else {
+		if (opt_list && opt_pid)
+			printf("voffset\t");
+		if (opt_list == 1)
+			printf("offset\tlen\tflags\n");
+		if (opt_list == 2)
+			printf("offset\tflags\n");
+	}
 
 	walk_addr_ranges();
 
 	if (opt_list == 1)
-		show_page_range(0, 0, 0);  /* drain the buffer */
+		show_page_range(&main_ctx, 0, 0, 0, 0);  /* drain the buffer */
 
-	if (opt_no_summary)
-		return 0;
+	if (!opt_no_summary) {
+		if (opt_list && !opt_format)
+			printf("\n\n");
+		show_summary();
+	}
+
+	if (opt_capacity)
+		show_capacity();
 
-	if (opt_list)
-		printf("\n\n");
+	if (opt_owners)
+		show_owners();
 
-	show_summary();
+	if (opt_cgroup && !opt_format)
+		show_cgroup_summary();
 
 	return 0;
 }
@@ -0,0 +1,1478 @@
+/**
+ * pallocsim: PALLOC allocator simulator
+ *
+ * The PALLOC color allocator of patches/palloc-3.15.patch, ported to user
+ * space over a modeled buddy allocator, to evaluate it without booting a
+ * patched kernel. palloc_insert(), palloc_flush(), palloc_find_cmap()
+ * (alloc_balance, per-CPU palloc_rand_seed) and the PALLOC
+ * __rmqueue_smallest() follow the patch; the zone is one of MAX_ORDER
+ * buddy free lists of a single migratetype, and the page allocator around
+ * __rmqueue_smallest() is reduced to a fallback to any free page when no
+ * page of the cgroup's colors is left (what stealing from another
+ * migratetype does to colors), or to a failure with -F none.
+ *
+ * An allocation trace is replayed, or a synthetic one run, and the
+ * report has the allocation latency and search effort (as palloc's
+ * debugfs control file shows them), fallbacks out of the color set, the
+ * pages each cgroup got per color, and the zone's fragmentation.
+ *
+ * -A pcp swaps the allocator for a redesign of the color path: each CPU
+ * keeps per-color free lists, refilled in batches from the zone's color
+ * lists (and the buddy) and drained in batches back into the buddy, under
+ * the zone lock only then. When neither the CPU's cache nor the zone has
+ * a page of the cgroup's colors, the other CPUs' caches of those colors
+ * are drained first, as drain_all_pages() does, before falling back.
+ * The color is picked in constant time, by a round-robin cursor per
+ * cgroup, with rank/select over the bitmap of the CPU's non-empty colors:
+ * popcounts per word, then pdep within the word.
+ * -j runs the synthetic workload as an allocation storm on that many
+ * threads, one per CPU and cgroup, against the zone lock, to compare both.
+ *
+ * Trace format, one operation per line, '#' comments:
+ *	cgroup <cg> <bins>		cgroup cg may use bins, e.g. 0-3,8.
+ *					none or empty: all bins
+ *	alloc <id> <cg> <cpu> <order>	allocation id, by cpu for cgroup cg
+ *	free <id>
+ *	flush				palloc_flush(), as the control file
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "list.h"
+#include "colormap.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define MAX_ORDER		11
+#define MAX_PALLOC_BITS		8
+#define MAX_PALLOC_BINS		(1 << MAX_PALLOC_BITS)
+#define BITMAP_WORDS		(MAX_PALLOC_BINS / 64)
+#define MAX_CGROUPS		64
+#define MAX_CPUS		256
+#define PAGE_SHIFT		12
+#define BALANCE_TIMEOUT_NS	1000000	/* palloc_find_cmap()'s 1ms */
+
+#define DEFAULT_MEM_MB		1024
+#define DEFAULT_PALLOC_MASK	0xC000	/* scripts/functions: bank bits 14,15 */
+#define DEFAULT_UTIL		80
+#define DEFAULT_HIGH_ORDER	10
+
+#define PCP_BATCH		16	/* pages per color per refill/drain */
+#define PCP_HIGH		(4 * PCP_BATCH)	/* per color, drain above */
+
+#define for_each_set_bit(bit, map) \
+	for ((bit) = 0; (bit) < MAX_PALLOC_BINS; (bit)++) \
+		if (bitmap_test((map), (bit)))
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+typedef uint64_t color_bitmap_t[BITMAP_WORDS];
+
+struct page {
+	struct list_head lru;
+	int8_t		order;		/* buddy order, -1: not in the buddy */
+	uint8_t		cached;		/* on a color_list */
+	uint16_t	color;
+};
+
+struct free_area {
+	struct list_head free_list;
+	unsigned long	nr_free;
+};
+
+struct zone {
+	struct page	*pages;
+	unsigned long	nr_pages;
+	unsigned long	start_pfn;
+	struct free_area free_area[MAX_ORDER];
+	struct list_head color_list[MAX_PALLOC_BINS];
+	color_bitmap_t	color_bitmap;
+	unsigned long	nr_cached;	/* pages on color lists */
+};
+
+/* palloc_stat, as the patch keeps it */
+struct palloc_stat {
+	int64_t		max_ns;
+	int64_t		min_ns;
+	int64_t		tot_ns;
+	int64_t		tot_cnt;
+	int64_t		iter_cnt;
+	int64_t		cache_hit_cnt;
+	int64_t		cache_acc_cnt;
+	int64_t		flush_cnt;
+	int64_t		alloc_balance;
+	int64_t		alloc_balance_timeout;
+	int64_t		start;
+};
+
+struct cgroup {
+	int		id;
+	int		used;
+	color_bitmap_t	cmap;		/* palloc.bins, empty: all */
+	uint64_t	pages[MAX_PALLOC_BINS];	/* allocated, per color */
+	uint64_t	nr_allocs;
+	uint64_t	nr_fallback;	/* allocations outside cmap */
+	uint64_t	nr_failed;
+};
+
+struct alloc {
+	long		page;		/* index in zone->pages, -1: free */
+	int		order;
+	int		cg;
+	int		cpu;
+};
+
+/*
+ * -A pcp: a CPU's color cache, only touched by that CPU but for drains
+ * from others. lock stands in for local_irq_save() and the drain IPI:
+ * the owner takes it first, then the zone lock
+ */
+struct pcp {
+	pthread_spinlock_t lock;
+	struct list_head list[MAX_PALLOC_BINS];
+	int		count[MAX_PALLOC_BINS];
+	color_bitmap_t	nonempty;
+	unsigned int	cursor[MAX_CGROUPS];	/* round-robin, per cgroup */
+	uint64_t	hits;
+	uint64_t	refills;
+	uint64_t	drains;
+	uint64_t	drained;	/* pages taken from other CPUs' caches */
+} __attribute__((aligned(64)));
+
+/* -j: a storm thread, a CPU allocating for one cgroup */
+struct storm {
+	pthread_t	thread;
+	int		cpu;
+	long		nr_ops;
+	long		target;		/* live pages */
+	int		high;
+	struct cgroup	cg;		/* its share of the cgroup's stats */
+	uint64_t	hist[32];
+};
+
+enum strategy { STRATEGY_SEED, STRATEGY_FIRST, STRATEGY_LEAST, NR_STRATEGIES };
+enum fallback { FALLBACK_ANY, FALLBACK_NONE };
+enum allocator { ALLOCATOR_PALLOC, ALLOCATOR_PCP, NR_ALLOCATORS };
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static const char * const strategy_names[NR_STRATEGIES] = {
+	"seed", "first", "least",
+};
+static const char * const allocator_names[NR_ALLOCATORS] = {
+	"palloc", "pcp",
+};
+
+static struct zone g_zone;
+static struct colormap g_cmap;
+static int g_nr_bins;
+static int use_palloc = 1;
+static int sysctl_alloc_balance;
+static enum strategy g_strategy = STRATEGY_SEED;
+static enum fallback g_fallback = FALLBACK_ANY;
+static enum allocator g_allocator = ALLOCATOR_PALLOC;
+static pthread_mutex_t g_zone_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pcp *g_pcp;		/* MAX_CPUS, -A pcp */
+
+static unsigned long palloc_rand_seed[MAX_CPUS];
+static struct palloc_stat g_stat[3];	/* 0 - color, 1 - normal, 2 - fail */
+static struct cgroup g_cgroups[MAX_CGROUPS];
+
+static struct alloc *g_allocs;
+static long g_nr_allocs;		/* slots in g_allocs */
+static uint64_t g_ops;
+static uint64_t g_latency_hist[32];	/* log2(ns) buckets, all allocations */
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fatal(const char *msg)
+{
+	fprintf(stderr, "pallocsim: %s\n", msg);
+	exit(1);
+}
+
+static inline int bitmap_test(const color_bitmap_t map, int bit)
+{
+	return !!(map[bit / 64] & (1ULL << (bit % 64)));
+}
+
+static inline void bitmap_set(color_bitmap_t map, int bit)
+{
+	map[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static inline void bitmap_clear(color_bitmap_t map, int bit)
+{
+	map[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+static inline int bitmap_weight(const color_bitmap_t map)
+{
+	int i, w = 0;
+
+	for (i = 0; i < BITMAP_WORDS; i++)
+		w += __builtin_popcountll(map[i]);
+	return w;
+}
+
+static inline int bitmap_and(color_bitmap_t dst, const color_bitmap_t a,
+			     const color_bitmap_t b)
+{
+	uint64_t any = 0;
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS; i++)
+		any |= dst[i] = a[i] & b[i];
+	return !!any;
+}
+
+static inline void bitmap_fill_bins(color_bitmap_t map)
+{
+	int c;
+
+	memset(map, 0, sizeof(color_bitmap_t));
+	for (c = 0; c < g_nr_bins; c++)
+		bitmap_set(map, c);
+}
+
+/* the idx-th set bit of x */
+static inline int select64(uint64_t x, unsigned int idx)
+{
+#ifdef __BMI2__
+	return __builtin_ctzll(_pdep_u64(1ULL << idx, x));
+#else
+	while (idx--)
+		x &= x - 1;
+	return __builtin_ctzll(x);
+#endif
+}
+
+/* the idx-th set bit of map: rank by word popcounts, then select in one */
+static inline int bitmap_select(const color_bitmap_t map, unsigned int idx)
+{
+	unsigned int w;
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS; i++) {
+		w = __builtin_popcountll(map[i]);
+		if (idx < w)
+			return i * 64 + select64(map[i], idx);
+		idx -= w;
+	}
+	return -1;
+}
+
+/* "0-3,8", as bitmap_parselist() */
+static int parse_bins(const char *list, color_bitmap_t map)
+{
+	const char *p = list;
+	char *end;
+	long first, last;
+
+	memset(map, 0, sizeof(color_bitmap_t));
+	while (*p && *p != '\n') {
+		first = last = strtol(p, &end, 0);
+		if (end == p)
+			return -1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 0);
+			if (end == p)
+				return -1;
+		}
+		if (first < 0 || last >= g_nr_bins || first > last)
+			return -1;
+		for (; first <= last; first++)
+			bitmap_set(map, first);
+		if (*end && *end != ',' && *end != '\n')
+			return -1;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return 0;
+}
+
+/**************************************************************************
+ * Buddy allocator
+ **************************************************************************/
+static inline void set_page_order(struct page *page, int order)
+{
+	page->order = order;
+}
+
+static inline void rmv_page_order(struct page *page)
+{
+	page->order = -1;
+}
+
+static void __free_one_page(struct page *page, int order)
+{
+	struct zone *zone = &g_zone;
+	unsigned long idx = page - zone->pages, buddy_idx;
+	struct page *buddy;
+
+	while (order < MAX_ORDER - 1) {
+		buddy_idx = idx ^ (1UL << order);
+		if (buddy_idx >= zone->nr_pages)
+			break;
+		buddy = &zone->pages[buddy_idx];
+		if (buddy->order != order)
+			break;
+		list_del(&buddy->lru);
+		zone->free_area[order].nr_free--;
+		rmv_page_order(buddy);
+		idx &= buddy_idx;
+		order++;
+	}
+	page = &zone->pages[idx];
+	set_page_order(page, order);
+	list_add(&page->lru, &zone->free_area[order].free_list);
+	zone->free_area[order].nr_free++;
+}
+
+static void expand(struct page *page, int low, int high)
+{
+	struct zone *zone = &g_zone;
+	unsigned long size = 1UL << high;
+
+	while (high > low) {
+		high--;
+		size >>= 1;
+		list_add(&page[size].lru, &zone->free_area[high].free_list);
+		zone->free_area[high].nr_free++;
+		set_page_order(&page[size], high);
+	}
+}
+
+/**************************************************************************
+ * PALLOC, after mm/page_alloc.c of the patch
+ **************************************************************************/
+
+/* move all color_list pages into the buddy */
+static void palloc_flush(void)
+{
+	struct zone *zone = &g_zone;
+	struct page *page;
+	int c;
+
+	for (c = 0; c < MAX_PALLOC_BINS; c++) {
+		while (!list_empty(&zone->color_list[c])) {
+			page = list_entry(zone->color_list[c].next,
+					  struct page, lru);
+			list_del_init(&page->lru);
+			page->cached = 0;
+			zone->nr_cached--;
+			zone->free_area[0].nr_free--;
+			__free_one_page(page, 0);
+		}
+		bitmap_clear(zone->color_bitmap, c);
+	}
+	g_stat[0].flush_cnt++;
+}
+
+/* move a page (size=1<<order) into the order-0 colored cache */
+static void palloc_insert(struct page *page, int order)
+{
+	struct zone *zone = &g_zone;
+	int i, color;
+
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+
+	for (i = 0; i < (1 << order); i++) {
+		color = page[i].color;
+		INIT_LIST_HEAD(&page[i].lru);
+		list_add_tail(&page[i].lru, &zone->color_list[color]);
+		bitmap_set(zone->color_bitmap, color);
+		zone->free_area[0].nr_free++;
+		rmv_page_order(&page[i]);
+		page[i].cached = 1;
+		zone->nr_cached++;
+	}
+}
+
+/* the candidate color to take, of the found_w in tmpmask */
+static int palloc_pick(struct cgroup *cg, color_bitmap_t tmpmask,
+		       int found_w, unsigned long rand_seed)
+{
+	unsigned int tmp_idx;
+	int c, best = -1;
+
+	switch (g_strategy) {
+	case STRATEGY_FIRST:
+		for_each_set_bit(c, tmpmask)
+			return c;
+		break;
+	case STRATEGY_LEAST:
+		/* the color the cgroup has the fewest pages of */
+		for_each_set_bit(c, tmpmask)
+			if (best < 0 || cg->pages[c] < cg->pages[best])
+				best = c;
+		return best;
+	case STRATEGY_SEED:
+	default:
+		break;
+	}
+
+	tmp_idx = rand_seed % found_w;
+	for_each_set_bit(c, tmpmask) {
+		if (tmp_idx-- <= 0)
+			break;
+	}
+	return c;
+}
+
+/* return a colored page (order-0) and remove it from the colored cache */
+static struct page *palloc_find_cmap(struct cgroup *cg, color_bitmap_t cmap,
+				     int order, int cpu,
+				     struct palloc_stat *stat)
+{
+	struct zone *zone = &g_zone;
+	struct page *page;
+	color_bitmap_t tmpmask;
+	int c, found_w, want_w;
+	unsigned long rand_seed;
+
+	stat->cache_acc_cnt++;
+
+	if (!bitmap_and(tmpmask, zone->color_bitmap, cmap))
+		return NULL;
+
+	/* must have a balance. */
+	found_w = bitmap_weight(tmpmask);
+	want_w = bitmap_weight(cmap);
+	if (sysctl_alloc_balance && found_w < want_w &&
+	    found_w < (sysctl_alloc_balance < want_w ?
+		       sysctl_alloc_balance : want_w)) {
+		if (now_ns() - stat->start < BALANCE_TIMEOUT_NS) {
+			/* try to balance unless 1ms has passed */
+			stat->alloc_balance++;
+			return NULL;
+		}
+		stat->alloc_balance_timeout++;
+	}
+
+	/* choose a bit among the candidates */
+	if (sysctl_alloc_balance) {
+		rand_seed = (unsigned long)stat->start;
+	} else {
+		rand_seed = palloc_rand_seed[cpu]++;
+		if (rand_seed > MAX_PALLOC_BINS)
+			palloc_rand_seed[cpu] = 0;
+	}
+	c = palloc_pick(cg, tmpmask, found_w, rand_seed);
+
+	page = list_entry(zone->color_list[c].next, struct page, lru);
+	list_del(&page->lru);
+	page->cached = 0;
+	zone->nr_cached--;
+	if (list_empty(&zone->color_list[c]))
+		bitmap_clear(zone->color_bitmap, c);
+	zone->free_area[0].nr_free--;
+
+	stat->cache_hit_cnt++;
+	return page;
+}
+
+static void update_stat(struct palloc_stat *stat, int iters)
+{
+	int64_t dur = now_ns() - stat->start;
+
+	if (dur < stat->min_ns)
+		stat->min_ns = dur;
+	if (dur > stat->max_ns)
+		stat->max_ns = dur;
+	stat->tot_ns += dur;
+	stat->iter_cnt += iters;
+	stat->tot_cnt++;
+}
+
+static struct page *__rmqueue_smallest(struct cgroup *cg, int order, int cpu)
+{
+	struct zone *zone = &g_zone;
+	struct palloc_stat *c_stat = &g_stat[0], *n_stat = &g_stat[1];
+	struct list_head *curr, *tmp;
+	struct free_area *area;
+	struct page *page;
+	color_bitmap_t tmpcmap;
+	uint64_t *cmap;
+	int current_order, iters = 0;
+
+	c_stat->start = n_stat->start = g_stat[2].start = now_ns();
+
+	if (!use_palloc)
+		goto normal_buddy_alloc;
+
+	if (bitmap_weight(cg->cmap) > 0) {
+		cmap = cg->cmap;
+	} else {
+		bitmap_fill_bins(tmpcmap);
+		cmap = tmpcmap;
+	}
+
+	if (order == 0) {
+		/* find in the cache */
+		page = palloc_find_cmap(cg, cmap, 0, cpu, c_stat);
+		if (page) {
+			update_stat(c_stat, iters);
+			return page;
+		}
+
+		/* search the entire list. make color cache in the process */
+		iters++;
+		for (current_order = 0; current_order < MAX_ORDER;
+		     ++current_order) {
+			area = &zone->free_area[current_order];
+			list_for_each_safe(curr, tmp, &area->free_list) {
+				iters++;
+				page = list_entry(curr, struct page, lru);
+				palloc_insert(page, current_order);
+				page = palloc_find_cmap(cg, cmap, current_order,
+							cpu, c_stat);
+				if (page) {
+					update_stat(c_stat, iters);
+					return page;
+				}
+			}
+		}
+		return NULL;
+	}
+
+normal_buddy_alloc:
+	for (current_order = order; current_order < MAX_ORDER;
+	     ++current_order) {
+		area = &zone->free_area[current_order];
+		iters++;
+		if (list_empty(&area->free_list))
+			continue;
+		page = list_entry(area->free_list.next, struct page, lru);
+		list_del(&page->lru);
+		rmv_page_order(page);
+		area->nr_free--;
+		expand(page, order, current_order);
+		update_stat(n_stat, iters);
+		return page;
+	}
+	return NULL;
+}
+
+/* any page of the color cache, NULL if it is empty */
+static struct page *rmqueue_fallback(void)
+{
+	struct zone *zone = &g_zone;
+	struct page *page;
+	int c;
+
+	if (!zone->nr_cached)
+		return NULL;
+	for (c = 0; c < MAX_PALLOC_BINS; c++)
+		if (!list_empty(&zone->color_list[c]))
+			break;
+	page = list_entry(zone->color_list[c].next, struct page, lru);
+	list_del(&page->lru);
+	page->cached = 0;
+	zone->nr_cached--;
+	if (list_empty(&zone->color_list[c]))
+		bitmap_clear(zone->color_bitmap, c);
+	zone->free_area[0].nr_free--;
+	return page;
+}
+
+/*
+ * __rmqueue(): __rmqueue_smallest(), then, for an order-0 page, any page
+ * of the color cache when fallbacks are allowed
+ */
+static struct page *__rmqueue(struct cgroup *cg, int order, int cpu,
+			      int *fallback)
+{
+	struct page *page;
+
+	*fallback = 0;
+	page = __rmqueue_smallest(cg, order, cpu);
+	if (!page && g_fallback == FALLBACK_ANY && !order) {
+		page = rmqueue_fallback();
+		*fallback = !!page;
+	}
+	if (!page)
+		update_stat(&g_stat[2], 0);
+	return page;
+}
+
+/**************************************************************************
+ * Per-CPU color caches (-A pcp)
+ **************************************************************************/
+
+/*
+ * move up to PCP_BATCH pages of each color of cmap from the zone's color
+ * lists to pcp, breaking buddy blocks into the color lists, smallest
+ * first as palloc does, until one of the colors has a page. zone lock held
+ */
+static int pcp_refill(struct pcp *pcp, const color_bitmap_t cmap)
+{
+	struct zone *zone = &g_zone;
+	struct page *page;
+	int c, n, order, got = 0;
+
+	pcp->refills++;
+	for (;;) {
+		for_each_set_bit(c, cmap) {
+			if (!bitmap_test(zone->color_bitmap, c))
+				continue;
+			for (n = 0; n < PCP_BATCH &&
+				    !list_empty(&zone->color_list[c]); n++) {
+				page = list_entry(zone->color_list[c].next,
+						  struct page, lru);
+				list_move(&page->lru, &pcp->list[c]);
+				page->cached = 0;
+			}
+			if (list_empty(&zone->color_list[c]))
+				bitmap_clear(zone->color_bitmap, c);
+			zone->nr_cached -= n;
+			zone->free_area[0].nr_free -= n;
+			pcp->count[c] += n;
+			bitmap_set(pcp->nonempty, c);
+			got += n;
+		}
+		if (got)
+			return got;
+
+		for (order = 0; order < MAX_ORDER; order++)
+			if (!list_empty(&zone->free_area[order].free_list))
+				break;
+		if (order == MAX_ORDER)
+			return 0;
+		palloc_insert(list_entry(zone->free_area[order].free_list.next,
+					 struct page, lru), order);
+	}
+}
+
+/*
+ * return the pages of cmap's colors in the other CPUs' caches to the
+ * buddy, as drain_all_pages(). zone lock held: a CPU busy with its own
+ * cache, holding its lock, is skipped rather than waited for
+ */
+static void pcp_drain_others(struct pcp *pcp, const color_bitmap_t cmap)
+{
+	struct pcp *other;
+	struct page *page;
+	color_bitmap_t tmp;
+	int cpu, c;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		other = &g_pcp[cpu];
+		if (other == pcp || !bitmap_and(tmp, other->nonempty, cmap))
+			continue;
+		if (pthread_spin_trylock(&other->lock))
+			continue;
+		bitmap_and(tmp, other->nonempty, cmap);
+		for_each_set_bit(c, tmp) {
+			while (!list_empty(&other->list[c])) {
+				page = list_entry(other->list[c].next,
+						  struct page, lru);
+				list_del(&page->lru);
+				__free_one_page(page, 0);
+				pcp->drained++;
+			}
+			other->count[c] = 0;
+			bitmap_clear(other->nonempty, c);
+		}
+		pthread_spin_unlock(&other->lock);
+	}
+}
+
+static struct page *pcp_take(struct pcp *pcp, int c)
+{
+	struct page *page;
+
+	page = list_entry(pcp->list[c].next, struct page, lru);
+	list_del(&page->lru);
+	if (!--pcp->count[c])
+		bitmap_clear(pcp->nonempty, c);
+	return page;
+}
+
+/* an order-0 page of cg's colors from the CPU's cache, O(1) but refills */
+static struct page *pcp_alloc(struct cgroup *cg, int cpu, int *fallback)
+{
+	struct pcp *pcp = &g_pcp[cpu];
+	struct page *page;
+	color_bitmap_t all, tmp;
+	const uint64_t *cmap = cg->cmap;
+	int c, w;
+
+	*fallback = 0;
+	if (!use_palloc || !bitmap_weight(cmap)) {
+		bitmap_fill_bins(all);
+		cmap = all;
+	}
+
+	pthread_spin_lock(&pcp->lock);
+	if (!bitmap_and(tmp, pcp->nonempty, cmap)) {
+		pthread_mutex_lock(&g_zone_lock);
+		if (!pcp_refill(pcp, cmap)) {
+			pcp_drain_others(pcp, cmap);
+			pcp_refill(pcp, cmap);
+		}
+		if (!bitmap_and(tmp, pcp->nonempty, cmap)) {
+			/* out of the colors: any page, ours first */
+			page = NULL;
+			if (g_fallback == FALLBACK_ANY) {
+				c = bitmap_select(pcp->nonempty, 0);
+				page = c >= 0 ? pcp_take(pcp, c)
+					      : rmqueue_fallback();
+				*fallback = !!page;
+			}
+			if (!page)
+				g_stat[2].tot_cnt++;
+			pthread_mutex_unlock(&g_zone_lock);
+			pthread_spin_unlock(&pcp->lock);
+			return page;
+		}
+		pthread_mutex_unlock(&g_zone_lock);
+	} else {
+		pcp->hits++;
+	}
+
+	w = bitmap_weight(tmp);
+	page = pcp_take(pcp, bitmap_select(tmp, pcp->cursor[cg->id]++ % w));
+	pthread_spin_unlock(&pcp->lock);
+	return page;
+}
+
+/* back to the CPU's cache; above PCP_HIGH, PCP_BATCH of the color to the buddy */
+static void pcp_free(struct page *page, int cpu)
+{
+	struct pcp *pcp = &g_pcp[cpu];
+	int c = page->color, n;
+
+	pthread_spin_lock(&pcp->lock);
+	list_add(&page->lru, &pcp->list[c]);
+	bitmap_set(pcp->nonempty, c);
+	if (++pcp->count[c] <= PCP_HIGH) {
+		pthread_spin_unlock(&pcp->lock);
+		return;
+	}
+
+	pcp->drains++;
+	pthread_mutex_lock(&g_zone_lock);
+	for (n = 0; n < PCP_BATCH; n++) {
+		/* the coldest pages, at the tail */
+		page = list_entry(pcp->list[c].prev, struct page, lru);
+		list_del(&page->lru);
+		__free_one_page(page, 0);
+	}
+	pthread_mutex_unlock(&g_zone_lock);
+	pcp->count[c] -= PCP_BATCH;
+	pthread_spin_unlock(&pcp->lock);
+}
+
+static void pcp_init(void)
+{
+	int cpu, c;
+
+	g_pcp = aligned_alloc(64, MAX_CPUS * sizeof(*g_pcp));
+	if (!g_pcp)
+		fatal("out of memory for the per-CPU caches");
+	memset(g_pcp, 0, MAX_CPUS * sizeof(*g_pcp));
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		pthread_spin_init(&g_pcp[cpu].lock, PTHREAD_PROCESS_PRIVATE);
+		for (c = 0; c < MAX_PALLOC_BINS; c++)
+			INIT_LIST_HEAD(&g_pcp[cpu].list[c]);
+	}
+}
+
+/**************************************************************************
+ * Page allocator entry points, either allocator
+ **************************************************************************/
+static struct page *alloc_pages(struct cgroup *cg, int cpu, int order,
+				int *fallback)
+{
+	struct page *page;
+
+	if (g_allocator == ALLOCATOR_PCP && !order)
+		return pcp_alloc(cg, cpu, fallback);
+
+	pthread_mutex_lock(&g_zone_lock);
+	page = __rmqueue(cg, order, cpu, fallback);
+	pthread_mutex_unlock(&g_zone_lock);
+	return page;
+}
+
+static void free_pages(struct page *page, int cpu, int order)
+{
+	if (g_allocator == ALLOCATOR_PCP && !order) {
+		pcp_free(page, cpu);
+		return;
+	}
+	/* order-0 frees go back through the buddy, not the color cache */
+	pthread_mutex_lock(&g_zone_lock);
+	__free_one_page(page, order);
+	pthread_mutex_unlock(&g_zone_lock);
+}
+
+/* charge an allocation (page NULL: a failed one) to cg */
+static void account_alloc(struct cgroup *cg, struct page *page, int order,
+			  int fallback)
+{
+	int i, outside = 0;
+
+	cg->nr_allocs++;
+	if (!page) {
+		cg->nr_failed++;
+		return;
+	}
+	for (i = 0; i < (1 << order); i++) {
+		cg->pages[page[i].color]++;
+		if (bitmap_weight(cg->cmap) &&
+		    !bitmap_test(cg->cmap, page[i].color))
+			outside++;
+	}
+	/* normal buddy pages of order > 0 may be in the color set by chance */
+	cg->nr_fallback += fallback || outside;
+}
+
+static void account_free(struct cgroup *cg, struct page *page, int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		cg->pages[page[i].color]--;
+}
+
+static inline void account_latency(uint64_t *hist, int64_t dur)
+{
+	int i = dur > 0 ? 63 - __builtin_clzll(dur) : 0;
+
+	hist[i < 32 ? i : 31]++;
+}
+
+/**************************************************************************
+ * Workload
+ **************************************************************************/
+static void zone_init(unsigned long nr_pages, unsigned long start_pfn)
+{
+	struct zone *zone = &g_zone;
+	unsigned long i, block = 1UL << (MAX_ORDER - 1);
+	uint64_t paddr[CMAP_BLOCK];
+	uint16_t color[CMAP_BLOCK];
+	unsigned long j, n;
+	int o, c;
+
+	nr_pages &= ~(block - 1);
+	if (!nr_pages)
+		fatal("zone smaller than a MAX_ORDER block");
+	zone->nr_pages = nr_pages;
+	zone->start_pfn = start_pfn & ~(block - 1);
+	zone->pages = calloc(nr_pages, sizeof(struct page));
+	if (!zone->pages)
+		fatal("out of memory for the zone");
+
+	for (o = 0; o < MAX_ORDER; o++)
+		INIT_LIST_HEAD(&zone->free_area[o].free_list);
+	for (c = 0; c < MAX_PALLOC_BINS; c++)
+		INIT_LIST_HEAD(&zone->color_list[c]);
+
+	/* colors of all pages, once */
+	for (i = 0; i < nr_pages; i += n) {
+		n = nr_pages - i < CMAP_BLOCK ? nr_pages - i : CMAP_BLOCK;
+		for (j = 0; j < n; j++)
+			paddr[j] = (uint64_t)(zone->start_pfn + i + j) << PAGE_SHIFT;
+		cmap_colors(&g_cmap, paddr, color, n);
+		for (j = 0; j < n; j++)
+			zone->pages[i + j].color = color[j];
+	}
+
+	for (i = 0; i < nr_pages; i++)
+		zone->pages[i].order = -1;
+	for (i = 0; i < nr_pages; i += block)
+		__free_one_page(&zone->pages[i], MAX_ORDER - 1);
+}
+
+static struct alloc *get_alloc(long id)
+{
+	long n;
+
+	if (id < 0)
+		fatal("negative allocation id");
+	if (id >= g_nr_allocs) {
+		n = g_nr_allocs ? g_nr_allocs : 4096;
+		while (n <= id)
+			n *= 2;
+		g_allocs = realloc(g_allocs, n * sizeof(*g_allocs));
+		if (!g_allocs)
+			fatal("out of memory for allocations");
+		for (; g_nr_allocs < n; g_nr_allocs++)
+			g_allocs[g_nr_allocs].page = -1;
+	}
+	return &g_allocs[id];
+}
+
+static void do_alloc(long id, int cgid, int cpu, int order)
+{
+	struct alloc *a = get_alloc(id);
+	struct cgroup *cg;
+	struct page *page;
+	int64_t start;
+	int fallback;
+
+	if (a->page >= 0)
+		fatal("allocation id in use");
+	if (cgid < 0 || cgid >= MAX_CGROUPS || cpu < 0 || cpu >= MAX_CPUS ||
+	    order < 0 || order >= MAX_ORDER)
+		fatal("bad alloc operation");
+	cg = &g_cgroups[cgid];
+	cg->used = 1;
+	g_ops++;
+
+	start = now_ns();
+	page = alloc_pages(cg, cpu, order, &fallback);
+	account_latency(g_latency_hist, now_ns() - start);
+
+	account_alloc(cg, page, order, fallback);
+	if (!page)
+		return;
+	a->page = page - g_zone.pages;
+	a->order = order;
+	a->cg = cgid;
+	a->cpu = cpu;
+}
+
+static void do_free(long id)
+{
+	struct alloc *a = get_alloc(id);
+	struct page *page;
+
+	if (a->page < 0)
+		fatal("free of an unallocated id");
+	page = &g_zone.pages[a->page];
+	account_free(&g_cgroups[a->cg], page, a->order);
+	g_ops++;
+	free_pages(page, a->cpu, a->order);
+	a->page = -1;
+}
+
+static void replay(const char *path)
+{
+	char line[1024], cmd[16], bins[512];
+	long id;
+	int lineno = 0, cg, cpu, order, n;
+	FILE *fp;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || sscanf(line, "%15s", cmd) != 1)
+			continue;
+		if (!strcmp(cmd, "alloc") &&
+		    sscanf(line, "%*s %ld %d %d %d", &id, &cg, &cpu, &order) == 4) {
+			do_alloc(id, cg, cpu, order);
+		} else if (!strcmp(cmd, "free") &&
+			   sscanf(line, "%*s %ld", &id) == 1) {
+			do_free(id);
+		} else if (!strcmp(cmd, "flush")) {
+			palloc_flush();
+		} else if (!strcmp(cmd, "cgroup") &&
+			   (n = sscanf(line, "%*s %d %511s", &cg, bins)) >= 1 &&
+			   cg >= 0 && cg < MAX_CGROUPS) {
+			if (n == 1 || !strcmp(bins, "none"))
+				bins[0] = '\0';
+			if (parse_bins(bins, g_cgroups[cg].cmap) < 0) {
+				fprintf(stderr, "%s:%d: bad bins %s\n", path,
+					lineno, bins);
+				exit(1);
+			}
+		} else {
+			fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+			exit(1);
+		}
+	}
+	if (fp != stdin)
+		fclose(fp);
+}
+
+/*
+ * synthetic workload: each op, a random cgroup allocates on its CPU while
+ * under util% of memory, or frees one of the live allocations at random.
+ * high% of the allocations are of order 1-3
+ */
+static void synthetic(long nr_ops, int nr_cgroups, int util, int high)
+{
+	long *live, nr_live = 0, next_id = 0, i, target;
+	unsigned long live_pages = 0;
+	int cg, order;
+
+	target = g_zone.nr_pages * util / 100;
+	live = malloc(nr_ops * sizeof(*live));
+	if (!live)
+		fatal("out of memory for the workload");
+
+	for (i = 0; i < nr_ops; i++) {
+		cg = rand() % nr_cgroups;
+		if (nr_live && ((long)live_pages >= target || rand() % 100 < 40)) {
+			long k = rand() % nr_live;
+			struct alloc *a = get_alloc(live[k]);
+
+			live_pages -= 1UL << a->order;
+			do_free(live[k]);
+			live[k] = live[--nr_live];
+			continue;
+		}
+		order = rand() % 100 < high ? 1 + rand() % 3 : 0;
+		do_alloc(next_id, cg, cg, order);
+		if (get_alloc(next_id)->page >= 0) {
+			live[nr_live++] = next_id;
+			live_pages += 1UL << order;
+		}
+		next_id++;
+	}
+	free(live);
+}
+
+/*
+ * the synthetic workload of one storm thread: its cgroup allocates on its
+ * CPU while under its share of util%, or frees a live allocation
+ */
+static void *storm_thread(void *arg)
+{
+	struct storm *t = arg;
+	struct { struct page *page; int order; } *live;
+	unsigned int seed = t->cpu + 1;
+	long nr_live = 0, live_pages = 0, i, k;
+	struct page *page;
+	int64_t start;
+	int order, fallback;
+
+	live = malloc(t->nr_ops * sizeof(*live));
+	if (!live)
+		fatal("out of memory for the workload");
+
+	for (i = 0; i < t->nr_ops; i++) {
+		if (nr_live && (live_pages >= t->target ||
+				rand_r(&seed) % 100 < 40)) {
+			k = rand_r(&seed) % nr_live;
+			live_pages -= 1L << live[k].order;
+			account_free(&t->cg, live[k].page, live[k].order);
+			free_pages(live[k].page, t->cpu, live[k].order);
+			live[k] = live[--nr_live];
+			continue;
+		}
+		order = rand_r(&seed) % 100 < t->high ? 1 + rand_r(&seed) % 3 : 0;
+		start = now_ns();
+		page = alloc_pages(&t->cg, t->cpu, order, &fallback);
+		account_latency(t->hist, now_ns() - start);
+		account_alloc(&t->cg, page, order, fallback);
+		if (page) {
+			live[nr_live].page = page;
+			live[nr_live++].order = order;
+			live_pages += 1L << order;
+		}
+	}
+	free(live);
+	return NULL;
+}
+
+/*
+ * the synthetic workload on nr_threads threads at once, thread i as CPU i
+ * of cgroup i % nr_cgroups, each with its share of the ops and memory
+ */
+static void storm(long nr_ops, int nr_threads, int nr_cgroups, int util,
+		  int high)
+{
+	struct storm *t;
+	struct cgroup *cg;
+	int64_t start, dur;
+	int i, c;
+
+	t = calloc(nr_threads, sizeof(*t));
+	if (!t)
+		fatal("out of memory for the threads");
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		t[i].cpu = i;
+		t[i].nr_ops = nr_ops / nr_threads;
+		t[i].target = g_zone.nr_pages * util / 100 / nr_threads;
+		t[i].high = high;
+		t[i].cg = g_cgroups[i % nr_cgroups];
+		if (pthread_create(&t[i].thread, NULL, storm_thread, &t[i]))
+			fatal("cannot create a storm thread");
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(t[i].thread, NULL);
+	dur = now_ns() - start;
+
+	for (i = 0; i < nr_threads; i++) {
+		cg = &g_cgroups[i % nr_cgroups];
+		cg->used = 1;
+		cg->nr_allocs += t[i].cg.nr_allocs;
+		cg->nr_fallback += t[i].cg.nr_fallback;
+		cg->nr_failed += t[i].cg.nr_failed;
+		for (c = 0; c < MAX_PALLOC_BINS; c++)
+			cg->pages[c] += t[i].cg.pages[c];
+		for (c = 0; c < 32; c++)
+			g_latency_hist[c] += t[i].hist[c];
+		g_ops += t[i].nr_ops;
+	}
+	nr_ops = t[0].nr_ops * nr_threads;
+	printf("storm: %d threads, %.2f Mops/s (%.3f s)\n", nr_threads,
+	       dur ? (double)nr_ops * 1000 / dur : 0, dur / 1e9);
+	free(t);
+}
+
+/**************************************************************************
+ * Report
+ **************************************************************************/
+static void report_stats(void)
+{
+	const char *desc[] = { "Color", "Normal", "Fail" };
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		struct palloc_stat *stat = &g_stat[i];
+
+		printf("statistics %s:\n", desc[i]);
+		printf("  min(ns)/max(ns)/avg(ns)/tot_cnt: %" PRId64 " %" PRId64
+		       " %" PRId64 " %" PRId64 "\n",
+		       stat->tot_cnt ? stat->min_ns : 0, stat->max_ns,
+		       stat->tot_cnt ? stat->tot_ns / stat->tot_cnt : 0,
+		       stat->tot_cnt);
+		printf("  hit rate: %" PRId64 "/%" PRId64 " (%" PRId64 " %%)\n",
+		       stat->cache_hit_cnt, stat->cache_acc_cnt,
+		       stat->cache_acc_cnt ?
+		       stat->cache_hit_cnt * 100 / stat->cache_acc_cnt : 0);
+		printf("  avg iter: %" PRId64 " (%" PRId64 "/%" PRId64 ")\n",
+		       stat->tot_cnt ? stat->iter_cnt / stat->tot_cnt : 0,
+		       stat->iter_cnt, stat->tot_cnt);
+		printf("  flush cnt: %" PRId64 "\n", stat->flush_cnt);
+		printf("  balance: %" PRId64 " | fail: %" PRId64 "\n",
+		       stat->alloc_balance, stat->alloc_balance_timeout);
+	}
+}
+
+static void report_pcp(void)
+{
+	uint64_t hits = 0, refills = 0, drains = 0, drained = 0;
+	int cpu;
+
+	if (!g_pcp)
+		return;
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		hits += g_pcp[cpu].hits;
+		refills += g_pcp[cpu].refills;
+		drains += g_pcp[cpu].drains;
+		drained += g_pcp[cpu].drained;
+	}
+	printf("per-CPU caches: hits %" PRIu64 " (%" PRIu64 " %%), refills %"
+	       PRIu64 ", drains %" PRIu64 ", pages drained from other CPUs %"
+	       PRIu64 "\n", hits,
+	       hits + refills ? hits * 100 / (hits + refills) : 0,
+	       refills, drains, drained);
+}
+
+static void report_latency(void)
+{
+	uint64_t total = 0, sum = 0;
+	int i, p;
+	const int pct[] = { 50, 90, 99, 100 };
+
+	for (i = 0; i < 32; i++)
+		total += g_latency_hist[i];
+	if (!total)
+		return;
+	printf("\nallocation latency (all paths, log2 buckets):");
+	for (p = 0, i = 0; i < 32 && p < 4; i++) {
+		sum += g_latency_hist[i];
+		while (p < 4 && sum * 100 >= total * pct[p]) {
+			printf(" p%d < %lu ns", pct[p], 2UL << i);
+			p++;
+		}
+	}
+	printf("\n");
+}
+
+static void report_cgroups(void)
+{
+	int i, c, w;
+	uint64_t total, live, min, max;
+	double mean, var;
+
+	printf("\n%4s %10s %10s %8s %8s %6s %8s %8s %6s\n", "cg", "allocs",
+	       "live", "fallback", "failed", "colors", "min", "max", "cv");
+	for (i = 0; i < MAX_CGROUPS; i++) {
+		struct cgroup *cg = &g_cgroups[i];
+		color_bitmap_t cmap;
+
+		if (!cg->used)
+			continue;
+		if (bitmap_weight(cg->cmap))
+			memcpy(cmap, cg->cmap, sizeof(cmap));
+		else
+			bitmap_fill_bins(cmap);
+
+		for (live = 0, c = 0; c < g_nr_bins; c++)
+			live += cg->pages[c];
+
+		/* balance of the live pages over the cgroup's colors */
+		total = 0, min = UINT64_MAX, max = 0;
+		for_each_set_bit(c, cmap) {
+			total += cg->pages[c];
+			min = cg->pages[c] < min ? cg->pages[c] : min;
+			max = cg->pages[c] > max ? cg->pages[c] : max;
+		}
+		w = bitmap_weight(cmap);
+		mean = (double)total / w;
+		var = 0;
+		for_each_set_bit(c, cmap)
+			var += (cg->pages[c] - mean) * (cg->pages[c] - mean);
+		var /= w;
+
+		printf("%4d %10" PRIu64 " %10" PRIu64 " %7.2f%% %8" PRIu64
+		       " %6d %8" PRIu64 " %8" PRIu64 " %6.3f\n", i,
+		       cg->nr_allocs, live,
+		       cg->nr_allocs ? 100.0 * cg->nr_fallback / cg->nr_allocs : 0,
+		       cg->nr_failed, w, min, max, mean ? sqrt(var) / mean : 0);
+	}
+}
+
+static void report_fragmentation(void)
+{
+	struct zone *zone = &g_zone;
+	unsigned long free_pages = 0, usable, pcp_pages = 0;
+	const int orders[] = { 3, 9 };
+	int o, i, c;
+
+	printf("\nfree blocks per order:");
+	for (o = 0; o < MAX_ORDER; o++) {
+		unsigned long blocks = zone->free_area[o].nr_free;
+
+		/* order 0 nr_free includes the color cache, as in the patch */
+		if (o == 0)
+			blocks -= zone->nr_cached;
+		printf(" %lu", blocks);
+		free_pages += blocks << o;
+	}
+	free_pages += zone->nr_cached;
+	printf("\ncolor cache: %lu pages\n", zone->nr_cached);
+	if (g_pcp) {
+		for (i = 0; i < MAX_CPUS; i++)
+			for (c = 0; c < MAX_PALLOC_BINS; c++)
+				pcp_pages += g_pcp[i].count[c];
+		free_pages += pcp_pages;
+		printf("per-CPU caches: %lu pages\n", pcp_pages);
+	}
+	printf("free: %lu of %lu pages\n", free_pages, zone->nr_pages);
+
+	/* unusable free space index: free memory in blocks below order */
+	for (i = 0; i < 2; i++) {
+		usable = 0;
+		for (o = orders[i]; o < MAX_ORDER; o++)
+			usable += zone->free_area[o].nr_free << o;
+		printf("unusable free space index, order %d: %.3f\n", orders[i],
+		       free_pages ? (double)(free_pages - usable) / free_pages : 0);
+	}
+}
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: $ %s [<option>]*\n\n", argv[0]);
+	printf("-m <MB> : zone size. default: %d\n", DEFAULT_MEM_MB);
+	printf("-p <pfn> : zone start PFN. default: 0\n");
+	printf("-b <mask> : palloc_mask (address bits). default: 0x%x\n",
+	       DEFAULT_PALLOC_MASK);
+	printf("-x <bit:xor_bit> : XOR a palloc_mask bit with another (use_mc_xor)\n");
+	printf("-f <file> : color map file instead of -b, see colormap.h\n");
+	printf("-P <0|1> : use_palloc. default: 1\n");
+	printf("-B <n> : alloc_balance. default: 0\n");
+	printf("-s <seed|first|least> : color selection among candidates, -A palloc. default: seed\n");
+	printf("-F <any|none> : order-0 fallback when the cgroup's colors are out. default: any\n");
+	printf("-A <palloc|pcp> : allocator, the patch's or per-CPU color caches. default: palloc\n");
+	printf("-t <file> : replay an allocation trace, - for stdin\n");
+	printf("-r <ops> : run a synthetic workload of ops allocations and frees\n");
+	printf("-c <bins> : synthetic workload cgroup bins, once per cgroup. default: one, all bins\n");
+	printf("-u <%%> : synthetic workload memory utilization. default: %d\n", DEFAULT_UTIL);
+	printf("-o <%%> : synthetic workload order 1-3 allocations. default: %d\n", DEFAULT_HIGH_ORDER);
+	printf("-j <threads> : run the synthetic workload on threads at once (thread i: CPU i, cgroup i %% cgroups)\n");
+	printf("-h : help\n");
+	printf("\nExamples: \n$ pallocsim -b 0xC000 -c 0-1 -c 2-3 -B 4 -r 1000000\n");
+	printf("$ pallocsim -c 0-1 -c 2-3 -j 8 -r 8000000 -A pcp\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long mem_mb = DEFAULT_MEM_MB, start_pfn = 0;
+	unsigned long palloc_mask = DEFAULT_PALLOC_MASK;
+	int mc_xor_bits[64] = { 0 };
+	char *map_file = NULL, *trace = NULL, *bins[MAX_CGROUPS];
+	long nr_ops = 0;
+	int nr_cgroups = 0, util = DEFAULT_UTIL, high = DEFAULT_HIGH_ORDER;
+	int nr_threads = 0;
+	int opt, i, bit, xor_bit;
+
+	while ((opt = getopt(argc, argv, "m:p:b:x:f:P:B:s:F:A:t:r:c:u:o:j:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			mem_mb = strtol(optarg, NULL, 0);
+			break;
+		case 'p':
+			start_pfn = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			palloc_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			if (sscanf(optarg, "%d:%d", &bit, &xor_bit) != 2 ||
+			    bit <= 0 || bit >= 64 || xor_bit <= 0 ||
+			    xor_bit >= 64 || bit == xor_bit)
+				usage(argc, argv);
+			mc_xor_bits[bit] = xor_bit;
+			break;
+		case 'f':
+			map_file = optarg;
+			break;
+		case 'P':
+			use_palloc = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			sysctl_alloc_balance = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			for (i = 0; i < NR_STRATEGIES; i++)
+				if (!strcmp(optarg, strategy_names[i]))
+					break;
+			if (i == NR_STRATEGIES)
+				usage(argc, argv);
+			g_strategy = i;
+			break;
+		case 'F':
+			if (!strcmp(optarg, "any"))
+				g_fallback = FALLBACK_ANY;
+			else if (!strcmp(optarg, "none"))
+				g_fallback = FALLBACK_NONE;
+			else
+				usage(argc, argv);
+			break;
+		case 'A':
+			for (i = 0; i < NR_ALLOCATORS; i++)
+				if (!strcmp(optarg, allocator_names[i]))
+					break;
+			if (i == NR_ALLOCATORS)
+				usage(argc, argv);
+			g_allocator = i;
+			break;
+		case 't':
+			trace = optarg;
+			break;
+		case 'r':
+			nr_ops = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (nr_cgroups == MAX_CGROUPS)
+				fatal("too many cgroups");
+			bins[nr_cgroups++] = optarg;
+			break;
+		case 'u':
+			util = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			high = strtol(optarg, NULL, 0);
+			break;
+		case 'j':
+			nr_threads = strtol(optarg, NULL, 0);
+			if (nr_threads < 1 || nr_threads > MAX_CPUS)
+				usage(argc, argv);
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+	if (!trace && !nr_ops)
+		usage(argc, argv);
+
+	if (map_file) {
+		if (cmap_load(&g_cmap, map_file) < 0) {
+			fprintf(stderr, "%s\n", cmap_strerror());
+			exit(1);
+		}
+	} else {
+		/* page_to_color(): a function per mask bit, XORed with its pair */
+		cmap_from_mask(&g_cmap, palloc_mask);
+		for (i = 0; i < g_cmap.nr_funcs; i++) {
+			bit = __builtin_ctzll(g_cmap.mask[i]);
+			if (mc_xor_bits[bit])
+				g_cmap.mask[i] |= 1ULL << mc_xor_bits[bit];
+		}
+	}
+	if (g_cmap.nr_funcs > MAX_PALLOC_BITS)
+		fatal("more than MAX_PALLOC_BITS color bits");
+	g_nr_bins = cmap_nr_colors(&g_cmap);
+
+	for (i = 0; i < (int)(sizeof(g_stat) / sizeof(g_stat[0])); i++)
+		g_stat[i].min_ns = 0x7fffffff;
+	for (i = 0; i < MAX_CGROUPS; i++)
+		g_cgroups[i].id = i;
+	for (i = 0; i < nr_cgroups; i++)
+		if (parse_bins(bins[i], g_cgroups[i].cmap) < 0) {
+			fprintf(stderr, "bad bins %s, %d bins\n", bins[i],
+				g_nr_bins);
+			exit(1);
+		}
+
+	zone_init((mem_mb << 20) >> PAGE_SHIFT, start_pfn);
+	if (g_allocator == ALLOCATOR_PCP)
+		pcp_init();
+	printf("zone: %lu pages, %d bins, allocator %s, palloc %s, "
+	       "alloc_balance %d, selection %s, fallback %s\n",
+	       g_zone.nr_pages, g_nr_bins, allocator_names[g_allocator],
+	       use_palloc ? "enabled" : "disabled", sysctl_alloc_balance,
+	       strategy_names[g_strategy],
+	       g_fallback == FALLBACK_ANY ? "any" : "none");
+
+	if (trace)
+		replay(trace);
+	if (nr_ops && nr_threads)
+		storm(nr_ops, nr_threads, nr_cgroups ? nr_cgroups : 1, util,
+		      high);
+	else if (nr_ops)
+		synthetic(nr_ops, nr_cgroups ? nr_cgroups : 1, util, high);
+
+	printf("operations: %" PRIu64 "\n", g_ops);
+	report_stats();
+	report_pcp();
+	report_latency();
+	report_cgroups();
+	report_fragmentation();
+	return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * pgtrace: page trace analyzer
+ *
+ * Reads a page trace written by pll -T or bandwidth -T, or a pagetype
+ * -F bin listing, and reports how the traced memory is spread over
+ * colors, DRAM channels and banks. Each is given as a map file (see
+ * colormap.h); without a color map the colors recorded in the trace are
+ * used. Pages are counted per base page, by the frame's base address;
+ * sampled accesses (pll -S) by their full physical address, so channel
+ * and bank bits below the page size are only resolved for accesses.
+ * One sectioned map file can serve all three, e.g. -C dram.map:channel
+ * -B dram.map:bank,bankgroup.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "pagetype-rec.h"
+#include "colormap.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define MAX_BINS (1 << CMAP_MAX_FUNCS)
+#define NR_MAPS 3
+#define NR_SIZES 3	/* 4KB, 2MB, 1GB */
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+struct dist {
+	const char *name;
+	const char *file;		   /* map file, NULL: not reported */
+	struct colormap cm;
+	uint64_t pages[MAX_BINS];	   /* base pages per bin */
+	uint64_t accesses[MAX_BINS];	   /* sampled accesses per bin */
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static struct dist g_dist[NR_MAPS] = {
+	{ .name = "color" },
+	{ .name = "channel" },
+	{ .name = "bank" },
+};
+
+static uint64_t g_nr_pages[NR_SIZES];	   /* records per page size */
+static uint64_t g_nr_base_pages;
+static uint64_t g_nr_uncolored;		   /* multi-page records, no -f */
+static uint64_t g_nr_accesses;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static int size_index(uint64_t count)
+{
+	if (count >= (1 << 18))
+		return 2;
+	if (count >= (1 << 9))
+		return 1;
+	return 0;
+}
+
+static void account(const struct pgt_record *rec, int page_shift)
+{
+	uint64_t i, paddr;
+	int m;
+
+	switch (rec->kind) {
+	case PGT_PAGE:
+	case PGT_RANGE:
+		if (rec->kind == PGT_PAGE)
+			g_nr_pages[size_index(rec->count)]++;
+		g_nr_base_pages += rec->count;
+		for (m = 0; m < NR_MAPS; m++) {
+			struct dist *d = &g_dist[m];
+
+			/* a recorded color is the first base page's only */
+			if (!d->file) {
+				if (m == 0 && rec->count > 1)
+					g_nr_uncolored += rec->count;
+				else if (m == 0 && rec->color >= 0 &&
+					 rec->color < MAX_BINS)
+					d->pages[rec->color]++;
+				continue;
+			}
+			for (i = 0; i < rec->count; i++)
+				d->pages[cmap_color(&d->cm,
+					(rec->pfn + i) << page_shift)]++;
+		}
+		break;
+	case PGT_ACCESS:
+		g_nr_accesses++;
+		paddr = (rec->pfn << page_shift) + rec->flags;
+		for (m = 0; m < NR_MAPS; m++) {
+			struct dist *d = &g_dist[m];
+
+			if (!d->file) {
+				if (m == 0 && rec->color >= 0 &&
+				    rec->color < MAX_BINS)
+					d->accesses[rec->color]++;
+				continue;
+			}
+			d->accesses[cmap_color(&d->cm, paddr)]++;
+		}
+		break;
+	}
+}
+
+static void report(struct dist *d, int nr_bins)
+{
+	uint64_t max = 0, min = UINT64_MAX, used = 0;
+	int i;
+
+	printf("\n%s distribution%s%s\n", d->name, d->file ? ": " : "",
+	       d->file ? d->file : " (recorded colors)");
+	printf("%8s %12s %8s %12s %8s\n", d->name, "pages", "%", "accesses", "%");
+	for (i = 0; i < nr_bins; i++) {
+		if (!d->pages[i] && !d->accesses[i])
+			continue;
+		printf("%8d %12" PRIu64 " %8.2f %12" PRIu64 " %8.2f\n", i,
+		       d->pages[i],
+		       g_nr_base_pages ? 100.0 * d->pages[i] / g_nr_base_pages : 0,
+		       d->accesses[i],
+		       g_nr_accesses ? 100.0 * d->accesses[i] / g_nr_accesses : 0);
+	}
+
+	/* imbalance over all the map's bins, unused ones included */
+	for (i = 0; i < nr_bins; i++) {
+		max = d->pages[i] > max ? d->pages[i] : max;
+		min = d->pages[i] < min ? d->pages[i] : min;
+		used += !!d->pages[i];
+	}
+	printf("%d of %d used, pages max/mean %.2f, min/mean %.2f\n",
+	       (int)used, nr_bins,
+	       g_nr_base_pages ? (double)max * nr_bins / g_nr_base_pages : 0,
+	       g_nr_base_pages ? (double)min * nr_bins / g_nr_base_pages : 0);
+}
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: $ %s [<option>]* <trace>\n\n", argv[0]);
+	printf("-f <file> : color map file. default: colors recorded in the trace\n");
+	printf("-C <file> : channel map file\n");
+	printf("-B <file> : bank map file\n");
+	printf("   map files may be given as <file>:<group>[,<group>...], see colormap.h\n");
+	printf("-h : help\n");
+	printf("\n<trace> is written by pll -T, bandwidth -T or pagetype -F bin; - for stdin\n");
+	printf("\nExamples: \n$ pll -m 64 -e 0 -T pll.trc -S 16; pgtrace -B bank.map pll.trc\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pgt_record rec[1024];
+	struct pgt_reader r;
+	int page_shift, nr_bins;
+	int opt, i, n;
+
+	while ((opt = getopt(argc, argv, "f:C:B:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			g_dist[0].file = optarg;
+			break;
+		case 'C':
+			g_dist[1].file = optarg;
+			break;
+		case 'B':
+			g_dist[2].file = optarg;
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argc, argv);
+
+	for (i = 0; i < NR_MAPS; i++) {
+		if (g_dist[i].file && cmap_load(&g_dist[i].cm, g_dist[i].file) < 0) {
+			fprintf(stderr, "%s\n", cmap_strerror());
+			exit(1);
+		}
+	}
+
+	if (pgt_open(&r, argv[optind]) < 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind],
+			errno == EINVAL ? "not a page trace" : strerror(errno));
+		exit(1);
+	}
+	page_shift = __builtin_ctz(r.hdr.page_size);
+
+	while ((n = pgt_read(&r, rec, 1024)) > 0)
+		for (i = 0; i < n; i++)
+			account(&rec[i], page_shift);
+	pgt_close(&r);
+
+	printf("pages: %" PRIu64 " x 4KB, %" PRIu64 " x 2MB, %" PRIu64
+	       " x 1GB (%" PRIu64 " MB)\n", g_nr_pages[0], g_nr_pages[1],
+	       g_nr_pages[2], (g_nr_base_pages << page_shift) >> 20);
+	printf("sampled accesses: %" PRIu64 "\n", g_nr_accesses);
+	if (g_nr_uncolored && !g_dist[0].file)
+		printf("%" PRIu64 " pages of huge pages or ranges are "
+		       "only colored with -f\n", g_nr_uncolored);
+
+	for (i = 0; i < NR_MAPS; i++) {
+		if (g_dist[i].file)
+			nr_bins = cmap_nr_colors(&g_dist[i].cm);
+		else if (i == 0 && r.hdr.nr_colors)
+			nr_bins = r.hdr.nr_colors;
+		else
+			continue;
+		report(&g_dist[i], nr_bins < MAX_BINS ? nr_bins : MAX_BINS);
+	}
+	return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef __PGTRACE_H
+#define __PGTRACE_H
+
+/*
+ * Page traces of a benchmark's own memory (pll and bandwidth -T), in the
+ * pagetype-rec.h format: one PGT_PAGE record per allocated page with its
+ * virtual page, PFN, size in base pages and color, then optionally
+ * PGT_ACCESS records for sampled accesses in access order. Analyze them
+ * with pgtrace.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "pagetype-rec.h"
+#include "colormap.h"
+
+#define PGT_PAGEMAP_BATCH	4096
+
+/* create a trace file. returns NULL with errno set on failure */
+static inline FILE *pgt_create(const char *path, const struct colormap *cm)
+{
+	struct pgt_header hdr;
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if (!file)
+		return NULL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PGT_MAGIC, sizeof(hdr.magic));
+	hdr.version = PGT_VERSION;
+	hdr.record_size = sizeof(struct pgt_record);
+	hdr.page_size = getpagesize();
+	hdr.nr_colors = cm ? cmap_nr_colors(cm) : 0;
+	fwrite(&hdr, sizeof(hdr), 1, file);
+	return file;
+}
+
+static inline void pgt_write(FILE *file, uint32_t kind, int32_t color,
+			     uint64_t vpn, uint64_t pfn, uint64_t count,
+			     uint64_t flags)
+{
+	struct pgt_record rec;
+
+	rec.kind = kind;
+	rec.color = color;
+	rec.vpn = vpn;
+	rec.pfn = pfn;
+	rec.count = count;
+	rec.flags = flags;
+	fwrite(&rec, sizeof(rec), 1, file);
+}
+
+/*
+ * Write a PGT_PAGE record for each page of [addr, addr + len), mapped
+ * with pages of page_size bytes. The color is that of the page's first
+ * byte, -1 without a map. Pages that are not present, or without a PFN
+ * (no root), are skipped. Returns the number of records written.
+ */
+static inline long pgt_dump_region(FILE *file, const void *addr, size_t len,
+				   size_t page_size, const struct colormap *cm)
+{
+	uint64_t buf[PGT_PAGEMAP_BATCH], pfn;
+	unsigned long base = getpagesize();
+	unsigned long vpn, end, n, i, step;
+	long written = 0;
+	ssize_t got;
+	int fd;
+
+	fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	vpn = ((unsigned long)addr & ~(page_size - 1)) / base;
+	end = ((unsigned long)addr + len + base - 1) / base;
+	step = page_size / base;
+
+	while (vpn < end) {
+		n = end - vpn < PGT_PAGEMAP_BATCH ? end - vpn : PGT_PAGEMAP_BATCH;
+		got = pread(fd, buf, n * sizeof(uint64_t), vpn * sizeof(uint64_t));
+		if (got <= 0)
+			break;
+		n = got / sizeof(uint64_t);
+
+		/* i is kept on page_size boundaries across batches */
+		for (i = 0; i < n; i += step) {
+			pfn = buf[i] & ((1ULL << 55) - 1);
+			if (!(buf[i] & (1ULL << 63)) || !pfn)
+				continue;
+			pgt_write(file, PGT_PAGE,
+				  cm ? cmap_color(cm, pfn * base) : -1,
+				  vpn + i, pfn, step, 0);
+			written++;
+		}
+		vpn += (n + step - 1) / step * step;
+	}
+	close(fd);
+	return written;
+}
+
+#endif /* __PGTRACE_H */
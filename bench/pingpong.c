@@ -0,0 +1,440 @@
+/**
+ * pingpong: cache line ping-pong and false sharing latency microbenchmark
+ *
+ * Threads pinned to the given CPUs pass a token around a ring through one
+ * shared cache line, using plain stores, atomic increments, CAS, or
+ * adjacent per-thread fields of the same line (false sharing). The round
+ * trip latency histogram and the line transfer rate are reported, either
+ * for one ring or as a core-to-core matrix over every pair of CPUs.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Conditional Compilation Options
+ **************************************************************************/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE             /* See feature_test_macros(7) */
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <getopt.h>
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define CACHE_LINE_SIZE 64
+#define MAX_THREADS (CACHE_LINE_SIZE / sizeof(uint64_t)) /* fields per line */
+#define MAX_CPUS 1024
+#define DEFAULT_ITER 100000
+#define DEFAULT_BUCKET_NS 10
+#define NR_BUCKETS 100
+
+#define MAX(a,b) ((a>b)?(a):(b))
+#define MIN(a,b) ((a>b)?(b):(a))
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+enum pp_mode { STORE, ATOMIC, CAS, FALSE_SHARING, PADDED, NR_MODES };
+
+struct pp_result {
+	double avg, min, p50, p99, max;	   /* round trip (ns) */
+	double transfers;		   /* line transfers per second */
+	uint64_t hist[NR_BUCKETS + 1];	   /* last bucket: overflow */
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static const char *mode_names[] = {
+	[STORE]		= "store",
+	[ATOMIC]	= "atomic",
+	[CAS]		= "cas",
+	[FALSE_SHARING]	= "false",
+	[PADDED]	= "padded",
+};
+
+/* the bounced line. token modes use flag, field modes use field[] */
+static union {
+	volatile uint64_t flag;
+	volatile uint64_t field[MAX_THREADS];
+} g_line __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* PADDED: the same protocol as FALSE_SHARING but one line per field */
+static struct {
+	volatile uint64_t val;
+} __attribute__((aligned(CACHE_LINE_SIZE))) g_padded[MAX_THREADS];
+
+static int g_mode;
+static int g_nthreads;
+static int g_cpus[MAX_THREADS];
+static int64_t g_iter = DEFAULT_ITER;
+static int64_t g_warmup = 1000;
+static int g_bucket_ns = DEFAULT_BUCKET_NS;
+static uint64_t *g_lat;		   /* per round trip (ns), thread 0 */
+static volatile int g_nready;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static inline uint64_t nstime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile("yield" ::: "memory");
+#endif
+}
+
+/*
+ * Pass the token once: wait until it is thread id's turn in round r,
+ * then hand it to the next thread.
+ */
+static inline void pass_token(int id, uint64_t r)
+{
+	const uint64_t n = g_nthreads;
+	uint64_t mine = r * n + id, exp;
+	int prev = (id + n - 1) % n;
+
+	switch (g_mode) {
+	case STORE:
+		while (g_line.flag != mine)
+			cpu_relax();
+		g_line.flag = mine + 1;
+		break;
+	case ATOMIC:
+		while (__atomic_load_n(&g_line.flag, __ATOMIC_ACQUIRE) != mine)
+			cpu_relax();
+		__atomic_fetch_add(&g_line.flag, 1, __ATOMIC_ACQ_REL);
+		break;
+	case CAS:
+		/* every failed attempt also steals the line */
+		do {
+			exp = mine;
+		} while (!__atomic_compare_exchange_n(&g_line.flag, &exp, mine + 1, 0,
+						      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		break;
+	case FALSE_SHARING:
+		/* thread 0 starts round r, every other thread follows its predecessor */
+		if (id != 0)
+			while (g_line.field[prev] != r + 1)
+				cpu_relax();
+		g_line.field[id] = r + 1;
+		break;
+	case PADDED:
+		if (id != 0)
+			while (g_padded[prev].val != r + 1)
+				cpu_relax();
+		g_padded[id].val = r + 1;
+		break;
+	}
+}
+
+/* thread 0 closes round r when the token is back */
+static inline void wait_round(uint64_t r)
+{
+	const uint64_t n = g_nthreads;
+
+	switch (g_mode) {
+	case STORE:
+	case ATOMIC:
+	case CAS:
+		while (__atomic_load_n(&g_line.flag, __ATOMIC_ACQUIRE) != (r + 1) * n)
+			cpu_relax();
+		break;
+	case FALSE_SHARING:
+		while (g_line.field[n - 1] != r + 1)
+			cpu_relax();
+		break;
+	case PADDED:
+		while (g_padded[n - 1].val != r + 1)
+			cpu_relax();
+		break;
+	}
+}
+
+static void *pp_thread(void *param)
+{
+	int id = (int)(intptr_t)param;
+	int64_t total = g_warmup + g_iter, r;
+	uint64_t prev, now;
+	cpu_set_t cmask;
+
+	CPU_ZERO(&cmask);
+	CPU_SET(g_cpus[id], &cmask);
+	if (sched_setaffinity(0, sizeof(cmask), &cmask) < 0)
+		perror("sched_setaffinity");
+
+	__atomic_fetch_add(&g_nready, 1, __ATOMIC_SEQ_CST);
+	while (g_nready < g_nthreads); // busy wait until all join
+
+	if (id != 0) {
+		for (r = 0; r < total; r++)
+			pass_token(id, r);
+		return NULL;
+	}
+
+	prev = nstime();
+	for (r = 0; r < total; r++) {
+		pass_token(0, r);
+		wait_round(r);
+		now = nstime();
+		if (r >= g_warmup)
+			g_lat[r - g_warmup] = now - prev;
+		prev = now;
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* run one ring over cpus[0..n-1] in mode */
+static void run_ring(const int *cpus, int n, int mode, struct pp_result *res)
+{
+	pthread_t tid[MAX_THREADS];
+	uint64_t sum = 0;
+	int64_t i;
+
+	memset((void *)&g_line, 0, sizeof(g_line));
+	memset((void *)g_padded, 0, sizeof(g_padded));
+	memcpy(g_cpus, cpus, n * sizeof(int));
+	g_nthreads = n;
+	g_mode = mode;
+	g_nready = 0;
+
+	for (i = 0; i < n; i++)
+		pthread_create(&tid[i], NULL, pp_thread, (void *)(intptr_t)i);
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+
+	memset(res, 0, sizeof(*res));
+	for (i = 0; i < g_iter; i++) {
+		sum += g_lat[i];
+		res->hist[MIN(g_lat[i] / g_bucket_ns, NR_BUCKETS)]++;
+	}
+	qsort(g_lat, g_iter, sizeof(uint64_t), cmp_u64);
+	res->avg = (double)sum / g_iter;
+	res->min = g_lat[0];
+	res->p50 = g_lat[g_iter / 2];
+	res->p99 = g_lat[MIN(g_iter * 99 / 100, g_iter - 1)];
+	res->max = g_lat[g_iter - 1];
+	/* one round trip moves the line n times */
+	res->transfers = (double)n * g_iter * 1e9 / sum;
+}
+
+static void print_result(const int *cpus, int n, int mode, struct pp_result *res)
+{
+	int i;
+
+	printf("cpus ");
+	for (i = 0; i < n; i++)
+		printf("%d%s", cpus[i], (i < n - 1) ? "->" : "");
+	printf(" mode %-6s: round trip avg %.1f min %.0f p50 %.0f p99 %.0f max %.0f ns | %.2f M transfers/s\n",
+	       mode_names[mode], res->avg, res->min, res->p50, res->p99,
+	       res->max, res->transfers / 1e6);
+}
+
+static void print_histogram(struct pp_result *res)
+{
+	uint64_t peak = 1;
+	int i, last = 0;
+
+	for (i = 0; i <= NR_BUCKETS; i++) {
+		if (res->hist[i])
+			last = i;
+		peak = MAX(peak, res->hist[i]);
+	}
+	for (i = 0; i <= last; i++) {
+		if (!res->hist[i])
+			continue;
+		if (i < NR_BUCKETS)
+			printf("  %5d-%-5d ns %10" PRIu64 " ", i * g_bucket_ns,
+			       (i + 1) * g_bucket_ns - 1, res->hist[i]);
+		else
+			printf("  %5d+      ns %10" PRIu64 " ", i * g_bucket_ns,
+			       res->hist[i]);
+		printf("%.*s\n", (int)(50 * res->hist[i] / peak),
+		       "##################################################");
+	}
+}
+
+static void print_matrix(const int *cpus, int n, int mode, const char *title,
+			 const double *val, const char *fmt)
+{
+	int i, j;
+
+	printf("\nmode %s: %s\n%6s", mode_names[mode], title, "");
+	for (j = 0; j < n; j++)
+		printf(" %6d", cpus[j]);
+	printf("\n");
+	for (i = 0; i < n; i++) {
+		printf("%6d", cpus[i]);
+		for (j = 0; j < n; j++) {
+			if (i == j) {
+				printf(" %6s", "-");
+				continue;
+			}
+			printf(" ");
+			printf(fmt, val[i * n + j]);
+		}
+		printf("\n");
+	}
+}
+
+/* parse a cpulist ("0,4" or "0-3,8") into cpus[]. returns the count */
+static int parse_cpulist(const char *str, int *cpus, int max)
+{
+	int n = 0, lo, hi;
+	const char *p = str;
+	char *end;
+
+	while (*p && n < max) {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (; lo <= hi && n < max; lo++)
+			cpus[n++] = lo;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+static void usage(int argc, char *argv[])
+{
+	int i;
+
+	printf("Usage: $ %s [<option>]*\n\n", argv[0]);
+	printf("-c: CPU list, e.g. 0,1 or 0-3. default=0,1\n");
+	printf("-a: access mode. default=all of them\n");
+	for (i = 0; i < NR_MODES; i++)
+		printf("    %s\n", mode_names[i]);
+	printf("-M: core-to-core matrix over every pair of the listed CPUs\n");
+	printf("-i: round trips per measurement. default=%d\n", DEFAULT_ITER);
+	printf("-b: histogram bucket width in ns. default=%d\n", DEFAULT_BUCKET_NS);
+	printf("-H: print the round trip latency histogram\n");
+	printf("-h: help\n");
+	printf("\nExamples: \n$ pingpong -c 0,4 -a cas -H\n  <- CAS ping-pong between CPU 0 and 4 with a histogram\n");
+	printf("$ pingpong -c 0-7 -M\n  <- core-to-core latency matrix of CPU 0..7\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static int cpus[MAX_CPUS];
+	int ncpus = 0, matrix = 0, histogram = 0;
+	int modes[NR_MODES], nmodes = 0;
+	struct pp_result res;
+	double *p50, *rate;
+	int opt, i, j, m;
+
+	while ((opt = getopt(argc, argv, "c:a:Mi:b:Hh")) != -1) {
+		switch (opt) {
+		case 'c':
+			ncpus = parse_cpulist(optarg, cpus, MAX_CPUS);
+			break;
+		case 'a':
+			for (m = 0; m < NR_MODES; m++)
+				if (!strcmp(optarg, mode_names[m]))
+					break;
+			if (m == NR_MODES) {
+				fprintf(stderr, "unknown mode %s\n", optarg);
+				exit(1);
+			}
+			if (nmodes < NR_MODES)
+				modes[nmodes++] = m;
+			break;
+		case 'M':
+			matrix = 1;
+			break;
+		case 'i':
+			g_iter = MAX(strtol(optarg, NULL, 0), 1);
+			break;
+		case 'b':
+			g_bucket_ns = MAX(strtol(optarg, NULL, 0), 1);
+			break;
+		case 'H':
+			histogram = 1;
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+		}
+	}
+
+	if (ncpus == 0) {
+		cpus[0] = 0;
+		cpus[1] = 1;
+		ncpus = 2;
+	}
+	if (ncpus < 2) {
+		fprintf(stderr, "need at least two CPUs\n");
+		exit(1);
+	}
+	if (!matrix && ncpus > MAX_THREADS) {
+		fprintf(stderr, "at most %d CPUs in a ring\n", (int)MAX_THREADS);
+		exit(1);
+	}
+	if (nmodes == 0)
+		for (nmodes = 0; nmodes < NR_MODES; nmodes++)
+			modes[nmodes] = nmodes;
+
+	g_lat = malloc(g_iter * sizeof(uint64_t));
+
+	if (!matrix) {
+		for (m = 0; m < nmodes; m++) {
+			run_ring(cpus, ncpus, modes[m], &res);
+			print_result(cpus, ncpus, modes[m], &res);
+			if (histogram)
+				print_histogram(&res);
+			fflush(stdout);
+		}
+		return 0;
+	}
+
+	/* core-to-core matrix of every ordered pair */
+	p50 = calloc(ncpus * ncpus, sizeof(double));
+	rate = calloc(ncpus * ncpus, sizeof(double));
+	for (m = 0; m < nmodes; m++) {
+		for (i = 0; i < ncpus; i++) {
+			for (j = 0; j < ncpus; j++) {
+				int pair[2] = { cpus[i], cpus[j] };
+				if (i == j)
+					continue;
+				run_ring(pair, 2, modes[m], &res);
+				p50[i * ncpus + j] = res.p50;
+				rate[i * ncpus + j] = res.transfers / 1e6;
+				if (histogram) {
+					print_result(pair, 2, modes[m], &res);
+					print_histogram(&res);
+				}
+			}
+		}
+		print_matrix(cpus, ncpus, modes[m], "median round trip (ns)", p50, "%6.0f");
+		print_matrix(cpus, ncpus, modes[m], "M transfers/s", rate, "%6.2f");
+		fflush(stdout);
+	}
+	return 0;
+}
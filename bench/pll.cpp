@@ -38,6 +38,10 @@
 #include <assert.h>
 #include <random>
 #include <signal.h>
+#include <getopt.h>
+
+#include "pgtrace.h"
+#include "isolbench.h"
 
 /**************************************************************************
  * Public Definitions
@@ -68,41 +72,35 @@ enum access_type { READ, WRITE};
  **************************************************************************/
 static int64_t g_mem_size = (DEFAULT_ALLOC_SIZE_KB*1024);
 static int64_t g_unit_size = 64; // 64B
-static int64_t* list[MAX_MLP];
-static int64_t next[MAX_MLP];
+static void *heads[MAX_MLP];
 
 static int g_debug = 0;
 static int g_color[MAX_COLORS]; // not assigned
 static int g_color_cnt = 0;
 
-static int g_pagemap_fd = -1;
-
 // static unsigned long bank_bitmask = 0x1e000; // 16|15,14,13,--| : xu4 (cortex-a15)
 static unsigned long bank_bitmask = 0x7800;  // --,14,13,12|11  : pi4 (cortex-a72)
 
-// Bank bit mapping from file
-static std::vector<std::vector<int>> g_bank_functions;
+// Bank bit mapping: from the map file, or one function per bank_bitmask bit
+static struct colormap g_cmap;
 static char* g_map_file = nullptr;
-static volatile int keep_running = 1;
+
+// Page trace (-T), with every g_trace_sample-th list access (-S)
+static char* g_trace_file = nullptr;
+static int64_t g_trace_sample = 0;
+static volatile int g_stop = 0;
+static int g_counters = 0;		// --counters
+static char* g_events = nullptr;	// its events, nullptr: default
 
 /**************************************************************************
  * Public Function Prototypes
  **************************************************************************/
 
 void signal_handler(int sig) {
-	keep_running = 0;
+	g_stop = 1;
 	//fflush(stdout);
 }
 
-uint64_t get_elapsed(struct timespec *start, struct timespec *end)
-{
-	uint64_t dur;
-
-	dur = ((uint64_t)end->tv_sec * 1000000000 + end->tv_nsec) - 
-		((uint64_t)start->tv_sec * 1000000000 + start->tv_nsec);
-	return dur;
-}
-
 // ----------------------------------------------
 long utime()
 {
@@ -200,156 +198,22 @@ found_middle:
 	     (bit) < (size);					\
 	     (bit) = find_next_bit((addr), (size), (bit) + 1))
 
-int paddr_to_color(unsigned long mask, unsigned long paddr)
-{
-	// If we have bank mapping functions from file, use them
-	if (!g_bank_functions.empty()) {
-		int color = 0;
-		
-		for (size_t func_idx = 0; func_idx < g_bank_functions.size(); func_idx++) {
-			int bit_result = 0;
-			
-			// XOR all the specified bits for this function
-			for (int bit_pos : g_bank_functions[func_idx]) {
-				bit_result ^= ((paddr >> bit_pos) & 0x1);
-			}
-			
-			// Set the corresponding bit in the color
-			if (bit_result) {
-				color |= (1 << func_idx);
-			}
-		}
-		
-		return color;
-	}
-	
-	// Fall back to original bitmask-based method
-	int color = 0;
-	int idx = 0;
-	unsigned long c = 0;
-	for_each_set_bit(c, &mask, BITS_PER_LONG) {
-		if ((paddr >> (c)) & 0x1)
-			color |= (1<<idx);
-		idx++;
-	}
-	return color;
-}
-
-
-size_t get_frame_number_from_pagemap(size_t value) {
-    return value & ((1ULL << 54) - 1);
-}
-
-ulong get_paddr(ulong vaddr)
-{
-	ulong value;
-	int page_size = getpagesize();
-	off64_t offset = (vaddr / page_size) * sizeof(value);
-	assert(g_pagemap_fd >= 0);
-	
-	// Check if we have root permission to read frame numbers
-	static int has_root_access = -1;  // Cache the result
-	if (has_root_access == -1) {
-		has_root_access = (geteuid() == 0) ? 1 : 0;
-		if (!has_root_access) {
-			printf("Warning: Running without root privileges. Physical addresses may not be accurate.\n");
-		}
-		return vaddr;
-	} else if (has_root_access == 0) {
-		// If not root, return the virtual address
-		// as we cannot reliably get the physical address.
-		return vaddr;
-	}
-
-	int got = pread(g_pagemap_fd, &value, sizeof(value), offset);
-	assert(got == 8);
-
-	// Check the "page present" flag.
-	assert(value & (1ULL << 63));
-
-	ulong frame_num = get_frame_number_from_pagemap(value);
-	return (frame_num * page_size) | (vaddr & (page_size - 1));
-}
-
-// ----------------------------------------------
-void init_pagemap() {
-    g_pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
-    assert(g_pagemap_fd >= 0);
-}
-
-// Read bank bit mapping functions from file
-void read_bank_map_file(const char* filename) {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open map file %s\n", filename);
-        exit(1);
-    }
-
-    char line[256];
-    g_bank_functions.clear();
-
-    while (fgets(line, sizeof(line), fp)) {
-        // Skip empty lines and comments
-        if (line[0] == '\n' || line[0] == '#') continue;
-        std::vector<int> function_bits;
-        char* token = strtok(line, " \t\n");
-        while (token != nullptr) {
-            int bit = atoi(token);
-            function_bits.push_back(bit);
-            token = strtok(nullptr, " \t\n");
-        }
-        if (!function_bits.empty()) {
-            g_bank_functions.push_back(function_bits);
-        }
-    }
-    fclose(fp);
-    if (g_debug) {
-        printf("Loaded %zu bank mapping functions:\n", g_bank_functions.size());
-        for (size_t i = 0; i < g_bank_functions.size(); i++) {
-            printf("Function %zu: XOR bits ", i);
-            for (int bit : g_bank_functions[i]) {
-                printf("%d ", bit);
-            }
-            printf("\n");
-        }
-    }
-}
 
 /**************************************************************************
  * Implementation
  **************************************************************************/
 int64_t run(int64_t iter, int mlp)
 {
-	int64_t cnt = 0;
-
-	for (int64_t i = 0; i < iter && keep_running; i++) {
-		for (int j = 0; j < mlp; j++) {
-			next[j] = list[j][next[j]];
-		}
-		cnt += mlp;
-	}
-	return cnt;
+	return ib_chase(heads, mlp, iter, &g_stop);
 }
 
 int64_t run_write(int64_t iter, int mlp)
 {
-	int64_t cnt = 0;
-
-	for (int64_t i = 0; i < iter && keep_running; i++) {
-		for (int j = 0; j < mlp; j++) {
-			list[j][next[j]+1] = 0xff; // write
-			next[j] = list[j][next[j]];
-		}
-		cnt += mlp;
-	}
-	return cnt;
+	return ib_chase_write(heads, mlp, iter, &g_stop);
 }
 
 int main(int argc, char* argv[])
 {
-	// struct sched_param param;
-        cpu_set_t cmask;
-	int num_processors;
 	int cpuid = 0;
 
 	int64_t *memchunk = NULL;
@@ -358,16 +222,24 @@ int main(int argc, char* argv[])
 
 	long repeat = DEFAULT_ITER;
 	int mlp = DEFAULT_MLP;
-	struct timespec start, end;
+	uint64_t start, end;
 	int acc_type = READ;
 
 	std::srand (0);
 	std::vector<int64_t> myvector;
+	struct ib_counters *pmu = nullptr;
+
+	static struct option long_options[] = {
+		{"counters", optional_argument, 0,  'C' },
+		{0,          0,                 0,  0 }
+	};
+	int option_index = 0;
 
 	/*
 	 * get command line options 
 	 */
-	while ((opt = getopt(argc, argv, "k:m:g:u:a:c:d:e:b:i:l:f:h")) != -1) {
+	while ((opt = getopt_long(argc, argv, "k:m:g:u:a:c:d:e:b:p:i:l:f:T:S:h",
+				  long_options, &option_index)) != -1) {
 		switch (opt) {
 		case 'k': /* set memory size in KB */
 			g_mem_size = 1024 * strtol(optarg, NULL, 0);
@@ -399,10 +271,7 @@ int main(int argc, char* argv[])
 		case 'c': /* set CPU affinity */
 			cpuid = strtol(optarg, NULL, 0);
 			fprintf(stderr, "cpuid: %d\n", cpuid);
-			num_processors = sysconf(_SC_NPROCESSORS_CONF);
-			CPU_ZERO(&cmask);
-			CPU_SET(cpuid % num_processors, &cmask);
-			if (sched_setaffinity(0, num_processors, &cmask) < 0) {
+			if (ib_pin_cpu(cpuid) < 0) {
 				perror("error");
 				exit(1);
 			}
@@ -417,7 +286,7 @@ int main(int argc, char* argv[])
 			break;	
 		case 'p': /* set priority */
 			prio = strtol(optarg, NULL, 0);
-			if (setpriority(PRIO_PROCESS, 0, prio) < 0)
+			if (ib_set_nice(prio) < 0)
 				perror("error");
 			else
 				fprintf(stderr, "assigned priority %d\n", prio);
@@ -430,10 +299,20 @@ int main(int argc, char* argv[])
 			mlp = strtol(optarg, NULL, 0);
 			fprintf(stderr, "MLP=%d\n", mlp);
 			break;
+		case 'T': /* page trace file */
+			g_trace_file = optarg;
+			break;
+		case 'S': /* access trace sampling */
+			g_trace_sample = strtol(optarg, NULL, 0);
+			break;
 		case 'f': /* bank map file */
 			g_map_file = optarg;
 			fprintf(stderr, "Bank map file: %s\n", g_map_file);
 			break;
+		case 'C': /* hardware counters */
+			g_counters = 1;
+			g_events = optarg;
+			break;
 		case 'h': /* help */
 			printf("Usage: %s [options]\n", argv[0]);
 			printf("Options:\n");
@@ -450,6 +329,9 @@ int main(int argc, char* argv[])
 			printf("  -p <prio>   : set process priority\n");
 			printf("  -i <iter>   : number of iterations (default: %ld)\n", (long)DEFAULT_ITER);
 			printf("  -l <mlp>    : memory-level parallelism (default: %d)\n", (int)DEFAULT_MLP);
+			printf("  -T <file>   : write a page trace (vaddr, pfn, page size, color), see pgtrace\n");
+			printf("  -S <n>      : also trace every n-th list access, in access order\n");
+			printf("  --counters[=<event>,...] : hardware counters of the timed run (default: %s)\n", IB_COUNTERS_DEFAULT);
 			exit(0);
 		}
 
@@ -458,11 +340,10 @@ int main(int argc, char* argv[])
 	signal(SIGTERM, signal_handler);
 	signal(SIGINT, signal_handler);
 
-	init_pagemap(); // need to open /proc/self/pagemap
-	
 	// Read bank mapping file if specified
-	if (g_map_file) {
-		read_bank_map_file(g_map_file);
+	if (ib_colormap(&g_cmap, g_map_file, bank_bitmask) < 0) {
+		fprintf(stderr, "Error: Cannot read map file %s\n", cmap_strerror());
+		exit(1);
 	}
 	
 	printf("g_mem_size: %ld (%ld KB)\n", g_mem_size, g_mem_size/1024);
@@ -474,18 +355,20 @@ int main(int argc, char* argv[])
 	if (g_color_cnt) {
 		int n_colors = 1;
 		
-		if (!g_bank_functions.empty()) {
+		if (g_map_file) {
 			// Using bank mapping functions from file
 			printf("Using bank mapping functions from file\n");
-			printf("Number of bank functions: %zu\n", g_bank_functions.size());
-			for (size_t i = 0; i < g_bank_functions.size(); i++) {
-				printf("Function %zu: XOR bits ", i);
-				for (int bit : g_bank_functions[i]) {
-					printf("%d ", bit);
+			printf("Number of bank functions: %d\n", g_cmap.nr_funcs);
+			for (i = 0; i < g_cmap.nr_funcs; i++) {
+				unsigned long mask = g_cmap.mask[i];
+				printf("Function %d (%s): XOR bits ", i,
+				       cmap_group_names[g_cmap.group[i]]);
+				for_each_set_bit(c, &mask, BITS_PER_LONG) {
+					printf("%d ", (int)c);
 				}
 				printf("\n");
 			}
-			n_colors = 1 << g_bank_functions.size(); // 2^n_functions
+			n_colors = cmap_nr_colors(&g_cmap); // 2^n_functions
 		} else {
 			// Using traditional bitmask
 			printf("bank bitmask: 0x%lx\n", bank_bitmask);
@@ -512,35 +395,56 @@ int main(int argc, char* argv[])
 
 	printf("orig_ws: %ld  mlp: %d\n", orig_ws, mlp);
 
-	clock_gettime(CLOCK_REALTIME, &start);
-
-	/* alloc memory. align to a page boundary */
-    // try 1GB huge page
-    memchunk = (int64_t *)mmap(NULL, g_mem_size, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE |
-                    (30 << MAP_HUGE_SHIFT), -1, 0);
-    if ((void *)memchunk == MAP_FAILED) {
-        // try 2MB huge page
-        memchunk = (int64_t *)mmap(NULL, g_mem_size, PROT_READ | PROT_WRITE,
-                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
-                        -1, 0);
-        if ((void *)memchunk == MAP_FAILED) {
-            // nomal page allocation
-            memchunk = (int64_t *)mmap(NULL, g_mem_size, PROT_READ | PROT_WRITE,
-                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
-            if ((void *)memchunk == MAP_FAILED) {
-                perror("alloc failed");
-                exit(1);
-            } else
-                printf("small page mapping (%u KB)\n", getpagesize() / 1024);
-        } else
-            printf("%s huge page mapping\n", "2MB");
-    } else {
-        printf("%s huge page mapping\n", "1GB");
+	start = ib_now_ns();
+
+	/* alloc memory: 1GB, then 2MB huge pages, then small pages */
+	size_t page_size;
+	memchunk = (int64_t *)ib_alloc(g_mem_size, IB_MEM_HUGE, &page_size);
+	if (!memchunk) {
+		perror("alloc failed");
+		exit(1);
+	}
+	if (page_size == 1UL << 30)
+		printf("%s huge page mapping\n", "1GB");
+	else if (page_size == 2UL << 20)
+		printf("%s huge page mapping\n", "2MB");
+	else
+		printf("small page mapping (%zu KB)\n", page_size / 1024);
+
+	FILE *trace = nullptr;
+	if (g_trace_file) {
+		trace = pgt_create(g_trace_file, &g_cmap);
+		if (!trace) {
+			perror(g_trace_file);
+			exit(1);
+		}
+		printf("traced %ld pages\n",
+		       pgt_dump_region(trace, memchunk, g_mem_size, page_size,
+				       &g_cmap));
 	}
 
-	/* initialize data */
-	memset(memchunk, 0, g_mem_size);
+	// colors of all units at once
+	std::vector<uint64_t> paddrs;
+	std::vector<uint16_t> colors;
+	bool have_pfn = true;
+	if (g_color_cnt > 0 || trace) {
+		paddrs.resize(orig_ws);
+		colors.resize(orig_ws);
+		if (ib_virt_to_phys(memchunk, orig_ws, g_unit_size,
+				    paddrs.data()) < 0) {
+			if (errno != EPERM) {
+				perror("pagemap");
+				exit(1);
+			}
+			// without root, pagemap has no frame numbers: use the
+			// virtual addresses
+			printf("Warning: Running without root privileges. Physical addresses may not be accurate.\n");
+			have_pfn = false;
+			for (int64_t i = 0; i < orig_ws; i++)
+				paddrs[i] = (ulong)memchunk + i * g_unit_size;
+		}
+		cmap_colors(&g_cmap, paddrs.data(), colors.data(), orig_ws);
+	}
 
 	// set some values:
 	for (int i=0; i<orig_ws; i++) {
@@ -549,13 +453,12 @@ int main(int argc, char* argv[])
 		if (g_color_cnt > 0) {
 			/* use coloring */
 			for (int j = 0; j < g_color_cnt; j++) {
-				ulong paddr = get_paddr(vaddr);
-				if (paddr_to_color(bank_bitmask, paddr) == g_color[j]) {
+				if (colors[i] == g_color[j]) {
 					if (g_debug)
 						printf("vaddr: %p paddr: %p color: %d\n",
 						       (void *)vaddr,
-							   (void *)paddr,
-						       paddr_to_color(bank_bitmask, paddr));
+							   (void *)paddrs[i],
+						       colors[i]);
 					myvector.push_back(i);
 				}
 			}
@@ -574,45 +477,48 @@ int main(int argc, char* argv[])
 	int64_t list_len = ws / mlp;
 	printf("list_len: %ld\n", list_len);
 	
-	for (i = 0; i < ws; i++) {
-		int64_t l = i / list_len;
-		int64_t curr_idx = myvector[i] * g_unit_size / 8;
-		int64_t next_idx = myvector[i+1] * g_unit_size / 8;
-		if ((i+1) % list_len == 0)
-			next_idx = myvector[i/list_len*list_len] * g_unit_size / 8;
-
-		memchunk[curr_idx] = next_idx;
-		
-		if (i % list_len == 0) {
-			list[l] = memchunk;
-			next[l] = curr_idx;
-			printf("list[%ld]  %ld\n", l,  next[l] * 8 / g_unit_size);
+	ib_chase_link(memchunk, g_unit_size, myvector.data(), ws, mlp, heads);
+	for (i = 0; i < mlp; i++)
+		printf("list[%d]  %ld\n", i, myvector[i * list_len]);
+	
+	// sampled accesses: step t of the run visits element t of every list.
+	// like pgt_dump_region(), no records without frame numbers
+	if (trace && g_trace_sample > 0 && !have_pfn)
+		printf("Warning: no physical addresses, access records skipped\n");
+	if (trace && g_trace_sample > 0 && have_pfn) {
+		int page = getpagesize();
+		for (int64_t t = 0; t < list_len; t += g_trace_sample) {
+			for (int l = 0; l < mlp; l++) {
+				int64_t u = myvector[l * list_len + t];
+				ulong va = (ulong)memchunk + u * g_unit_size;
+				pgt_write(trace, PGT_ACCESS, colors[u], va / page,
+					  paddrs[u] / page, t * mlp + l,
+					  paddrs[u] % page);
+			}
 		}
-		
-		// printf("%8d ->%8d\n", myvector[i], next_idx*4/g_unit_size);
 	}
-	
-#if 0
-        param.sched_priority = 1;
-        if(sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
-		perror("sched_setscheduler failed");
-        }
-#endif
+	if (trace)
+		fclose(trace);
 
-	clock_gettime(CLOCK_REALTIME, &end);
-	printf("Init took %.0f us\n", (double) get_elapsed(&start, &end)/1000);
+	end = ib_now_ns();
+	printf("Init took %.0f us\n", (double)(end - start)/1000);
 
 
 	long naccess;
-	clock_gettime(CLOCK_REALTIME, &start);
+	if (g_counters && !(pmu = ib_counters_open(g_events)))
+		exit(1);
+	ib_ready();
+	start = ib_now_ns();
+	ib_counters_start(pmu);
 	/* actual access */
 	if (acc_type == READ)
 		naccess = run((int64_t)repeat * list_len, mlp);
 	else
 		naccess = run_write((int64_t)repeat * list_len, mlp);
-	clock_gettime(CLOCK_REALTIME, &end);
+	ib_counters_stop(pmu);
+	end = ib_now_ns();
 
-	int64_t nsdiff = get_elapsed(&start, &end);
+	int64_t nsdiff = end - start;
 	double  avglat = (double)nsdiff/naccess;
 
 	printf("alloc. size: %ld (%ld KB)\n", g_mem_size, g_mem_size/1024);
@@ -621,6 +527,12 @@ int main(int argc, char* argv[])
 	printf("duration %.0f ns, #access %ld\n", (double)nsdiff, naccess);
 	printf("Avg. latency %.2f ns\n", avglat);	
 	printf("bandwidth %.2f MB/s\n", (double)64*1000*naccess/nsdiff);
+	ib_result("duration_ns", nsdiff);
+	ib_result("accesses", naccess);
+	ib_result("average_ns", avglat);
+	ib_result("bandwidth_mbs", (double)64*1000*naccess/nsdiff);
+	ib_counters_print(stdout, "counters: ", pmu, nullptr);
+	ib_counters_result(pmu);
 
 	return 0;
 }
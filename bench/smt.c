@@ -0,0 +1,475 @@
+/**
+ * smt: SMT sibling interference measurement microbenchmark
+ *
+ * Runs a latency-critical subject on one logical CPU and a co-runner
+ * either on its hyperthread sibling or on a separate physical core, and
+ * reports the subject's slowdown for each co-runner kernel type.
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Conditional Compilation Options
+ **************************************************************************/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE             /* See feature_test_macros(7) */
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <getopt.h>
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+#define CACHE_LINE_SIZE 64
+#define DEFAULT_SUBJECT_WS_KB 16   /* L1-resident: exposes core-private resources */
+#define DEFAULT_CORUN_WS_KB 8      /* load/store/fp co-runners stay in L1 */
+#define DEFAULT_THRASH_WS_KB 256   /* larger than any L1D */
+#define DEFAULT_ITER 2000000
+#define DEFAULT_REPEAT 5
+#define MAX_CPUS 1024
+
+#define MAX(a,b) ((a>b)?(a):(b))
+#define MIN(a,b) ((a>b)?(b):(a))
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+enum subject_type { CHASE, COMPUTE };
+
+struct corunner {
+	const char *name;
+	const char *desc;
+	void (*run)(void);
+};
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static int g_subject_ws = DEFAULT_SUBJECT_WS_KB * 1024;
+static int g_corun_ws = DEFAULT_CORUN_WS_KB * 1024;
+static int g_thrash_ws = DEFAULT_THRASH_WS_KB * 1024;
+static int64_t g_iter = DEFAULT_ITER;
+static int g_repeat = DEFAULT_REPEAT;
+static int g_subject = CHASE;
+
+static int64_t *g_chase;	   /* pointer chasing list (indices) */
+static volatile int g_stop;	   /* stop the co-runner */
+static volatile int g_ready;	   /* co-runner is running */
+static volatile int64_t g_sink;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static uint64_t nstime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int pin_cpu(int cpu)
+{
+	cpu_set_t cmask;
+
+	CPU_ZERO(&cmask);
+	CPU_SET(cpu, &cmask);
+	return sched_setaffinity(0, sizeof(cmask), &cmask);
+}
+
+/*
+ * topology
+ */
+
+/* parse a cpulist ("0,4" or "0-1,8-9") into cpus[]. returns the count */
+static int parse_cpulist(const char *str, int *cpus, int max)
+{
+	int n = 0, lo, hi;
+	const char *p = str;
+	char *end;
+
+	while (*p && *p != '\n' && n < max) {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (; lo <= hi && n < max; lo++)
+			cpus[n++] = lo;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+static int read_topology_int(int cpu, const char *name)
+{
+	char path[256];
+	FILE *fp;
+	int val = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+	return val;
+}
+
+static int read_cpulist(const char *path, int *cpus, int max)
+{
+	char buf[1024];
+	FILE *fp;
+	int n = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return 0;
+	}
+	if (fgets(buf, sizeof(buf), fp))
+		n = parse_cpulist(buf, cpus, max);
+	fclose(fp);
+	return n;
+}
+
+static int read_siblings(int cpu, int *cpus, int max)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+	return read_cpulist(path, cpus, max);
+}
+
+/* a logical CPU of the subject's physical core, or -1 if SMT is off */
+static int find_sibling(int cpu)
+{
+	int cpus[MAX_CPUS];
+	int n = read_siblings(cpu, cpus, MAX_CPUS), i;
+
+	for (i = 0; i < n; i++)
+		if (cpus[i] != cpu)
+			return cpus[i];
+	return -1;
+}
+
+/*
+ * an online CPU on another physical core, preferably in the same package.
+ * CPU ids can have holes: walk the online list, not 0..count-1
+ */
+static int find_other_core(int cpu)
+{
+	int online[MAX_CPUS];
+	int nonline = read_cpulist("/sys/devices/system/cpu/online", online,
+				   MAX_CPUS);
+	int pkg = read_topology_int(cpu, "physical_package_id");
+	int sib[MAX_CPUS], nsib = read_siblings(cpu, sib, MAX_CPUS);
+	int other = -1, c, i, j;
+
+	for (j = 0; j < nonline; j++) {
+		c = online[j];
+		for (i = 0; i < nsib && sib[i] != c; i++);
+		if (i < nsib || c == cpu)
+			continue;
+		if (read_topology_int(c, "physical_package_id") == pkg)
+			return c;
+		if (other < 0)
+			other = c;
+	}
+	return other;
+}
+
+/*
+ * co-runner kernels
+ */
+
+/* load ports: independent L1 loads, several per cycle */
+static void corun_load(void)
+{
+	int64_t *buf = aligned_alloc(CACHE_LINE_SIZE, g_corun_ws);
+	int64_t n = g_corun_ws / sizeof(int64_t), i;
+	int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+	memset(buf, 1, g_corun_ws);
+	g_ready = 1;
+	while (!g_stop) {
+		for (i = 0; i < n; i += 4) {
+			s0 += buf[i];
+			s1 += buf[i + 1];
+			s2 += buf[i + 2];
+			s3 += buf[i + 3];
+		}
+	}
+	g_sink = s0 + s1 + s2 + s3;
+	free(buf);
+}
+
+/* store buffer: back-to-back L1 stores */
+static void corun_store(void)
+{
+	volatile int64_t *buf = aligned_alloc(CACHE_LINE_SIZE, g_corun_ws);
+	int64_t n = g_corun_ws / sizeof(int64_t), i;
+
+	g_ready = 1;
+	while (!g_stop) {
+		for (i = 0; i < n; i++)
+			buf[i] = i;
+	}
+	free((void *)buf);
+}
+
+/* L1 thrash: touch one word per line of a buffer larger than the L1D */
+static void corun_l1(void)
+{
+	volatile int64_t *buf = aligned_alloc(CACHE_LINE_SIZE, g_thrash_ws);
+	int64_t n = g_thrash_ws / sizeof(int64_t), i;
+
+	memset((void *)buf, 1, g_thrash_ws);
+	g_ready = 1;
+	while (!g_stop) {
+		for (i = 0; i < n; i += CACHE_LINE_SIZE / sizeof(int64_t))
+			buf[i]++;
+	}
+	free((void *)buf);
+}
+
+/* FP: independent multiply-add chains */
+static void corun_fp(void)
+{
+	double a = 1.0, b = 1.1, c = 1.2, d = 1.3, e = 1.4, f = 1.5;
+	const double m = 0.999999, k = 1e-7;
+	int i;
+
+	g_ready = 1;
+	while (!g_stop) {
+		for (i = 0; i < 4096; i++) {
+			a = a * m + k; b = b * m + k; c = c * m + k;
+			d = d * m + k; e = e * m + k; f = f * m + k;
+			__asm__ volatile("" : "+x"(a), "+x"(b), "+x"(c),
+					 "+x"(d), "+x"(e), "+x"(f));
+		}
+	}
+	g_sink = a + b + c + d + e + f;
+}
+
+static struct corunner corunners[] = {
+	{ "load",  "L1 loads (load ports)",        corun_load },
+	{ "store", "L1 stores (store buffer)",     corun_store },
+	{ "l1",    "L1 thrash",                    corun_l1 },
+	{ "fp",    "FP multiply-add",              corun_fp },
+};
+
+struct corun_arg {
+	struct corunner *k;
+	int cpu;
+};
+
+static void *corun_thread(void *param)
+{
+	struct corun_arg *arg = param;
+
+	if (pin_cpu(arg->cpu) < 0)
+		perror("sched_setaffinity");
+	arg->k->run();
+	return NULL;
+}
+
+/*
+ * subject
+ */
+static void init_chase(void)
+{
+	int64_t n = g_subject_ws / CACHE_LINE_SIZE, i;
+	int64_t *perm = malloc(n * sizeof(int64_t));
+	const int64_t stride = CACHE_LINE_SIZE / sizeof(int64_t);
+
+	g_chase = aligned_alloc(CACHE_LINE_SIZE, n * CACHE_LINE_SIZE);
+	for (i = 0; i < n; i++)
+		perm[i] = i;
+	srand(0);
+	for (i = n - 1; i > 0; i--) {
+		int64_t j = rand() % (i + 1), tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (i = 0; i < n; i++)
+		g_chase[perm[i] * stride] = perm[(i + 1) % n] * stride;
+	free(perm);
+}
+
+/* ns per subject iteration */
+static double run_subject(void)
+{
+	uint64_t start, end;
+	int64_t i, next = 0, a = 1;
+
+	start = nstime();
+	if (g_subject == CHASE) {
+		for (i = 0; i < g_iter; i++)
+			next = g_chase[next];
+		g_sink = next;
+	} else {
+		for (i = 0; i < g_iter; i++) {
+			a = a * 3 + (a >> 7);
+			__asm__ volatile("" : "+r"(a));
+		}
+		g_sink = a;
+	}
+	end = nstime();
+	return (double)(end - start) / g_iter;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* median of g_repeat subject runs, with k running on cpu (k == NULL: solo) */
+static double measure(struct corunner *k, int cpu)
+{
+	double lat[g_repeat];
+	struct corun_arg arg = { k, cpu };
+	pthread_t tid;
+	int i;
+
+	if (k) {
+		g_stop = 0;
+		g_ready = 0;
+		pthread_create(&tid, NULL, corun_thread, &arg);
+		while (!g_ready);
+	}
+	run_subject(); /* warm up */
+	for (i = 0; i < g_repeat; i++)
+		lat[i] = run_subject();
+	if (k) {
+		g_stop = 1;
+		pthread_join(tid, NULL);
+	}
+	qsort(lat, g_repeat, sizeof(double), cmp_double);
+	return lat[g_repeat / 2];
+}
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: $ %s [<option>]*\n\n", argv[0]);
+	printf("-c: subject CPU. default=0\n");
+	printf("-s: co-runner CPU on the same physical core. default=from thread_siblings_list\n");
+	printf("-o: co-runner CPU on another physical core. default=auto\n");
+	printf("-S: subject type - chase, compute. default=chase\n");
+	printf("-m: subject working set in KB (chase). default=%d\n", DEFAULT_SUBJECT_WS_KB);
+	printf("-w: load/store co-runner working set in KB. default=%d\n", DEFAULT_CORUN_WS_KB);
+	printf("-W: l1 thrash co-runner working set in KB. default=%d\n", DEFAULT_THRASH_WS_KB);
+	printf("-i: subject iterations per run. default=%d\n", DEFAULT_ITER);
+	printf("-r: runs per measurement (median is reported). default=%d\n", DEFAULT_REPEAT);
+	printf("-h: help\n");
+	printf("\nExamples: \n$ smt -c 0 -S chase\n  <- pointer chase on CPU 0 vs. each co-runner on its sibling and on another core\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int cpuid = 0, sibling = -2, other = -2;
+	double solo, t;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:s:o:S:m:w:W:i:r:h")) != -1) {
+		switch (opt) {
+		case 'c': /* subject CPU */
+			cpuid = strtol(optarg, NULL, 0);
+			break;
+		case 's': /* sibling CPU */
+			sibling = strtol(optarg, NULL, 0);
+			break;
+		case 'o': /* other-core CPU */
+			other = strtol(optarg, NULL, 0);
+			break;
+		case 'S': /* subject type */
+			if (!strcmp(optarg, "chase"))
+				g_subject = CHASE;
+			else if (!strcmp(optarg, "compute"))
+				g_subject = COMPUTE;
+			else {
+				fprintf(stderr, "unknown subject type %s: chase or compute\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'm':
+			g_subject_ws = 1024 * strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			g_corun_ws = 1024 * strtol(optarg, NULL, 0);
+			break;
+		case 'W':
+			g_thrash_ws = 1024 * strtol(optarg, NULL, 0);
+			break;
+		case 'i':
+			g_iter = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			g_repeat = MAX(strtol(optarg, NULL, 0), 1);
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+		}
+	}
+
+	if (sibling == -2)
+		sibling = find_sibling(cpuid);
+	if (other == -2)
+		other = find_other_core(cpuid);
+
+	if (pin_cpu(cpuid) < 0) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+	if (g_subject == CHASE)
+		init_chase();
+
+	printf("subject=%s cpu=%d ws=%d KB, sibling cpu=%d, other-core cpu=%d\n",
+	       (g_subject == CHASE) ? "chase" : "compute", cpuid,
+	       g_subject_ws / 1024, sibling, other);
+	if (sibling < 0)
+		printf("no SMT sibling for cpu %d (SMT off?)\n", cpuid);
+	if (other < 0)
+		printf("no other physical core found\n");
+
+	solo = measure(NULL, 0);
+	printf("solo: %.2f ns\n", solo);
+
+	printf("%-8s %-28s %12s %8s %12s %8s\n", "corun", "", "sibling(ns)",
+	       "slowdown", "other(ns)", "slowdown");
+	for (i = 0; i < sizeof(corunners) / sizeof(corunners[0]); i++) {
+		struct corunner *k = &corunners[i];
+
+		printf("%-8s %-28s", k->name, k->desc);
+		if (sibling >= 0) {
+			t = measure(k, sibling);
+			printf(" %12.2f %8.2f", t, t / solo);
+		} else {
+			printf(" %12s %8s", "-", "-");
+		}
+		if (other >= 0) {
+			t = measure(k, other);
+			printf(" %12.2f %8.2f", t, t / solo);
+		} else {
+			printf(" %12s %8s", "-", "-");
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,187 @@
+/**
+ * topology: print the machine's topology profile for the scripts
+ *
+ * Caches, cores, clusters, packages and NUMA nodes from sysfs, the CPU
+ * from CPUID or MIDR, and what the experiments derive from them (see
+ * ib_topology() in isolbench.h): llc_ws and dram_ws in KB, the PALLOC
+ * mask and the default subject and co-runner CPUs. The profile is shell
+ * variable assignments, one per line:
+ *
+ *	$ eval "$(topology)"
+ *	$ latency -m $llc_ws -c $subject_cpu
+ *
+ * <name>_groups are the sets of CPUs that share the cache level, core
+ * (SMT siblings), cluster, package or NUMA node, as cpulists separated by
+ * spaces.
+ * <class>_cpus are the CPUs of each co-runner placement class next to the
+ * subject (see isolbench.c).
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isolbench.h"
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+static struct ib_topology g_topo;
+
+/**************************************************************************
+ * Implementation
+ **************************************************************************/
+static int key_l1(int c) { return g_topo.cpu[c].cache[1]; }
+static int key_l2(int c) { return g_topo.cpu[c].cache[2]; }
+static int key_l3(int c) { return g_topo.cpu[c].cache[3]; }
+static int key_l4(int c) { return g_topo.cpu[c].cache[4]; }
+static int key_core(int c) { return g_topo.cpu[c].package << 16 | g_topo.cpu[c].core; }
+static int key_cluster(int c) { return g_topo.cpu[c].package << 16 | g_topo.cpu[c].cluster; }
+static int key_package(int c) { return g_topo.cpu[c].package; }
+static int key_node(int c) { return g_topo.cpu[c].node; }
+
+static int (*const key_cache[IB_MAX_LEVELS + 1])(int) = {
+	NULL, key_l1, key_l2, key_l3, key_l4,
+};
+
+/* name="0-3 4-7": online CPUs grouped by key, as cpulists */
+static void print_groups(const char *name, int (*key)(int))
+{
+	int c, d, first = 1, start;
+
+	printf("%s_groups=\"", name);
+	for (c = 0; c < g_topo.nr_cpus; c++) {
+		if (!g_topo.cpu[c].online)
+			continue;
+		for (d = 0; d < c; d++)
+			if (g_topo.cpu[d].online && key(d) == key(c))
+				break;
+		if (d < c)
+			continue;	/* printed with d */
+
+		printf("%s", first ? "" : " ");
+		first = 0;
+		start = -1;
+		for (d = c; d <= g_topo.nr_cpus; d++) {
+			if (d < g_topo.nr_cpus && g_topo.cpu[d].online &&
+			    key(d) == key(c)) {
+				if (start < 0)
+					start = d;
+				continue;
+			}
+			if (start < 0)
+				continue;
+			printf("%s%d", start == c ? "" : ",", start);
+			if (d - 1 > start)
+				printf("-%d", d - 1);
+			start = -1;
+		}
+	}
+	printf("\"\n");
+}
+
+/* e.g. same_llc_cpus="1 2 3": CPUs of a placement class next to the subject */
+static void print_place(enum ib_place place)
+{
+	const char *p;
+	int c, first = 1;
+
+	for (p = ib_place_names[place]; *p; p++)
+		putchar(*p == '-' ? '_' : *p);
+	printf("_cpus=\"");
+	for (c = 0; c < g_topo.nr_cpus; c++)
+		if (g_topo.cpu[c].online && c != g_topo.subject &&
+		    ib_topo_place(&g_topo, g_topo.subject, c) == place) {
+			printf("%s%d", first ? "" : " ", c);
+			first = 0;
+		}
+	printf("\"\n");
+}
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: $ %s [<option>]*\n\n", argv[0]);
+	printf("-c <cpu> : subject CPU. default: the first online CPU\n");
+	printf("-h : help\n");
+	printf("\nExamples: \n$ eval \"$(topology)\"\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct ib_cache *cache;
+	char name[8];
+	int opt, cpu = -1, level, i;
+
+	while ((opt = getopt(argc, argv, "c:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+
+	if (ib_topology(&g_topo, cpu) < 0) {
+		perror("topology");
+		exit(1);
+	}
+
+	printf("# isolbench topology profile\n");
+	printf("model=\"%s\"\n", g_topo.model);
+	printf("cpu_id=\"%s\"\n", g_topo.id);
+	printf("nr_cpus=%d\n", g_topo.nr_online);
+	printf("nr_packages=%d\n", g_topo.nr_packages);
+	printf("nr_nodes=%d\n", g_topo.nr_nodes);
+
+	for (level = 1; level <= g_topo.llc; level++) {
+		cache = &g_topo.cache[level];
+		if (!cache->size)
+			continue;
+		printf("l%d_kb=%zu\n", level, cache->size >> 10);
+		printf("l%d_ways=%d\n", level, cache->ways);
+		printf("l%d_line=%d\n", level, cache->line);
+		printf("l%d_sets=%d\n", level, cache->sets);
+		snprintf(name, sizeof(name), "l%d", level);
+		print_groups(name, key_cache[level]);
+	}
+	printf("llc_level=%d\n", g_topo.llc);
+	print_groups("smt", key_core);
+	for (i = 0; i < g_topo.nr_cpus; i++)
+		if (g_topo.cpu[i].online && g_topo.cpu[i].cluster >= 0)
+			break;
+	if (i < g_topo.nr_cpus)
+		print_groups("cluster", key_cluster);
+	print_groups("package", key_package);
+	print_groups("node", key_node);
+
+	printf("llc_ws=%d\n", g_topo.llc_ws);
+	printf("dram_ws=%d\n", g_topo.dram_ws);
+	printf("ws_source=%s\n", g_topo.from_table ? "cpu_part" :
+	       g_topo.llc ? "sysfs" : "none");
+	if (g_topo.llc_set_mask)
+		printf("llc_set_mask=0x%08llx\n",
+		       (unsigned long long)g_topo.llc_set_mask);
+	printf("subject_cpu=%d\n", g_topo.subject);
+	for (i = 0; i < NR_IB_PLACES; i++)
+		print_place(i);
+	printf("corunner_cpus=\"");
+	for (i = 0; i < IB_CORUNNERS; i++)
+		printf("%s%d", i ? " " : "", g_topo.corunners[i]);
+	printf("\"\n");
+
+	if (!g_topo.llc_ws) {
+		fprintf(stderr, "topology: no cache sizes in sysfs and unknown "
+			"CPU part: set llc_ws and dram_ws\n");
+		return 1;
+	}
+	return 0;
+}
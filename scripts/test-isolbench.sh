@@ -12,14 +12,14 @@ test_latency_vs_bandwidth()
     [ -z "$startcpu" ] && startcpu=0
 #    [ -z "$CG_PALLOC_DIR" ] && error "CG_PALLOC_DIR is not set"
 
-    endcpu=`expr $startcpu + 3`
+    local n=0
     
     log_echo "latency($size_in_kb_subject) bandwidth_$acc_type ($size_in_kb_corun)"
     
-    for cpu in `seq $startcpu $endcpu`; do
-        if [ $cpu -ne $startcpu ]; then
-            # launch a co-runner
-	    [ -d "$CG_PALLOC_DIR" ] && echo $$ > $CG_PALLOC_DIR/core$cpu/tasks
+    for cpu in $startcpu $corunner_cpus; do
+        if [ $n -gt 0 ]; then
+            # launch the n-th co-runner
+	    [ -d "$CG_PALLOC_DIR" ] && echo $$ > $CG_PALLOC_DIR/core$n/tasks
 	    bandwidth -m $size_in_kb_corun -c $cpu -t 1000000 -a $acc_type >& /dev/null &
 	    sleep 2
 	    print_allocated_colors bandwidth
@@ -31,6 +31,7 @@ test_latency_vs_bandwidth()
 	    
         output=`grep average tmpout.txt | awk '{ print $2 }'`
 	log_echo $output
+        n=`expr $n + 1`
     # cleanup >& /dev/null
     done	
     cleanup >& /dev/null
@@ -46,14 +47,14 @@ test_bandwidth_vs_bandwidth()
     [ -z "$startcpu" ] && startcpu=0
 #    [ -z "$CG_PALLOC_DIR" ] && error "CG_PALLOC_DIR is not set"
     
-    endcpu=`expr $startcpu + 3`
+    local n=0
 
     log_echo "bandwidth_read ($size_in_kb_subject) bandwidth_$acc_type ($size_in_kb_corun)"
 
-    for cpu in `seq $startcpu $endcpu`; do 
-        if [ $cpu -ne $startcpu ]; then
-            # launch a co-runner
-	    [ -d "$CG_PALLOC_DIR" ] && echo $$ > $CG_PALLOC_DIR/core$cpu/tasks
+    for cpu in $startcpu $corunner_cpus; do 
+        if [ $n -gt 0 ]; then
+            # launch the n-th co-runner
+	    [ -d "$CG_PALLOC_DIR" ] && echo $$ > $CG_PALLOC_DIR/core$n/tasks
 	    bandwidth -m $size_in_kb_corun -c $cpu -t 1000000 -a $acc_type >& /dev/null &
 	    sleep 2
 	    print_allocated_colors bandwidth
@@ -64,6 +65,7 @@ test_bandwidth_vs_bandwidth()
         bandwidth -m $size_in_kb_subject -t 4 -c $startcpu -r 1 2> /dev/null > tmpout.txt
         output=`grep average tmpout.txt | awk '{ print $10 }'`
 	log_echo $output
+        n=`expr $n + 1`
     done	
     cleanup >& /dev/null
 }
@@ -78,6 +80,20 @@ print_env()
 
 cleanup >& /dev/null
 
+outputfile=log.txt
+startcpu=$1
+[ -z "$startcpu" ] && startcpu=0
+
+# working sets and co-runner CPUs from the topology profile (bench/topology).
+# llc_ws and dram_ws in the environment take precedence
+env_llc_ws=$llc_ws
+env_dram_ws=$dram_ws
+eval "`topology -c $startcpu`"
+[ -n "$env_llc_ws" ] && llc_ws=$env_llc_ws
+[ -n "$env_dram_ws" ] && dram_ws=$env_dram_ws
+[ -z "$llc_ws" -o "$llc_ws" = "0" ] && error "CPU specific 'llc_ws' and 'dram_ws' variables are not set"
+echo "$model ($cpu_id): llc_ws=$llc_ws dram_ws=$dram_ws co-runners on $corunner_cpus"
+
 if [ -d "/sys/kernel/debug/palloc" ]; then
     echo "This kernel supports PALLOC. initialize."
     echo flush > /sys/kernel/debug/palloc/control
@@ -94,55 +110,8 @@ if [ -d "/sys/kernel/debug/palloc" ]; then
     # set_worst     # worst partition
 fi
 
-if grep "0xc0f" /proc/cpuinfo; then
-    # cortex-a15
-    llc_ws=96
-    dram_ws=4096
-elif grep "0xc09" /proc/cpuinfo; then
-    # cortex-a9
-    llc_ws=96
-    dram_ws=4096
-elif grep "0xc07" /proc/cpuinfo; then
-    # cortex-a7
-    llc_ws=48
-    dram_ws=4096
-elif grep "0xc05" /proc/cpuinfo; then
-    # cortex-a5
-    llc_ws=48
-    dram_ws=4096
-elif grep "0xd03" /proc/cpuinfo; then
-    # cortex-a53
-    llc_ws=48
-    dram_ws=4096
-    echo "Cortex-A53. Pi3"
-elif grep "0xd08" /proc/cpuinfo; then
-    # cortex-a72
-    llc_ws=64
-    dram_ws=4096
-    echo "Cortex-A72. Pi4"
-elif grep "0xd0b" /proc/cpuinfo; then
-    # cortex-a76
-    llc_ws=768
-    dram_ws=16384
-    echo "Cortex-A76. Pi5"
-elif grep "W3530" /proc/cpuinfo; then
-    # nehalem
-    llc_ws=512
-    dram_ws=16384
-elif grep "Ryzen 3 2200G" /proc/cpuinfo; then
-    # ryzen apu
-    llc_ws=1024
-    dram_ws=16384
-else
-    error "CPU specific 'llc_ws' and 'dram_ws' variables are not set"
-fi
-
 size_in_kb_subject=$llc_ws
 
-outputfile=log.txt
-startcpu=$1
-[ -z "$startcpu" ] && startcpu=0
-
 test_latency_vs_bandwidth $dram_ws "read" $startcpu
 test_bandwidth_vs_bandwidth $dram_ws "read" $startcpu
 test_bandwidth_vs_bandwidth $llc_ws "read" $startcpu